@@ -0,0 +1,352 @@
+// Measures how the CPU solver scales with the particle count and the thread count.
+// Every combination of scenario, particle count and thread count is simulated for a few frames, and the
+// cost of each pass is written as a CSV row (see `print_usage`).
+
+#include "simulation/cpu_water_simulation.hpp"
+#include "simulation/particle_bvh.hpp"
+#include "simulation/water_scenarios.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+static void print_usage(const char* program) {
+  std::cout << "Usage: " << program << " [options]" << std::endl
+            << "  --scenarios <names>  Comma separated: center, corner, side, split-vortex, fountain, pour (default: the first four)" << std::endl
+            << "  --particles <counts> Comma separated approximate amounts of particles (default: 8000,64000,216000,1000000)" << std::endl
+            << "  --threads <counts>   Comma separated thread counts (default: 1, 2, 4, ... up to every hardware thread)" << std::endl
+            << "  --frames <count>     Measured frames per run (default: 10)" << std::endl
+            << "  --warmup <count>     Frames simulated before measuring (default: 2)" << std::endl
+            << "  --pcisph             Keep the water incompressible with PCISPH instead of the state equation" << std::endl
+            << "  --kernel-tables <samples>  Look the smoothing kernels up in tables of this many samples (scalar passes only)" << std::endl
+            << "  --bvh                Also time refitting a particle BVH after every frame against rebuilding it, and tracing" << std::endl
+            << "                       a grid of camera rays through both (adds the bvh_* and ns_ray_* columns)" << std::endl
+            << "  --output <path>      Write the CSV to a file instead of stdout" << std::endl
+            << std::endl
+            << "Every particle count models the same body of water (the radius shrinks as the count grows), and a frame" << std::endl
+            << "is as many substeps as the adaptive stepping needs. Costs are in ns per particle and substep." << std::endl
+            << "The efficiencies compare thread-seconds per particle-substep with the fewest threads, for the same particle" << std::endl
+            << "count (strong) and for the smallest particle count (weak). 1 is perfect scaling." << std::endl;
+}
+
+static bool parse_list(const char* text, std::vector<unsigned int>& values) {
+  values.clear();
+  std::stringstream stream(text);
+  std::string item;
+  while (std::getline(stream, item, ',')) {
+    char* end = nullptr;
+    unsigned long value = strtoul(item.c_str(), &end, 10);
+    if (item.empty() || *end != '\0') {
+      return false;
+    }
+    values.push_back(value);
+  }
+  return !values.empty();
+}
+
+struct BenchmarkRun {
+  WaterScenario scenario;
+  unsigned int particles;
+  unsigned int threads;
+  unsigned int frames;
+  double seconds;          // Wall time of the measured frames, including the time step selection.
+  SolverProfile profile;
+
+  // Only measured with --bvh, and not part of `seconds`.
+  double bvh_update_seconds;       // `ParticleBvh::update` after every frame, which mostly refits.
+  double bvh_build_seconds;        // A full build after every frame.
+  unsigned long long bvh_rebuilds; // Updates that rebuilt the tree.
+  double bvh_sah_ratio;            // SAH cost of the updated tree relative to a full build, after the last frame.
+  double refitted_ray_seconds;     // Tracing the rays through the updated tree.
+  double built_ray_seconds;        // Tracing them through the freshly built one.
+  unsigned long long rays;
+};
+
+// Camera rays per side of the grid that is traced through the BVHs every frame.
+static const unsigned int BVH_RAY_GRID = 128;
+
+// Rays from a camera in front of and above the box through a grid that covers the box's back wall.
+static std::vector<ParticleRay> create_camera_rays(WaterBox const& box) {
+  std::vector<ParticleRay> rays;
+  optix::float3 eye = optix::make_float3(0.0f, box.height, 3.0f * box.depth);
+  for (unsigned int j = 0; j < BVH_RAY_GRID; j++) {
+    for (unsigned int i = 0; i < BVH_RAY_GRID; i++) {
+      optix::float3 target = optix::make_float3(box.width * (2.0f * (i + 0.5f) / BVH_RAY_GRID - 1.0f),
+                                                box.height * (j + 0.5f) / BVH_RAY_GRID,
+                                                -box.depth);
+      ParticleRay ray;
+      ray.origin = eye;
+      ray.direction = optix::normalize(optix::make_float3(target.x - eye.x, target.y - eye.y, target.z - eye.z));
+      ray.t_min = 0.0f;
+      ray.t_max = 1e16f;
+      rays.push_back(ray);
+    }
+  }
+  return rays;
+}
+
+// Wall time of tracing every ray through `bvh`.
+static double trace_rays(ParticleBvh const& bvh, std::vector<ParticleRay> const& rays) {
+  auto start = std::chrono::steady_clock::now();
+  unsigned int hits = 0;
+  ParticleHit hit;
+  for (ParticleRay const& ray : rays) {
+    hits += bvh.intersect(ray, hit) ? 1 : 0;
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  // Keeps the traversal from being optimized away.
+  volatile unsigned int sink = hits;
+  (void) sink;
+  return elapsed.count();
+}
+
+// Thread-seconds per particle and substep.
+static double thread_cost(BenchmarkRun const& run) {
+  return run.seconds * run.threads / run.profile.particle_steps;
+}
+
+static BenchmarkRun run_benchmark(WaterScenario scenario,
+                                  unsigned int requested_particles,
+                                  unsigned int threads,
+                                  unsigned int warmup_frames,
+                                  unsigned int frames,
+                                  PressureSolver pressure_solver,
+                                  unsigned int kernel_table_size,
+                                  bool measure_bvh) {
+  // Same box as the interactive application, filled with the same volume of water at a finer resolution.
+  WaterBox box;
+  box.width = 0.5f;
+  box.height = 0.7f;
+  box.depth = 0.5f;
+
+  unsigned int side_length = std::max(1, (int) roundf(cbrtf((float) requested_particles)));
+  float scale = 20.0f / side_length;
+  float particle_radius = 0.0135f * scale; // [m]
+
+  unsigned int max_particles = side_length * side_length * side_length;
+  std::vector<Particle> particles = create_water_particles(scenario, side_length, particle_radius, box);
+  WaterSimulationParameters params = create_water_simulation_parameters(max_particles, particle_radius, box);
+  params.pressure_solver = pressure_solver;
+  params.kernel_table_size = kernel_table_size;
+
+  // The stable time step shrinks with the particles, so the frames do too to keep the substeps per frame similar.
+  float frame_dt = 0.01f * scale; // [s]
+
+  CpuWaterSimulation simulation(threads);
+  simulation.set_parameters(params);
+  simulation.set_particles(particles);
+  simulation.set_emitters(create_water_emitters(scenario, side_length, particle_radius, box), max_particles);
+  simulation.set_sinks(create_water_sinks(scenario, particle_radius, box));
+
+  simulation.step(0.0f);
+  for (unsigned int frame = 0; frame < warmup_frames; frame++) {
+    simulation.advance(frame_dt);
+  }
+  simulation.reset_profile();
+
+  BenchmarkRun run;
+  run.bvh_update_seconds = 0.0;
+  run.bvh_build_seconds = 0.0;
+  run.bvh_rebuilds = 0;
+  run.bvh_sah_ratio = 0.0;
+  run.refitted_ray_seconds = 0.0;
+  run.built_ray_seconds = 0.0;
+  run.rays = 0;
+
+  // The updated tree starts out freshly built from the last warmup frame.
+  std::unique_ptr<ParticleBvh> updated_bvh;
+  std::unique_ptr<ParticleBvh> built_bvh;
+  std::vector<ParticleRay> rays;
+  if (measure_bvh) {
+    updated_bvh = std::unique_ptr<ParticleBvh>(new ParticleBvh(threads));
+    built_bvh = std::unique_ptr<ParticleBvh>(new ParticleBvh(threads));
+    rays = create_camera_rays(box);
+    simulation.get_particles(particles);
+    updated_bvh->build(particles, particle_radius);
+  }
+
+  double seconds = 0.0;
+  for (unsigned int frame = 0; frame < frames; frame++) {
+    auto start = std::chrono::steady_clock::now();
+    simulation.advance(frame_dt);
+    seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (measure_bvh) {
+      simulation.get_particles(particles);
+
+      start = std::chrono::steady_clock::now();
+      run.bvh_rebuilds += updated_bvh->update(particles, particle_radius) ? 1 : 0;
+      run.bvh_update_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+      start = std::chrono::steady_clock::now();
+      built_bvh->build(particles, particle_radius);
+      run.bvh_build_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+      run.bvh_sah_ratio = updated_bvh->sah_cost() / built_bvh->sah_cost();
+      run.refitted_ray_seconds += trace_rays(*updated_bvh, rays);
+      run.built_ray_seconds += trace_rays(*built_bvh, rays);
+      run.rays += rays.size();
+    }
+  }
+
+  run.scenario = scenario;
+  run.particles = simulation.particle_count();
+  run.threads = threads;
+  run.frames = frames;
+  run.seconds = seconds;
+  run.profile = simulation.profile();
+  return run;
+}
+
+int main(int argc, char** argv) {
+  std::vector<WaterScenario> scenarios = {
+    WaterScenario::CENTER,
+    WaterScenario::CORNER,
+    WaterScenario::SIDE,
+    WaterScenario::SPLIT_VORTEX,
+  };
+  std::vector<unsigned int> particle_counts = { 8000, 64000, 216000, 1000000 };
+  std::vector<unsigned int> thread_counts;
+  unsigned int frames = 10;
+  unsigned int warmup_frames = 2;
+  PressureSolver pressure_solver = PressureSolver::STATE_EQUATION;
+  unsigned int kernel_table_size = 0;
+  bool measure_bvh = false;
+  std::string output_path;
+
+  unsigned int hardware_threads = std::max(1u, std::thread::hardware_concurrency());
+  for (unsigned int threads = 1; threads < hardware_threads; threads *= 2) {
+    thread_counts.push_back(threads);
+  }
+  thread_counts.push_back(hardware_threads);
+
+  for (int i = 1; i < argc; i++) {
+    bool has_value = i + 1 < argc;
+
+    if (strcmp(argv[i], "--scenarios") == 0 && has_value) {
+      scenarios.clear();
+      std::stringstream stream(argv[++i]);
+      std::string name;
+      while (std::getline(stream, name, ',')) {
+        WaterScenario scenario;
+        if (!parse_water_scenario(name, scenario)) {
+          std::cerr << "Unknown scenario '" << name << "'." << std::endl;
+          return EXIT_FAILURE;
+        }
+        scenarios.push_back(scenario);
+      }
+    } else if (strcmp(argv[i], "--particles") == 0 && has_value) {
+      if (!parse_list(argv[++i], particle_counts)) {
+        std::cerr << "Invalid particle counts '" << argv[i] << "'." << std::endl;
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[i], "--threads") == 0 && has_value) {
+      if (!parse_list(argv[++i], thread_counts) || std::count(thread_counts.begin(), thread_counts.end(), 0u) > 0) {
+        std::cerr << "Invalid thread counts '" << argv[i] << "'." << std::endl;
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[i], "--frames") == 0 && has_value) {
+      frames = std::max(1ul, strtoul(argv[++i], nullptr, 10));
+    } else if (strcmp(argv[i], "--warmup") == 0 && has_value) {
+      warmup_frames = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--pcisph") == 0) {
+      pressure_solver = PressureSolver::PCISPH;
+    } else if (strcmp(argv[i], "--kernel-tables") == 0 && has_value) {
+      kernel_table_size = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--bvh") == 0) {
+      measure_bvh = true;
+    } else if (strcmp(argv[i], "--output") == 0 && has_value) {
+      output_path = argv[++i];
+    } else {
+      print_usage(argv[0]);
+      return strcmp(argv[i], "--help") == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  std::sort(particle_counts.begin(), particle_counts.end());
+  std::sort(thread_counts.begin(), thread_counts.end());
+
+  std::ofstream file;
+  if (!output_path.empty()) {
+    file.open(output_path.c_str(), std::ios::trunc);
+    if (!file) {
+      std::cerr << "Could not open '" << output_path << "' for writing." << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  std::ostream& csv = output_path.empty() ? std::cout : file;
+
+  csv << "scenario,particles,threads,frames,substeps";
+  for (unsigned int pass = 0; pass < SOLVER_PASS_COUNT; pass++) {
+    csv << ",ns_" << solver_pass_name((SolverPass) pass);
+  }
+  csv << ",ns_total,avg_neighbors,max_neighbors,neighbor_rebuilds,grid_migrations,particle_reorders,hash_buckets,load_factor,collision_rate,memory_mib,strong_efficiency,weak_efficiency";
+  if (measure_bvh) {
+    csv << ",bvh_update_ms,bvh_build_ms,bvh_rebuilds,bvh_sah_ratio,ns_ray_updated,ns_ray_built";
+  }
+  csv << std::endl;
+
+  for (WaterScenario scenario : scenarios) {
+    BenchmarkRun weak_baseline;
+    bool has_weak_baseline = false;
+
+    for (unsigned int particles : particle_counts) {
+      BenchmarkRun strong_baseline;
+      bool has_strong_baseline = false;
+
+      for (unsigned int threads : thread_counts) {
+        std::cerr << water_scenario_name(scenario) << ": " << particles << " particles on " << threads << " threads" << std::endl;
+        BenchmarkRun run = run_benchmark(scenario, particles, threads, warmup_frames, frames, pressure_solver, kernel_table_size, measure_bvh);
+        SolverProfile const& profile = run.profile;
+
+        if (!has_strong_baseline) {
+          strong_baseline = run;
+          has_strong_baseline = true;
+        }
+        if (!has_weak_baseline) {
+          weak_baseline = run;
+          has_weak_baseline = true;
+        }
+
+        csv << water_scenario_name(scenario) << ',' << run.particles << ',' << run.threads << ',' << run.frames << ',' << profile.steps;
+        for (unsigned int pass = 0; pass < SOLVER_PASS_COUNT; pass++) {
+          csv << ',' << profile.nanoseconds_per_particle_step((SolverPass) pass);
+        }
+        csv << ',' << 1e9 * run.seconds / profile.particle_steps
+            << ',' << profile.average_neighbors()
+            << ',' << profile.max_neighbors
+            << ',' << profile.neighbor_rebuilds
+            << ',' << profile.grid_migrations
+            << ',' << profile.particle_reorders
+            << ',' << profile.hash_table.buckets
+            << ',' << profile.hash_table.load_factor()
+            << ',' << profile.hash_table.collision_rate()
+            << ',' << profile.memory_usage / (1024.0 * 1024.0)
+            << ',' << thread_cost(strong_baseline) / thread_cost(run)
+            << ',' << thread_cost(weak_baseline) / thread_cost(run);
+        if (measure_bvh) {
+          csv << ',' << 1e3 * run.bvh_update_seconds / run.frames
+              << ',' << 1e3 * run.bvh_build_seconds / run.frames
+              << ',' << run.bvh_rebuilds
+              << ',' << run.bvh_sah_ratio
+              << ',' << 1e9 * run.refitted_ray_seconds / run.rays
+              << ',' << 1e9 * run.built_ray_seconds / run.rays;
+        }
+        csv << std::endl;
+      }
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,419 @@
+// Runs the water simulation without a window and streams every frame to a particle cache (see `ParticleFrameWriter`).
+// Meant for long offline simulations whose frames are rendered later (e.g. with optixParticleVolumes).
+
+#include "simulation/checkpoint_writer.hpp"
+#include "simulation/cpu_water_simulation.hpp"
+#include "simulation/distributed_water_simulation.hpp"
+#include "simulation/particle_frame_writer.hpp"
+#include "simulation/signed_distance_field.hpp"
+#include "simulation/solver_profile_writer.hpp"
+#include "simulation/surface_reconstruction.hpp"
+#include "simulation/water_scenarios.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+
+static void print_usage(const char* program) {
+  std::cout << "Usage: " << program << " [options]" << std::endl
+            << "  --scenario <name>    center, corner, side, split-vortex, fountain or pour (default: split-vortex)" << std::endl
+            << "  --particles <count>  Approximate amount of particles, rounded to a cube (default: 8000)" << std::endl
+            << "                       The fountain and pour scenarios start with fewer and add water up to this amount" << std::endl
+            << "  --steps <count>      Amount of frames to simulate (default: 1000)" << std::endl
+            << "  --dt <seconds>       Simulated time per frame (default: 0.01)" << std::endl
+            << "  --output <path>      Particle cache that the frames are streamed to (default: water.pcache)" << std::endl
+            << "  --encoding <name>    float32, float16 or fixed16 (default: fixed16)" << std::endl
+            << "  --threads <count>    Simulation threads, 0 uses every hardware thread (default: 0)" << std::endl
+            << "  --processes <count>  Split the box into this many slabs, each stepped by a worker process of its own" << std::endl
+            << "                       with --threads threads (Linux only, not with --pcisph, --sleep, fountain or pour)" << std::endl
+            << "  --pcisph             Keep the water incompressible with PCISPH instead of the state equation" << std::endl
+            << "  --sleep              Stop simulating particles that have come to rest until something moves next to them" << std::endl
+            << "  --friction <mu>      Friction coefficient of the walls and the obstacle (default: 0)" << std::endl
+            << "  --projected-collisions  Project particles that left the box back onto it, instead of sweeping their motion" << std::endl
+            << "  --deterministic      Sum over the neighbors in a fixed order, so that every run is bit-identical" << std::endl
+            << "  --kernel-tables <samples>  Look the smoothing kernels up in tables of this many samples (scalar passes only)" << std::endl
+            << "  --verify <path>      Compare every frame with the same frame of a particle cache, and fail if any differs" << std::endl
+            << "  --checkpoint <path>  Periodically save the simulation state to this file" << std::endl
+            << "  --checkpoint-every <frames>  Frames between checkpoints (default: 100)" << std::endl
+            << "  --restore <path>     Continue from a checkpoint (its particles and parameters replace the options above," << std::endl
+            << "                       but the emitters and drains still come from --scenario and --particles)" << std::endl
+            << "  --mesh <prefix>      Also export the water surface of every frame to <prefix>_<frame>.obj" << std::endl
+            << "  --profile <path>     Also dump the cost of every frame's solver passes as CSV (or JSON if <path> ends in .json)" << std::endl
+            << "  --obstacle <path>    OBJ or PLY mesh that the water collides with (not saved in checkpoints)" << std::endl
+            << "  --obstacle-scale <s> Scale of the obstacle mesh (default: 1)" << std::endl
+            << "  --obstacle-offset <x,y,z>  Position of the obstacle mesh's origin [m] (default: 0,0,0)" << std::endl;
+}
+
+static bool parse_float3(const char* text, optix::float3& value) {
+  char end;
+  return sscanf(text, "%f,%f,%f%c", &value.x, &value.y, &value.z, &end) == 3;
+}
+
+// Compares the decoded frames of two particle caches exactly, and reports the first frame that differs.
+// Both should have been written with the same encoding, as each rounds differently.
+static bool verify_frames(std::string const& path, std::string const& golden_path) {
+  ParticleCacheReader reader(path);
+  ParticleCacheReader golden(golden_path);
+  if (!reader.isOpen() || !golden.isOpen()) {
+    std::cout << "Could not open '" << (reader.isOpen() ? golden_path : path) << "' for verification." << std::endl;
+    return false;
+  }
+
+  if (reader.frameCount() != golden.frameCount()) {
+    std::cout << "Verification failed: " << reader.frameCount() << " frames instead of " << golden.frameCount() << "." << std::endl;
+    return false;
+  }
+
+  ParticleCacheFrame frame, golden_frame;
+  std::vector<float> positions, golden_positions, velocities, golden_velocities;
+  for (uint32_t f = 0; f < reader.frameCount(); f++) {
+    if (!reader.mapFrame(f, frame) || !golden.mapFrame(f, golden_frame)) {
+      std::cout << "Verification failed: could not read frame " << f << "." << std::endl;
+      return false;
+    }
+
+    uint32_t count = frame.particleCount();
+    if (count != golden_frame.particleCount() || frame.time() != golden_frame.time()) {
+      std::cout << "Verification failed: frame " << f << " has " << count << " particles at t = " << frame.time()
+                << " s instead of " << golden_frame.particleCount() << " at t = " << golden_frame.time() << " s." << std::endl;
+      return false;
+    }
+
+    positions.resize(3 * count);
+    golden_positions.resize(3 * count);
+    velocities.resize(3 * count);
+    golden_velocities.resize(3 * count);
+    frame.decodePositions(positions.data());
+    golden_frame.decodePositions(golden_positions.data());
+    frame.decodeVelocities(velocities.data());
+    golden_frame.decodeVelocities(golden_velocities.data());
+
+    if (positions != golden_positions || velocities != golden_velocities) {
+      size_t differing = 0;
+      float max_distance = 0.0f;
+      for (uint32_t i = 0; i < count; i++) {
+        optix::float3 d = optix::make_float3(positions[3 * i] - golden_positions[3 * i],
+                                             positions[3 * i + 1] - golden_positions[3 * i + 1],
+                                             positions[3 * i + 2] - golden_positions[3 * i + 2]);
+        bool same = memcmp(&positions[3 * i], &golden_positions[3 * i], 3 * sizeof(float)) == 0 &&
+                    memcmp(&velocities[3 * i], &golden_velocities[3 * i], 3 * sizeof(float)) == 0;
+        differing += same ? 0 : 1;
+        max_distance = std::max(max_distance, optix::length(d));
+      }
+
+      std::cout << "Verification failed: frame " << f << " differs in " << differing << " of " << count
+                << " particles (up to " << max_distance << " m apart)." << std::endl;
+      return false;
+    }
+  }
+
+  std::cout << "Verified " << reader.frameCount() << " frames against '" << golden_path << "'." << std::endl;
+  return true;
+}
+
+int main(int argc, char** argv) {
+  WaterScenario scenario = WaterScenario::SPLIT_VORTEX;
+  unsigned int requested_particles = 8000;
+  unsigned int steps = 1000;
+  float frame_dt = 0.01f;
+  std::string output_path = "water.pcache";
+  ParticleCacheEncoding encoding = PARTICLE_CACHE_FIXED16;
+  unsigned int thread_count = 0;
+  unsigned int process_count = 0;
+  PressureSolver pressure_solver = PressureSolver::STATE_EQUATION;
+  bool sleeping = false;
+  bool deterministic = false;
+  float friction = 0.0f;
+  bool continuous_collisions = true;
+  unsigned int kernel_table_size = 0;
+  std::string verify_path;
+  std::string checkpoint_path;
+  unsigned int checkpoint_interval = 100;
+  std::string restore_path;
+  std::string mesh_prefix;
+  std::string profile_path;
+  std::string obstacle_path;
+  float obstacle_scale = 1.0f;
+  optix::float3 obstacle_offset = optix::make_float3(0.0f);
+
+  for (int i = 1; i < argc; i++) {
+    bool has_value = i + 1 < argc;
+
+    if (strcmp(argv[i], "--scenario") == 0 && has_value) {
+      if (!parse_water_scenario(argv[++i], scenario)) {
+        std::cout << "Unknown scenario '" << argv[i] << "'." << std::endl;
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[i], "--particles") == 0 && has_value) {
+      requested_particles = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--steps") == 0 && has_value) {
+      steps = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--dt") == 0 && has_value) {
+      frame_dt = strtof(argv[++i], nullptr);
+    } else if (strcmp(argv[i], "--output") == 0 && has_value) {
+      output_path = argv[++i];
+    } else if (strcmp(argv[i], "--encoding") == 0 && has_value) {
+      if (!parseParticleCacheEncoding(argv[++i], encoding)) {
+        std::cout << "Unknown encoding '" << argv[i] << "'." << std::endl;
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[i], "--threads") == 0 && has_value) {
+      thread_count = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--processes") == 0 && has_value) {
+      process_count = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--pcisph") == 0) {
+      pressure_solver = PressureSolver::PCISPH;
+    } else if (strcmp(argv[i], "--sleep") == 0) {
+      sleeping = true;
+    } else if (strcmp(argv[i], "--friction") == 0 && has_value) {
+      friction = strtof(argv[++i], nullptr);
+    } else if (strcmp(argv[i], "--projected-collisions") == 0) {
+      continuous_collisions = false;
+    } else if (strcmp(argv[i], "--deterministic") == 0) {
+      deterministic = true;
+    } else if (strcmp(argv[i], "--kernel-tables") == 0 && has_value) {
+      kernel_table_size = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--verify") == 0 && has_value) {
+      verify_path = argv[++i];
+    } else if (strcmp(argv[i], "--checkpoint") == 0 && has_value) {
+      checkpoint_path = argv[++i];
+    } else if (strcmp(argv[i], "--checkpoint-every") == 0 && has_value) {
+      checkpoint_interval = std::max(1ul, strtoul(argv[++i], nullptr, 10));
+    } else if (strcmp(argv[i], "--restore") == 0 && has_value) {
+      restore_path = argv[++i];
+    } else if (strcmp(argv[i], "--mesh") == 0 && has_value) {
+      mesh_prefix = argv[++i];
+    } else if (strcmp(argv[i], "--profile") == 0 && has_value) {
+      profile_path = argv[++i];
+    } else if (strcmp(argv[i], "--obstacle") == 0 && has_value) {
+      obstacle_path = argv[++i];
+    } else if (strcmp(argv[i], "--obstacle-scale") == 0 && has_value) {
+      obstacle_scale = strtof(argv[++i], nullptr);
+    } else if (strcmp(argv[i], "--obstacle-offset") == 0 && has_value) {
+      if (!parse_float3(argv[++i], obstacle_offset)) {
+        std::cout << "Invalid offset '" << argv[i] << "'." << std::endl;
+        return EXIT_FAILURE;
+      }
+    } else {
+      print_usage(argv[0]);
+      return strcmp(argv[i], "--help") == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  // Same setup as the interactive application (see `Application::setup_water_particles`).
+  const float particle_radius = 0.0135f; // [m]
+  WaterBox box;
+  box.width = 0.5f;
+  box.height = 0.7f;
+  box.depth = 0.5f;
+
+  unsigned int side_length = std::max(1, (int) roundf(cbrtf((float) requested_particles)));
+  unsigned int max_particles = side_length * side_length * side_length;
+  std::vector<Particle> particles = create_water_particles(scenario, side_length, particle_radius, box);
+
+  WaterSimulationParameters params = create_water_simulation_parameters(max_particles, particle_radius, box);
+  params.pressure_solver = pressure_solver;
+  params.sleeping = sleeping;
+  params.deterministic = deterministic;
+  params.friction = friction;
+  params.continuous_collisions = continuous_collisions;
+  params.kernel_table_size = kernel_table_size;
+
+  std::vector<WaterEmitter> emitters = create_water_emitters(scenario, side_length, particle_radius, box);
+  std::vector<WaterSink> sinks = create_water_sinks(scenario, particle_radius, box);
+  if (process_count > 0 && (pressure_solver == PressureSolver::PCISPH || sleeping || !emitters.empty() || !sinks.empty())) {
+    std::cout << "--processes can not be combined with --pcisph, --sleep or a scenario that adds or drains water." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::unique_ptr<CpuWaterSimulation> cpu_simulation;
+  std::unique_ptr<DistributedWaterSimulation> distributed_simulation;
+  if (process_count > 0) {
+    distributed_simulation = std::unique_ptr<DistributedWaterSimulation>(new DistributedWaterSimulation(process_count, thread_count));
+  } else {
+    cpu_simulation = std::unique_ptr<CpuWaterSimulation>(new CpuWaterSimulation(thread_count));
+  }
+  WaterSimulation& simulation = cpu_simulation ? (WaterSimulation&) *cpu_simulation : *distributed_simulation;
+  WaterSimulationState state;
+
+  if (restore_path.empty()) {
+    simulation.set_parameters(params);
+    simulation.set_particles(particles);
+  } else {
+    if (!read_water_simulation_state(restore_path, state) || !simulation.restore_state(state)) {
+      std::cout << "Could not restore the checkpoint '" << restore_path << "'." << std::endl;
+      return EXIT_FAILURE;
+    }
+    simulation.get_particles(particles);
+    std::cout << "Restored '" << restore_path << "' at t = " << simulation.time() << " s." << std::endl;
+
+    if (distributed_simulation && (simulation.parameters().pressure_solver == PressureSolver::PCISPH || simulation.parameters().sleeping)) {
+      std::cout << "--processes can not continue a checkpoint that uses PCISPH or sleeping particles." << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (cpu_simulation) {
+    cpu_simulation->set_emitters(emitters, max_particles);
+    cpu_simulation->set_sinks(sinks);
+  }
+
+  // Sampled at the particle radius, and far enough out that a particle can not pass the band in one substep.
+  if (!obstacle_path.empty()) {
+    TriangleMesh obstacle_mesh;
+    if (!load_triangle_mesh(obstacle_path, obstacle_scale, obstacle_offset, obstacle_mesh)) {
+      std::cout << "Could not load the obstacle '" << obstacle_path << "'." << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    ThreadPool pool(thread_count);
+    std::shared_ptr<SignedDistanceField> obstacle = std::make_shared<SignedDistanceField>();
+    obstacle->build(obstacle_mesh, particle_radius, 4.0f * particle_radius, pool);
+    if (cpu_simulation) {
+      cpu_simulation->set_obstacle(obstacle);
+    } else {
+      distributed_simulation->set_obstacle(obstacle);
+    }
+    std::cout << "Obstacle '" << obstacle_path << "': " << obstacle_mesh.indices.size() / 3 << " triangles, "
+              << obstacle->memory_usage() / (1024.0 * 1024.0) << " MiB distance field." << std::endl;
+  }
+
+  if (distributed_simulation && distributed_simulation->has_failed()) {
+    std::cout << "Could not start " << process_count << " worker processes." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  ParticleFrameWriter writer(output_path, encoding, particle_radius);
+  if (!writer.is_open()) {
+    std::cout << "Could not open '" << output_path << "' for writing." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::unique_ptr<SolverProfileWriter> profile_writer;
+  if (!profile_path.empty()) {
+    profile_writer = std::unique_ptr<SolverProfileWriter>(new SolverProfileWriter(profile_path));
+    if (!profile_writer->is_open()) {
+      std::cout << "Could not open '" << profile_path << "' for writing." << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  std::cout << "Simulating " << particles.size() << " particles (" << (restore_path.empty() ? water_scenario_name(scenario) : "restored") << ") for "
+            << steps << " frames, writing " << particleCacheEncodingName(encoding) << " frames to '" << output_path << "'." << std::endl;
+
+  SurfaceReconstructor surface(thread_count);
+  surface.set_parameters(create_surface_reconstruction_parameters(particle_radius));
+  SurfaceMesh mesh;
+  unsigned int meshes_failed = 0;
+
+  // Frames are exported from the main thread, between the steps.
+  auto write_mesh = [&](unsigned int frame) {
+    if (mesh_prefix.empty()) {
+      return;
+    }
+
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), "_%05u.obj", frame);
+    surface.reconstruct(particles, mesh);
+    if (!write_obj(mesh_prefix + suffix, mesh)) {
+      meshes_failed++;
+    }
+  };
+
+  auto start = std::chrono::steady_clock::now();
+
+  // Frame 0 is the initial state (after the densities and forces have been computed once).
+  // A restored simulation already has them, and must not be stepped to stay identical to the original run.
+  if (restore_path.empty()) {
+    simulation.step(0.0f);
+    simulation.get_particles(particles);
+  }
+  // The writer takes `particles` over (see particle_frame_writer.hpp), so the mesh is reconstructed first.
+  write_mesh(0);
+  writer.write(simulation.time(), particles);
+
+  CheckpointWriter checkpoints;
+
+  // Every frame is profiled on its own.
+  simulation.reset_profile();
+
+  unsigned int substeps = 0;
+  for (unsigned int frame = 1; frame <= steps; frame++) {
+    substeps += simulation.advance(frame_dt);
+    if (distributed_simulation && distributed_simulation->has_failed()) {
+      std::cout << "A worker process failed in frame " << frame << "." << std::endl;
+      return EXIT_FAILURE;
+    }
+    if (profile_writer) {
+      profile_writer->write(frame, simulation.time(), simulation.profile());
+      simulation.reset_profile();
+    }
+    simulation.get_particles(particles);
+    write_mesh(frame);
+    writer.write(simulation.time(), particles);
+
+    // Only copying the state stalls the simulation, the file is written in the background.
+    if (!checkpoint_path.empty() && (frame % checkpoint_interval == 0 || frame == steps)) {
+      simulation.save_state(state);
+      checkpoints.write(checkpoint_path, state);
+    }
+
+    if (frame % 100 == 0 || frame == steps) {
+      double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      std::cout << "Frame " << frame << "/" << steps << " (" << elapsed << " s, "
+                << (double) substeps / frame << " substeps per frame, ";
+      if (cpu_simulation) {
+        std::cout << cpu_simulation->awake_particle_count() << " of " << cpu_simulation->particle_count() << " particles awake)" << std::endl;
+      } else {
+        std::vector<unsigned int> owned, ghosts;
+        distributed_simulation->get_slab_counts(owned, ghosts);
+        std::cout << "particles per process:";
+        for (unsigned int w = 0; w < owned.size(); w++) {
+          std::cout << " " << owned[w] << " + " << ghosts[w] << " ghosts";
+        }
+        std::cout << ")" << std::endl;
+      }
+    }
+  }
+
+  writer.close();
+  checkpoints.wait();
+  if (profile_writer) {
+    profile_writer->close();
+  }
+
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::cout << "Wrote " << writer.frames_written() << " frames (" << writer.bytes_written() / (1024.0 * 1024.0)
+            << " MiB) in " << elapsed << " s." << std::endl;
+
+  if (!checkpoint_path.empty()) {
+    std::cout << "Wrote " << checkpoints.checkpoints_written() << " checkpoints to '" << checkpoint_path << "'." << std::endl;
+  }
+
+  if (writer.failed()) {
+    std::cout << "Failed to write every frame to '" << output_path << "'." << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (meshes_failed > 0) {
+    std::cout << "Failed to write " << meshes_failed << " surface meshes to '" << mesh_prefix << "_*.obj'." << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (profile_writer && profile_writer->failed()) {
+    std::cout << "Failed to write the profile to '" << profile_path << "'." << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (checkpoints.failed()) {
+    std::cout << "Failed to write a checkpoint to '" << checkpoint_path << "'." << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (!verify_path.empty() && !verify_frames(output_path, verify_path)) {
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
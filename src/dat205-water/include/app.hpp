@@ -1,11 +1,17 @@
 #pragma once
 
 #include "camera.hpp"
+#include "simulation/simulation_pipeline.hpp"
+#include "simulation/solver_profile_writer.hpp"
+#include "simulation/water_scenarios.hpp"
+#include "simulation/surface_reconstruction.hpp"
+#include "simulation/water_simulation.hpp"
 #include "util/opengl.hpp"
 #include "util/optix.hpp"
 #include "util/window.hpp"
 
 #include <memory>
+#include <string>
 
 // Enable the assert() macro.
 #undef NDEBUG
@@ -15,6 +21,16 @@ struct ApplicationCreateInfo {
   GLFWwindow* window;
   unsigned int window_width;
   unsigned int window_height;
+  WaterSimulationBackend simulation_backend;
+  PressureSolver pressure_solver;
+  WaterScenario scenario;
+  bool render_surface;
+  std::string obstacle_path; // OBJ or PLY mesh that the water collides with (CPU backend only), or empty.
+  float obstacle_scale;
+  optix::float3 obstacle_offset;
+  bool pipelined; // Simulate the next frame while the current one renders (CPU backend only).
+  std::string profile_path; // CSV or JSON file that the cost of every frame is dumped to, or empty.
+  bool deterministic; // Sum over the neighbors in a fixed order so that every run is the same (see WaterSimulationParameters).
 };
 
 class Application {
@@ -56,19 +72,74 @@ private:
   float m_box_height;
   float m_box_depth;
 
+  WaterSimulationBackend m_simulation_backend;
+  PressureSolver m_pressure_solver;
+  bool m_deterministic;
+  WaterScenario m_scenario;
+  std::unique_ptr<WaterSimulation> m_simulation;
+  bool m_pipelined;
+  std::unique_ptr<SimulationPipeline> m_simulation_pipeline; // Null unless the CPU backend is pipelined.
+
+  // Shown in the GUI. Captured while the simulation is idle, since it may be stepping on another thread otherwise.
+  unsigned int m_substep_count;
+  unsigned int m_pressure_iterations;
+  size_t m_awake_particle_count;
+  double m_simulation_time;
+  SolverProfile m_frame_profile; // The steps of the last simulated frame (empty while paused).
+
+  optix::GeometryGroup m_water_group;
+  optix::GeometryInstance m_particles_instance;
   optix::Acceleration m_water_acceleration;
   optix::Buffer m_particles_buffer;
+  std::vector<Particle> m_particles; // Host copy used to upload CPU simulated particles for rendering.
   int m_particles_count;
+  size_t m_particles_capacity; // Particles that fit in `m_particles_buffer`.
+  int m_max_particles_count; // The scenarios with emitters start out with fewer particles.
   float m_particles_radius;
 
-  optix::Buffer m_hash_buffer;
-
   void setup_water_simulation();
   void setup_water_particles();
   void setup_water_geometry();
   void setup_water_physics();
+  WaterBox water_box() const;
 
   void update_water_simulation(float dt);
+  void wait_for_water_simulation();
+  void capture_water_simulation_stats();
+  void set_pressure_solver(PressureSolver pressure_solver);
+  void set_sleeping(bool sleeping);
+
+  // Water Surface
+  bool m_render_surface; // Render a reconstructed surface mesh instead of one sphere per particle.
+  std::unique_ptr<SurfaceReconstructor> m_surface_reconstructor;
+  SurfaceMesh m_surface_mesh;
+  optix::GeometryInstance m_surface_instance;
+  optix::Geometry m_surface_geometry;
+
+  void setup_water_surface();
+  void update_water_surface();
+  void set_render_surface(bool render_surface);
+
+  // Obstacle
+  std::string m_obstacle_path;
+  float m_obstacle_scale;
+  optix::float3 m_obstacle_offset;
+
+  void setup_obstacle();
+
+  // Profiling
+  static const unsigned int PROFILE_HISTORY = 120; // Frames shown in the GUI.
+
+  double m_render_seconds; // The last render launch.
+  std::vector<float> m_pass_history[SOLVER_PASS_COUNT]; // [ms] Ring buffers of the last frames.
+  std::vector<float> m_render_history;                  // [ms]
+  unsigned int m_history_offset;                        // The oldest frame in the ring buffers.
+  unsigned int m_profiled_frames;
+  std::unique_ptr<SolverProfileWriter> m_profile_writer;
+
+  void setup_profiling(std::string const& profile_path);
+  void record_frame_profile();
+  void render_profile_gui();
 
   // OptiX Rendering
   optix::Buffer m_output_buffer;
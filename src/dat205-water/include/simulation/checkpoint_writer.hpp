@@ -0,0 +1,48 @@
+#pragma once
+
+#include "simulation/water_simulation_state.hpp"
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Writes checkpoints (see water_simulation_state.hpp) on a background thread, so that saving one does not stall the simulation.
+// Only the newest checkpoint matters, so one that is queued while another is still waiting to be written replaces it.
+class CheckpointWriter {
+public:
+  CheckpointWriter();
+
+  // Finishes writing the queued checkpoint.
+  ~CheckpointWriter();
+
+  // Queues `state` to be written to `path` without copying it.
+  // `state` is swapped with the state of an already written checkpoint, so its contents are unspecified afterwards.
+  void write(std::string const& path, WaterSimulationState& state);
+
+  // Blocks until every queued checkpoint has been written.
+  void wait();
+
+  unsigned int checkpoints_written();
+  unsigned int checkpoints_replaced(); // Queued, but replaced by a newer one before they were written.
+  bool failed();
+
+private:
+  std::mutex m_mutex;
+  std::condition_variable m_checkpoint_available;
+  std::condition_variable m_idle;
+
+  WaterSimulationState m_pending;
+  std::string m_pending_path;
+  bool m_has_pending;
+  bool m_writing;
+  bool m_stopping;
+
+  unsigned int m_checkpoints_written;
+  unsigned int m_checkpoints_replaced;
+  bool m_failed;
+
+  std::thread m_thread;
+
+  void writer_loop();
+};
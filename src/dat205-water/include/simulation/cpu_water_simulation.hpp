@@ -0,0 +1,184 @@
+#pragma once
+
+#include "simulation/neighbor_list.hpp"
+#include "simulation/particle_arrays.hpp"
+#include "simulation/particle_pool.hpp"
+#include "simulation/signed_distance_field.hpp"
+#include "simulation/sph_kernels.hpp"
+#include "simulation/sph_simd.hpp"
+#include "simulation/uniform_grid.hpp"
+#include "simulation/water_emitters.hpp"
+#include "simulation/water_simulation.hpp"
+#include "util/thread_pool.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Host implementation of the solver in water_simulation.cu.
+// The physics passes are ported one-to-one and distributed over every core, but neighbors are found
+// with a counting-sort `UniformGrid` instead of the fixed-slot hash table and then cached in a
+// `NeighborList` that is shared by all passes (and steps) until the particles have moved too far.
+class CpuWaterSimulation : public WaterSimulation {
+public:
+  // A `thread_count` of 0 uses every hardware thread.
+  CpuWaterSimulation(unsigned int thread_count = 0);
+
+  void set_parameters(WaterSimulationParameters const& parameters) override;
+  void set_particles(std::vector<Particle> const& particles) override;
+  void get_particles(std::vector<Particle>& particles) override;
+  void step(float dt) override;
+
+  unsigned int last_pressure_iterations() const override;
+
+  // Adds the neighbor lists and the motion measured for adaptive stepping, which the next step depends on.
+  // The grid is rebuilt from scratch whenever the lists are, so it is not part of the state.
+  void save_state(WaterSimulationState& state) override;
+  bool restore_state(WaterSimulationState const& state) override;
+
+  // The density and force sums use the widest instruction set the CPU supports, unless a narrower one is requested.
+  SimdLevel simd_level() const;
+  void set_simd_level(SimdLevel level);
+
+  // Particles, grid, neighbor lists and solver scratch space [bytes].
+  size_t memory_usage() const;
+
+  // A static obstacle that the particles collide with in addition to the box (nullptr for none).
+  // It should have been built with a band of at least the particle radius plus the distance a particle
+  // moves in one substep, or particles may pass through it.
+  void set_obstacle(std::shared_ptr<SignedDistanceField const> obstacle);
+
+  // Particles that are simulated in the next step (all of them unless sleeping is enabled).
+  size_t awake_particle_count() const;
+
+  // Nozzles that add water at the start of every step, until there are `max_particles`, and drains that remove
+  // it at the end (see cpu_emitters.cpp). Emitters are not part of the saved state, but how far along they are is.
+  // `get_particles` keeps the remaining particles in order, and appends the new ones.
+  void set_emitters(std::vector<WaterEmitter> const& emitters, size_t max_particles);
+  void set_sinks(std::vector<WaterSink> const& sinks);
+
+  size_t particle_count() const;
+
+  // Particles that the arrays have room for. It doubles whenever the emitters run out of room.
+  size_t particle_capacity() const;
+
+  // For the slab workers of `DistributedWaterSimulation` (see cpu_halo.cpp). `exchange_particles` simulates the
+  // particles `ids` (in increasing order) of `particles` from now on: those that it already simulated keep their
+  // slots, and the neighbor lists are only rebuilt if any came or went. `get_particles` then returns them in the
+  // order of `ids`, and `set_particle` replaces the state of the n-th of them in place.
+  void exchange_particles(std::vector<unsigned int> const& ids, Particle const* particles);
+  void set_particle(size_t n, Particle const& particle);
+
+private:
+  ThreadPool m_pool;
+  SphKernelConstants m_kernels;
+  SimdLevel m_simd_level;
+
+  // The kernels of the scalar passes (see sph_kernels.hpp).
+  AnalyticSphKernels m_analytic_kernels;
+  TabulatedSphKernels m_tabulated_kernels; // Empty unless `kernel_table_size` is set.
+
+  SimdLevel pass_simd_level() const; // The scalar passes in deterministic mode or with kernel tables.
+
+  ParticleArrays m_particles;
+  ParticlePool m_particle_pool; // Which slots of `m_particles` (and every other per-particle array) hold a particle.
+
+  // The slots of the particles in the order that `get_particles` returns them, which is the order they were set
+  // or emitted in. Particles change slots whenever they are compacted or sorted (see cpu_reordering.cpp).
+  std::vector<unsigned int> m_output_order;
+  std::vector<unsigned int> m_output_ranks; // The index in `m_output_order` of each slot (deterministic mode only).
+  std::vector<unsigned int> m_particle_ids;  // Of the particles in `m_output_order`, as of the last exchange.
+
+  void load_particle(unsigned int i, Particle const& particle);
+
+  // Sorting the particles by where they are (see cpu_reordering.cpp).
+  unsigned int m_rebuilds_since_reorder;
+  ParticleArrays m_reorder_scratch;
+  std::vector<std::pair<uint64_t, unsigned int>> m_reorder_keys; // Morton code and slot of each particle.
+
+  void reorder_particles(float cell_size);
+  UniformGrid m_grid;
+  HashTableStatistics m_grid_statistics; // As of the last neighbor rebuild.
+  NeighborList m_neighbors;
+  std::shared_ptr<SignedDistanceField const> m_obstacle;
+
+  // Tracked while integrating so that adaptive stepping needs no extra sweep over the particles.
+  bool m_motion_valid;
+  float m_max_speed;
+  float m_max_acceleration;
+
+  void measure_motion(float& max_speed, float& max_acceleration) override;
+
+  // Sleeping (see `WaterSimulationParameters::sleeping`). Every pass only visits the awake particles.
+  std::vector<unsigned int> m_awake_particles; // In increasing order.
+  std::vector<uint8_t> m_asleep;
+  std::vector<uint8_t> m_moving;      // Whether the particle was faster than the wake speed during the last step.
+  std::vector<uint8_t> m_still_steps; // Steps in a row that the particle has stayed near its rest position (at most 255).
+  std::vector<optix::float3> m_rest_positions;
+
+  void wake_all_particles();
+  void update_sleeping();
+  void update_awake_particles();
+
+  // Emitters and sinks (see cpu_emitters.cpp).
+  std::vector<WaterEmitter> m_emitters;
+  std::vector<WaterSink> m_sinks;
+  size_t m_max_particles;
+  std::vector<float> m_emitter_progress;        // How far the last layer of each emitter has moved [m].
+  std::vector<unsigned int> m_emitter_layers;   // Layers emitted by each emitter.
+
+  void emit_particles(float dt);
+  void drain_particles();
+  void add_particle(optix::float3 position, optix::float3 velocity);
+  void resize_particle_slots();
+  void compact_particles();
+  void save_particle_pool(StateSectionWriter& writer) const;
+  bool restore_particle_pool(StateSectionReader& reader);
+  uint8_t const* alive_flags() const; // nullptr while every slot holds a particle.
+
+  // PCISPH state (see cpu_pcisph.cpp).
+  float m_pcisph_delta; // Pressure per density error, times dt^2.
+  unsigned int m_pressure_iterations;
+  std::vector<float> m_predicted_x;
+  std::vector<float> m_predicted_y;
+  std::vector<float> m_predicted_z;
+  std::vector<float> m_predicted_density;
+  std::vector<float> m_density_error;
+  std::vector<float> m_pressure_ax;
+  std::vector<float> m_pressure_ay;
+  std::vector<float> m_pressure_az;
+
+  float pcisph_delta() const;
+  void update_pressure_pcisph(float dt);
+  void predict_positions(float dt);
+  float predict_density_error();
+  void update_pressure_acceleration();
+
+  template<typename Kernels> void predicted_density_pass(Kernels const& kernels);
+  template<typename Kernels> void pressure_acceleration_pass(Kernels const& kernels);
+
+  // Passes (see the RT_PROGRAMs with the same names).
+  void update_nearest_neighbors();
+  void update_particles_data();
+  void update_force();
+  void update_particles(float dt);
+
+  // The scalar versions of the density and force passes, for either kernel set.
+  template<typename Kernels> void density_pass(Kernels const& kernels);
+  template<typename Kernels> void force_pass(Kernels const& kernels);
+
+  // Forces
+  template<typename Kernels> optix::float3 pressure_force(Kernels const& kernels, unsigned int i, NeighborRange nn) const;
+  template<typename Kernels> optix::float3 viscosity_force(Kernels const& kernels, unsigned int i, NeighborRange nn) const;
+  optix::float3 gravity_force(float particle_density) const;
+  template<typename Kernels> optix::float3 surface_tension_force(Kernels const& kernels, unsigned int i, NeighborRange nn) const;
+
+  // Integration
+  void swept_collision(optix::float3 previous, optix::float3& position, optix::float3& velocity, float dt) const;
+  bool box_time_of_impact(optix::float3 start, optix::float3 end, optix::float3 velocity, float& toi, optix::float3& surface_normal) const;
+  bool obstacle_time_of_impact(optix::float3 start, optix::float3 end, optix::float3 velocity, float& toi, optix::float3& surface_normal) const;
+  optix::float3 collision_response(optix::float3 velocity, optix::float3 surface_normal) const;
+  void collision_detection(optix::float3& position, optix::float3& velocity, float dt) const;
+  void obstacle_collision(optix::float3& position, optix::float3& velocity, float dt) const;
+};
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "simulation/signed_distance_field.hpp"
+#include "simulation/water_simulation.hpp"
+
+#include <memory>
+#include <vector>
+
+struct DistributedSharedState;
+enum class WorkerCommand;
+
+// Splits the box into slabs along x and steps each slab in a worker process of its own (Linux only).
+//
+// The particles live in memory that is shared with the workers. Each worker keeps the particles of its slab,
+// plus a halo of ghost particles within two support radii (and the neighbor skin) of it, in a
+// `CpuWaterSimulation` of its own. Every step, it reads the ghosts that the other workers stepped, takes the
+// step, and writes back only the particles it owns. The ghosts within one support radius of the slab then
+// have the same neighbors as in the full simulation, so their densities, and with them the forces on the owned
+// particles, are exact. The owned particles and the ghosts keep the order of the shared arrays, so with
+// `deterministic` set every sum runs in the same order as in a single `CpuWaterSimulation`, and the result is
+// bit-identical to it.
+//
+// Particles only change owners when the workers exchange them, which is once some particle may have moved half
+// the skin (like a neighbor list rebuild), or when the slabs are moved to balance the particle counts because
+// one holds 10% more than the average. Each worker then finds its particles in lists of the others' particles
+// that are sorted by x, so a worker only ever reads its slab and halo. In between, the solvers keep their grids,
+// neighbor lists and particle order.
+//
+// Reading the halo from shared memory could be replaced with sending it to a process on another machine
+// without touching the solver. Emitters, sinks, sleeping and PCISPH are not supported: they need state that
+// moves with the particles, or (for PCISPH) a halo that grows with every pressure iteration.
+class DistributedWaterSimulation : public WaterSimulation {
+public:
+  // `thread_count` simulation threads per worker process (0 divides the hardware threads between them).
+  DistributedWaterSimulation(unsigned int process_count, unsigned int thread_count = 1);
+  ~DistributedWaterSimulation();
+
+  void set_parameters(WaterSimulationParameters const& parameters) override;
+
+  // (Re)starts the workers if the particles no longer fit in the shared memory.
+  void set_particles(std::vector<Particle> const& particles) override;
+  void get_particles(std::vector<Particle>& particles) override;
+  void step(float dt) override;
+
+  // Restarts the workers, which only see the obstacle that was set when they were started.
+  void set_obstacle(std::shared_ptr<SignedDistanceField const> obstacle);
+
+  size_t particle_count() const;
+  unsigned int process_count() const;
+
+  // Whether a worker could not be started or stopped responding. The simulation no longer steps after that.
+  bool has_failed() const;
+
+  // Particles owned by each worker in the last step, and the ghosts it copied.
+  void get_slab_counts(std::vector<unsigned int>& owned, std::vector<unsigned int>& ghosts) const;
+
+private:
+  unsigned int m_process_count;
+  unsigned int m_thread_count;
+  std::shared_ptr<SignedDistanceField const> m_obstacle;
+
+  DistributedSharedState* m_shared;
+  size_t m_shared_size;     // [bytes]
+  size_t m_capacity;        // Particles that fit in each of the shared particle arrays.
+  std::vector<int> m_workers; // Process ids.
+  bool m_failed;
+  bool m_balanced;          // Whether the slabs were placed for the current particles.
+  bool m_exchange;          // Whether the workers exchange particles before the next step.
+  bool m_published;         // Whether the workers' lists hold the current particles.
+
+  // Measured by the workers during the last step (see `measure_motion`).
+  bool m_motion_valid;
+  float m_max_speed;
+  float m_max_acceleration;
+
+  void measure_motion(float& max_speed, float& max_acceleration) override;
+
+  bool start_workers(size_t capacity);
+  void stop_workers();
+  bool run_workers(WorkerCommand command);
+  bool wait_for_workers();
+  void publish_particles();
+  void balance_slabs();
+};
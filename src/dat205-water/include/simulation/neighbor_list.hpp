@@ -0,0 +1,80 @@
+#pragma once
+
+#include "simulation/uniform_grid.hpp"
+#include "simulation/water_simulation_state.hpp"
+
+#include <cstdint>
+#include <vector>
+
+// The neighbors of a single particle.
+struct NeighborRange {
+  unsigned int const* first;
+  unsigned int const* last;
+
+  unsigned int const* begin() const { return first; }
+  unsigned int const* end() const { return last; }
+  unsigned int size() const { return last - first; }
+};
+
+// Cached neighbor lists (Verlet lists) in compressed sparse row form.
+//
+// Pairs are gathered within `support_radius + skin`, so the lists stay complete until some particle has
+// moved more than half the skin since they were built. Until then they can be shared by every SPH
+// sum of every step without searching the grid again.
+class NeighborList {
+public:
+  NeighborList();
+
+  // Gathers every pair of particles within `radius` of each other.
+  // The grid must have been built from `particles` with a cell size of at least `radius`, and with the same
+  // `alive` flags. Particles whose flag is not set get no neighbors.
+  // The neighbors are in the order the grid visits them, or in increasing order of `order[j]` if it is given.
+  void build(ParticleArrays const& particles, UniformGrid const& grid, float radius, float skin, ThreadPool& pool,
+             uint8_t const* alive = nullptr, unsigned int const* order = nullptr);
+
+  // Forgets the lists so that the next `needs_rebuild` is true.
+  void clear();
+
+  // Whether some pair within the support radius may be missing from the lists.
+  // Particles whose `alive` flag is not set are ignored.
+  bool needs_rebuild(ParticleArrays const& particles, ThreadPool& pool, uint8_t const* alive = nullptr) const;
+
+  NeighborRange neighbors(unsigned int particle_index) const;
+
+  // The raw CSR arrays.
+  unsigned int const* offsets() const;
+  unsigned int const* indices() const;
+
+  // Checkpointing of the lists, including where the particles were when they were built.
+  void save(StateSectionWriter& writer) const;
+  bool restore(StateSectionReader& reader);
+
+  size_t pair_count() const;
+  unsigned int max_neighbor_count() const; // Of any single particle.
+  size_t memory_usage() const; // [bytes]
+
+private:
+  float m_skin;
+  unsigned int m_max_neighbor_count;
+
+  std::vector<unsigned int> m_offsets; // Particle `i` has the neighbors [m_offsets[i], m_offsets[i + 1]).
+  std::vector<unsigned int> m_indices;
+
+  // Where the particles were when the lists were built.
+  std::vector<optix::float3> m_reference_positions;
+};
+
+inline NeighborRange NeighborList::neighbors(unsigned int particle_index) const {
+  NeighborRange range;
+  range.first = m_indices.data() + m_offsets[particle_index];
+  range.last = m_indices.data() + m_offsets[particle_index + 1];
+  return range;
+}
+
+inline unsigned int const* NeighborList::offsets() const {
+  return m_offsets.data();
+}
+
+inline unsigned int const* NeighborList::indices() const {
+  return m_indices.data();
+}
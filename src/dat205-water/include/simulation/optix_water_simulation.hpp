@@ -0,0 +1,26 @@
+#pragma once
+
+#include "simulation/water_simulation.hpp"
+
+#include <optixu/optixpp_namespace.h>
+
+// Runs the ray generation programs in water_simulation.cu directly on the particles buffer that is rendered.
+class OptixWaterSimulation : public WaterSimulation {
+public:
+  OptixWaterSimulation(optix::Context& ctx, optix::Buffer particles_buffer);
+
+  void set_parameters(WaterSimulationParameters const& parameters) override;
+  void set_particles(std::vector<Particle> const& particles) override;
+  void get_particles(std::vector<Particle>& particles) override;
+  void step(float dt) override;
+
+private:
+  optix::Context& m_ctx;
+  optix::Buffer m_particles_buffer;
+  optix::Buffer m_hash_buffer;
+  optix::Buffer m_counters_buffer; // See `solver_counters` in water_simulation.cu.
+  unsigned int m_particles_count;
+
+  // Sizes the hash table for the particle count and the box, and clears it if `clear` or if it was resized.
+  void update_hash_table(bool clear);
+};
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "shaders/cuda/common.cuh"
+
+#include <vector>
+
+// Structure-of-arrays storage of the simulated particles.
+//
+// The interleaved `Particle` struct pulls every field through the cache even when a pass only needs a
+// few of them (e.g. the density sum only reads positions). Keeping each component in its own array lets
+// the CPU passes stream exactly the fields they use. The AoS layout is still used for rendering, so
+// conversions in both directions are provided.
+struct ParticleArrays {
+  // Position [m]
+  std::vector<float> x;
+  std::vector<float> y;
+  std::vector<float> z;
+
+  // Velocity [m / s]
+  std::vector<float> vx;
+  std::vector<float> vy;
+  std::vector<float> vz;
+
+  // Force density [N / m^3]
+  std::vector<float> fx;
+  std::vector<float> fy;
+  std::vector<float> fz;
+
+  std::vector<float> density;  // [kg / m^3]
+  std::vector<float> pressure; // [Pa]
+
+  size_t size() const;
+  void resize(size_t count);
+  void reserve(size_t count);
+  size_t memory_usage() const; // [bytes]
+
+  optix::float3 position(size_t i) const;
+  optix::float3 velocity(size_t i) const;
+  optix::float3 force(size_t i) const;
+
+  void set_position(size_t i, optix::float3 position);
+  void set_velocity(size_t i, optix::float3 velocity);
+  void set_force(size_t i, optix::float3 force);
+
+  // Copies every field of particle `from` to particle `to`.
+  void move(size_t from, size_t to);
+
+  // Replaces the particles with `source[order[0]], source[order[1]], ...`.
+  void gather(ParticleArrays const& source, std::vector<unsigned int> const& order);
+
+  // Conversion to and from the AoS layout of the particles buffer.
+  void from_particles(std::vector<Particle> const& particles);
+  void to_particles(std::vector<Particle>& particles) const;
+
+  // Only the particles `order[0], order[1], ...`, in that order.
+  void to_particles(std::vector<Particle>& particles, std::vector<unsigned int> const& order) const;
+};
+
+inline size_t ParticleArrays::size() const {
+  return x.size();
+}
+
+inline optix::float3 ParticleArrays::position(size_t i) const {
+  return optix::make_float3(x[i], y[i], z[i]);
+}
+
+inline optix::float3 ParticleArrays::velocity(size_t i) const {
+  return optix::make_float3(vx[i], vy[i], vz[i]);
+}
+
+inline optix::float3 ParticleArrays::force(size_t i) const {
+  return optix::make_float3(fx[i], fy[i], fz[i]);
+}
+
+inline void ParticleArrays::set_position(size_t i, optix::float3 position) {
+  x[i] = position.x;
+  y[i] = position.y;
+  z[i] = position.z;
+}
+
+inline void ParticleArrays::set_velocity(size_t i, optix::float3 velocity) {
+  vx[i] = velocity.x;
+  vy[i] = velocity.y;
+  vz[i] = velocity.z;
+}
+
+inline void ParticleArrays::set_force(size_t i, optix::float3 force) {
+  fx[i] = force.x;
+  fy[i] = force.y;
+  fz[i] = force.z;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "shaders/cuda/common.cuh"
+#include "util/thread_pool.hpp"
+
+#include <vector>
+
+// A ray as the renderer traces it: the direction is normalized, and only hits within (t_min, t_max) count.
+struct ParticleRay {
+  optix::float3 origin;
+  optix::float3 direction;
+  float t_min;
+  float t_max;
+};
+
+struct ParticleHit {
+  unsigned int particle; // Index into the particles that the BVH was last updated with.
+  float t;               // [m] Distance along the ray.
+};
+
+// Bounding volume hierarchy over the particle spheres, for tracing rays on the CPU.
+//
+// The tree is built top-down with binned SAH, one level at a time with the nodes of a level split in parallel.
+// Between builds it is only refitted to the new positions: bottom-up, one level at a time, which keeps the
+// topology and just moves the boxes. Particles that drift apart make the refitted boxes overlap more and more, so
+// the SAH cost is recomputed after every refit, and the tree is rebuilt once it has grown past the rebuild threshold
+// since the last build. The growth is that of the absolute cost (the summed box areas, weighted by what each box
+// holds), as water that spreads out also grows the root box that the SAH cost is relative to, which hides the
+// overlap. Rays hit the spheres exactly like `ray_intersection` in water_rendering.cu.
+class ParticleBvh {
+public:
+  static const unsigned int MAX_LEAF_SIZE = 4;
+  static const unsigned int SAH_BINS = 16;
+
+  // A `thread_count` of 0 uses every hardware thread.
+  ParticleBvh(unsigned int thread_count = 0);
+
+  // Rebuild once the refitted tree costs this many times as much as after the last build (default: 1.5).
+  void set_rebuild_threshold(float threshold);
+  float rebuild_threshold() const;
+
+  // Refits the tree to `particles`, or rebuilds it if their count changed or the refitted tree got too expensive.
+  // Returns whether the tree was rebuilt.
+  bool update(std::vector<Particle> const& particles, float particle_radius);
+
+  void build(std::vector<Particle> const& particles, float particle_radius);
+
+  // `particles` must be as many as the tree was built for.
+  void refit(std::vector<Particle> const& particles, float particle_radius);
+
+  // Finds the closest sphere that `ray` hits. Returns false if it misses all of them.
+  bool intersect(ParticleRay const& ray, ParticleHit& hit) const;
+
+  // Expected cost of tracing a ray that hits the root box through the tree, in box and sphere tests.
+  float sah_cost() const;
+
+  // How much the cost has grown since the last build (see `set_rebuild_threshold`).
+  float sah_cost_growth() const;
+
+  size_t particle_count() const;
+  size_t node_count() const;
+  unsigned int depth() const;
+  unsigned long long builds() const;
+  unsigned long long refits() const;
+  size_t memory_usage() const; // [bytes]
+
+private:
+  // Splits below this depth are at the median, which bounds the depth (and the traversal stack) for any input.
+  static const unsigned int MAX_SAH_DEPTH = 64;
+  static const unsigned int MAX_DEPTH = 128;
+
+  struct Node {
+    optix::float3 lower;
+    optix::float3 upper;
+    unsigned int first; // The first particle in `m_order` for leaves, and the left child (the right one follows it) otherwise.
+    unsigned int count; // Particles in a leaf, 0 for inner nodes.
+  };
+
+  struct BuildItem {
+    optix::float3 center;
+    unsigned int particle;
+  };
+
+  ThreadPool m_pool;
+  float m_rebuild_threshold;
+  float m_particle_radius; // [m]
+
+  std::vector<Node> m_nodes;                // Breadth first, so that every level is contiguous.
+  std::vector<unsigned int> m_level_starts; // The first node of each level, followed by the node count.
+  std::vector<unsigned int> m_order;        // Particle indices in leaf order.
+  std::vector<optix::float3> m_centers;     // Particle positions in leaf order.
+  std::vector<BuildItem> m_items;           // Scratch space of `build`: the particles, partitioned as the nodes are split.
+  std::vector<unsigned int> m_splits;       // Scratch space of `build`: the left child's share of each node of a level (0 for leaves).
+
+  float m_sah_cost;
+  double m_area_cost;       // The SAH cost before it is divided by the root's area.
+  double m_build_area_cost;
+  unsigned long long m_builds;
+  unsigned long long m_refits;
+
+  void fit_leaf(Node& node) const;
+  unsigned int split(Node& node, unsigned int level);
+  void compute_sah_cost();
+};
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "shaders/cuda/common.cuh"
+
+#include <ParticleCache.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Streams particle frames to a particle cache (see ParticleCache.h) from a background thread,
+// so that the encoding and disk I/O overlap the simulation.
+class ParticleFrameWriter {
+public:
+  // At most `max_pending_frames` frames are buffered. Once the disk falls that far behind, `write` blocks.
+  ParticleFrameWriter(std::string const& path,
+                      ParticleCacheEncoding encoding,
+                      float particle_radius,
+                      size_t max_pending_frames = 4);
+
+  // Finishes writing every pending frame.
+  ~ParticleFrameWriter();
+
+  // False if the file could not be created.
+  bool is_open() const;
+
+  // Queues `particles` as the frame at `time` [s] without copying them.
+  // `particles` is swapped with the buffer of an already written frame, so its contents are unspecified afterwards.
+  void write(float time, std::vector<Particle>& particles);
+
+  // Waits until every queued frame has been written and finishes the cache (see `ParticleCacheWriter::finish`).
+  void close();
+
+  // True if any frame could not be written.
+  bool failed();
+
+  unsigned int frames_written();
+  uint64_t bytes_written();
+
+private:
+  struct Frame {
+    float time;
+    std::vector<Particle> particles;
+  };
+
+  ParticleCacheWriter m_cache;
+  size_t m_max_pending_frames;
+
+  std::mutex m_mutex;
+  std::condition_variable m_frame_available;
+  std::condition_variable m_frame_written;
+  std::deque<Frame> m_pending;
+  std::vector<std::vector<Particle>> m_free_buffers; // Recycled so that a long run does not allocate every frame.
+  bool m_closing;
+  bool m_failed;
+  unsigned int m_frames_written;
+  uint64_t m_bytes_written;
+
+  std::thread m_thread;
+
+  void writer_loop();
+  bool write_frame(Frame const& frame, std::vector<float>& positions, std::vector<float>& velocities);
+};
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "simulation/water_simulation_state.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Hands out the slots of the particle arrays to particles that are added and removed while simulating.
+//
+// A removed particle leaves a hole that goes on a free list and is reused by the next particle that is added,
+// so both take O(1) and every other particle keeps its index. New slots are only appended once the free list
+// is empty, and the capacity that the owner reserves for its arrays doubles whenever they run out, so a
+// steady inflow never reallocates every step. Once holes make up too much of the slots, `compact` moves
+// particles from the end into them.
+class ParticlePool {
+public:
+  ParticlePool();
+
+  // Every slot in [0, count) holds a particle.
+  void reset(size_t count);
+
+  size_t size() const;       // Slots, including holes.
+  size_t capacity() const;   // Slots that the arrays should have room for.
+  size_t live_count() const;
+  bool has_holes() const;
+
+  bool alive(size_t slot) const;
+  uint8_t const* alive_flags() const;
+
+  // Returns the slot of a new particle. Appended slots are beyond the end of the arrays until they are resized
+  // to `size()` (after reserving `capacity()`).
+  unsigned int allocate();
+
+  void release(unsigned int slot);
+
+  // Whether more than a quarter of the slots are holes.
+  bool needs_compaction() const;
+
+  // Moves the particles at the end into the holes, calling `move(from, to)` for each, until `size()` equals
+  // `live_count()`. The arrays should then be shrunk to `size()`.
+  template<typename F>
+  void compact(F move);
+
+  // Checkpointing of which slots are holes and in which order they are reused.
+  void save(StateSectionWriter& writer) const;
+  bool restore(StateSectionReader& reader);
+
+  size_t memory_usage() const; // [bytes]
+
+private:
+  std::vector<uint8_t> m_alive;
+  std::vector<unsigned int> m_free; // Reused last in, first out.
+  size_t m_capacity;
+};
+
+inline bool ParticlePool::alive(size_t slot) const {
+  return m_alive[slot] != 0;
+}
+
+template<typename F>
+void ParticlePool::compact(F move) {
+  // With the holes in increasing order, the first one is filled with the last particle until none are left.
+  // Holes at the end are simply dropped.
+  std::sort(m_free.begin(), m_free.end());
+
+  size_t first = 0;
+  while (first < m_free.size()) {
+    unsigned int last = m_alive.size() - 1;
+    if (m_free.back() == last) {
+      m_free.pop_back();
+    } else {
+      unsigned int hole = m_free[first++];
+      move(last, hole);
+      m_alive[hole] = 1;
+    }
+    m_alive.pop_back();
+  }
+
+  m_free.clear();
+}
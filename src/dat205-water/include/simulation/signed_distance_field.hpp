@@ -0,0 +1,73 @@
+#pragma once
+
+#include "util/thread_pool.hpp"
+
+#include <optixu/optixu_math_namespace.h>
+
+#include <string>
+#include <vector>
+
+// Indexed triangles, e.g. of a static obstacle.
+struct TriangleMesh {
+  std::vector<optix::float3> positions;
+  std::vector<unsigned int> indices; // 3 per triangle
+};
+
+// Loads an OBJ or PLY file with sutil's MeshLoader, scaled by `scale` and then moved by `offset`.
+// Returns false if the file has no triangles.
+bool load_triangle_mesh(std::string const& path, float scale, optix::float3 offset, TriangleMesh& mesh);
+
+// Signed distance [m] to a triangle mesh, negative inside of it, sampled on a sparse grid.
+//
+// Only blocks of `BLOCK_CELLS`^3 cells within `band` of a triangle are stored, so memory grows with the
+// surface area rather than the volume. A dense table of block indices over the mesh's bounds then finds
+// the block of any point in O(1), and every block has its own copy of the nodes it shares with its
+// neighbors so that interpolation never has to look into another block. Points outside of every stored
+// block are at least `band` away from the surface and are reported as exactly that far away, with a zero
+// gradient. Whether such a point is inside is decided once per empty region of blocks while building.
+//
+// The sign comes from angle-weighted pseudonormals (Baerentzen and Aanaes 2005), which is exact for
+// closed meshes. Open meshes act as one-sided walls whose front is the side their triangles face.
+class SignedDistanceField {
+public:
+  static const int BLOCK_CELLS = 8;
+
+  SignedDistanceField();
+
+  // Samples the distance to `mesh` every `cell_size` within `band` of its surface.
+  void build(TriangleMesh const& mesh, float cell_size, float band, ThreadPool& pool);
+
+  bool empty() const;
+  float band() const;
+
+  // Trilinear interpolation of the distance.
+  float distance(optix::float3 position) const;
+
+  // Also returns the gradient of the interpolated distance, which points away from the surface.
+  float distance(optix::float3 position, optix::float3& gradient) const;
+
+  size_t block_count() const;
+  size_t memory_usage() const; // [bytes]
+
+private:
+  static const int BLOCK_NODES = BLOCK_CELLS + 1;
+
+  // Table entries of blocks that are not stored.
+  static const int EMPTY_OUTSIDE = -1;
+  static const int EMPTY_INSIDE = -2;
+
+  float m_cell_size;
+  float m_band;
+
+  // The dense table of blocks covers the blocks [m_first_block, m_first_block + m_block_dims).
+  optix::int3 m_first_block;
+  optix::int3 m_block_dims;
+  std::vector<int> m_block_table; // Index of the stored block, or EMPTY_OUTSIDE or EMPTY_INSIDE.
+
+  // BLOCK_NODES^3 distances per stored block (x fastest).
+  std::vector<float> m_values;
+
+  // Finds the stored block and the cell within it that contains `position`. Returns the block's table entry,
+  // which is negative if it is not stored.
+  int locate(optix::float3 position, float const*& values, optix::int3& cell, optix::float3& t) const;
+};
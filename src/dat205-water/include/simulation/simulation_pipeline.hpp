@@ -0,0 +1,54 @@
+#pragma once
+
+#include "simulation/water_simulation.hpp"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Advances a simulation on a background thread while the caller shows the previous frame.
+//
+// The particles are double-buffered: the worker copies every frame it simulates into a back buffer, and
+// `finish` swaps that buffer with the caller's front buffer once the frame is done. Calling `start` right
+// after `finish` then simulates frame N + 1 while frame N is rendered, so a frame takes about as long as
+// the slower of the two instead of their sum. The rendered frame is one frame behind the simulation.
+//
+// The simulation must not be used by anyone else while a frame is in flight (see `wait`).
+// Only backends that keep their state on the host can be pipelined like this.
+class SimulationPipeline {
+public:
+  explicit SimulationPipeline(WaterSimulation& simulation);
+
+  // Finishes the frame in flight.
+  ~SimulationPipeline();
+
+  // Starts advancing the simulation by `frame_dt` seconds. Waits for the frame in flight first (if any),
+  // whose particles are then dropped.
+  void start(float frame_dt);
+
+  // Waits for the frame in flight and swaps its particles into `particles`.
+  // Returns false (leaving `particles` as is) if no frame was started since the last `finish`.
+  bool finish(std::vector<Particle>& particles);
+
+  // Blocks until the simulation is idle, after which it may be used until the next `start`.
+  // The frame in flight (if any) is kept for the next `finish`.
+  void wait();
+
+private:
+  WaterSimulation& m_simulation;
+
+  std::mutex m_mutex;
+  std::condition_variable m_frame_started;
+  std::condition_variable m_frame_done;
+
+  std::vector<Particle> m_back_buffer;
+  float m_frame_dt;
+  bool m_started;   // A frame was started and has not been finished.
+  bool m_simulating;
+  bool m_stopping;
+
+  std::thread m_thread;
+
+  void worker_loop();
+};
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+// The passes of a simulation step, in the order they run.
+enum class SolverPass : unsigned int {
+  NEIGHBOR_SEARCH, // Grid and neighbor list (re)builds, including the check whether one is needed.
+  DENSITY,         // Densities and state equation pressures.
+  FORCE,           // Pressure, viscosity, surface tension and gravity forces.
+  PRESSURE_SOLVE,  // PCISPH corrections.
+  INTEGRATION,     // Time integration and boundary collisions.
+  COUNT,
+};
+
+const unsigned int SOLVER_PASS_COUNT = (unsigned int) SolverPass::COUNT;
+
+const char* solver_pass_name(SolverPass pass);
+
+// Occupancy of the hash table that a backend finds neighbors with.
+struct HashTableStatistics {
+  unsigned int buckets;          // Buckets of the table (hash cells for OptiX).
+  unsigned int occupied_buckets; // Buckets that hold at least one particle.
+  unsigned int occupied_cells;   // Grid cells that hold at least one particle, or 0 if the backend cannot tell them apart.
+
+  HashTableStatistics();
+
+  // Fraction of the buckets in use.
+  double load_factor() const;
+
+  // Fraction of the occupied cells that share their bucket with another cell.
+  double collision_rate() const;
+};
+
+// Cost counters that a backend accumulates over every step since the last reset.
+struct SolverProfile {
+  double pass_seconds[SOLVER_PASS_COUNT]; // Wall time spent in each pass.
+  unsigned long long pass_particles[SOLVER_PASS_COUNT]; // Particles processed by each pass, summed over the steps.
+  unsigned long long steps;
+  unsigned long long particle_steps;      // Particles advanced, summed over the steps.
+  unsigned long long neighbor_rebuilds;
+  unsigned long long grid_migrations;     // Particles moved to another cell by the rebuilds (all of them for a full sort).
+  unsigned long long particle_reorders;   // Times the particles were sorted in memory by where they are.
+  unsigned long long neighbor_entries;    // Neighbor list entries used, summed over the steps.
+  unsigned int max_neighbors;             // Largest neighbor count of any particle in any step.
+  unsigned long long overflowed_cells;    // Grid cells that were too full to hold every particle, summed over the steps.
+  size_t memory_usage;                    // [bytes] Held by the backend after the last step.
+  HashTableStatistics hash_table;         // After the last step.
+
+  SolverProfile();
+
+  void reset();
+
+  double total_seconds() const;
+
+  // Neighbors per particle, averaged over the steps.
+  double average_neighbors() const;
+
+  // Particles per step.
+  double average_particles() const;
+  double average_particles(SolverPass pass) const;
+
+  // Cost of a pass per particle and step [ns].
+  double nanoseconds_per_particle_step(SolverPass pass) const;
+  double nanoseconds_per_particle_step() const;
+};
+
+// Adds the wall time of its own lifetime, and the particles it was given, to a pass.
+class ScopedPassTimer {
+public:
+  ScopedPassTimer(SolverProfile& profile, SolverPass pass, size_t particles = 0);
+  ~ScopedPassTimer();
+
+private:
+  SolverProfile& m_profile;
+  SolverPass m_pass;
+  std::chrono::steady_clock::time_point m_start;
+};
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "simulation/solver_profile.hpp"
+
+#include <fstream>
+#include <string>
+
+// Dumps what every frame cost, e.g. to see which pass to tune the support radius and cell size against.
+// Writes a CSV file, or a JSON array with one object per frame if the path ends in ".json".
+class SolverProfileWriter {
+public:
+  explicit SolverProfileWriter(std::string const& path);
+
+  // Finishes the file.
+  ~SolverProfileWriter();
+
+  // False if the file could not be created.
+  bool is_open() const;
+
+  // `profile` must only hold the steps of this frame. `render_seconds` is the time spent rendering it (if it was).
+  void write(unsigned int frame, double time, SolverProfile const& profile, double render_seconds = 0.0);
+
+  void close();
+
+  // True if any frame could not be written.
+  bool failed() const;
+
+private:
+  std::ofstream m_file;
+  bool m_json;
+  unsigned int m_frames_written;
+  bool m_failed;
+};
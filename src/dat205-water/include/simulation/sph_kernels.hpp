@@ -0,0 +1,232 @@
+#pragma once
+
+#include "shaders/cuda/common.cuh"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Normalization constants of the smoothing kernels.
+// They only depend on the support radius, so they are computed once instead of with `powf` for every pair.
+struct SphKernelConstants {
+  float h;  // Support radius [m]
+  float h2; // h^2
+
+  float poly6;               //  315 / (64 pi h^9), eq 4.3
+  float poly6_gradient;      // -945 / (32 pi h^9), eq 4.4 and 4.5
+  float spiky_gradient;      //  -45 / (pi h^6), eq 4.14
+  float viscosity_laplacian; //   45 / (pi h^6), eq 4.22
+};
+
+SphKernelConstants make_sph_kernel_constants(float support_radius);
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+
+// Smoothing kernels of the scalar passes.
+// Each kernel is a policy that is evaluated from the squared distance `r2` (or the distance vector) and vanishes
+// from the support radius on. The passes take a whole `SphKernelSet` as a template parameter, so every evaluation
+// is inlined into the neighbor loops and either folds into a few multiplications or becomes a table lookup.
+
+// The direction of the spiky kernel's gradient, which still points somewhere for (nearly) coinciding particles.
+inline optix::float3 spiky_gradient_direction(optix::float3 dist_vec, float distance) {
+  if (distance < 1e-3f) {
+    return optix::make_float3(dist_vec.x > 0.0f ? 1.0f : -1.0f,
+                              dist_vec.y > 0.0f ? 1.0f : -1.0f,
+                              dist_vec.z > 0.0f ? 1.0f : -1.0f);
+  } else {
+    return optix::make_float3(dist_vec.x / distance, dist_vec.y / distance, dist_vec.z / distance);
+  }
+}
+
+// See eq 4.3, 4.4 and 4.5
+class Poly6Kernel {
+public:
+  Poly6Kernel() : m_k() {}
+  explicit Poly6Kernel(SphKernelConstants const& k) : m_k(k) {}
+
+  float value(float r2) const {
+    float q = m_k.h2 - r2;
+    return r2 < m_k.h2 ? m_k.poly6 * q * q * q : 0.0f;
+  }
+
+  // The gradient divided by the distance vector.
+  float gradient_scale(float r2) const {
+    float q = m_k.h2 - r2;
+    return r2 < m_k.h2 ? m_k.poly6_gradient * q * q : 0.0f;
+  }
+
+  float laplacian(float r2) const {
+    return r2 < m_k.h2 ? m_k.poly6_gradient * (m_k.h2 - r2) * (3.0f * m_k.h2 - 7.0f * r2) : 0.0f;
+  }
+
+  optix::float3 gradient(optix::float3 dist_vec) const {
+    float scale = gradient_scale(optix::dot(dist_vec, dist_vec));
+    return optix::make_float3(scale * dist_vec.x, scale * dist_vec.y, scale * dist_vec.z);
+  }
+
+private:
+  SphKernelConstants m_k;
+};
+
+// See eq 4.14 and fig 4.4
+class SpikyKernel {
+public:
+  SpikyKernel() : m_k() {}
+  explicit SpikyKernel(SphKernelConstants const& k) : m_k(k) {}
+
+  // The length of the gradient (negative, as it points towards the other particle).
+  float gradient_length(float r2) const {
+    float h_minus_r = m_k.h - sqrtf(r2);
+    return r2 < m_k.h2 ? m_k.spiky_gradient * h_minus_r * h_minus_r : 0.0f;
+  }
+
+  optix::float3 gradient(optix::float3 dist_vec) const {
+    float r2 = optix::dot(dist_vec, dist_vec);
+    if (r2 >= m_k.h2) {
+      return optix::make_float3(0.0f);
+    }
+    float gradient = gradient_length(r2);
+    optix::float3 direction = spiky_gradient_direction(dist_vec, sqrtf(r2));
+    return optix::make_float3(gradient * direction.x, gradient * direction.y, gradient * direction.z);
+  }
+
+private:
+  SphKernelConstants m_k;
+};
+
+// See eq 4.22 and fig 4.5
+class ViscosityKernel {
+public:
+  ViscosityKernel() : m_k() {}
+  explicit ViscosityKernel(SphKernelConstants const& k) : m_k(k) {}
+
+  float laplacian(float r2) const {
+    return r2 < m_k.h2 ? m_k.viscosity_laplacian * (m_k.h - sqrtf(r2)) : 0.0f;
+  }
+
+private:
+  SphKernelConstants m_k;
+};
+
+// A function of the squared distance, sampled at evenly spaced points of [0, h^2] and linearly interpolated in
+// between. Every kernel above is continuous and 0 at h^2, so the table only has to cover the support radius.
+class KernelTable {
+public:
+  KernelTable() : m_scale(0.0f), m_last(0.0f) {}
+
+  template<typename F>
+  KernelTable(float h2, unsigned int samples, F f);
+
+  float operator()(float r2) const {
+    float t = r2 * m_scale;
+    if (!(t < m_last)) {
+      return 0.0f;
+    }
+    unsigned int i = (unsigned int) t;
+    float fraction = t - i;
+    return m_values[i] + fraction * (m_values[i + 1] - m_values[i]);
+  }
+
+  size_t memory_usage() const {
+    return m_values.capacity() * sizeof(float);
+  }
+
+private:
+  std::vector<float> m_values;
+  float m_scale; // Samples per unit of r^2.
+  float m_last;  // Index of the sample at h^2.
+};
+
+template<typename F>
+KernelTable::KernelTable(float h2, unsigned int samples, F f)
+  : m_values(std::max(2u, samples)),
+    m_scale(h2 > 0.0f ? (m_values.size() - 1) / h2 : 0.0f),
+    m_last((float) (m_values.size() - 1)) {
+  for (size_t i = 0; i < m_values.size(); i++) {
+    m_values[i] = f(h2 * i / (m_values.size() - 1));
+  }
+}
+
+// The kernels above, looked up in tables instead of evaluated. The spiky gradient keeps its exact direction.
+class TabulatedPoly6Kernel {
+public:
+  TabulatedPoly6Kernel() {}
+  TabulatedPoly6Kernel(SphKernelConstants const& k, unsigned int samples);
+
+  float value(float r2) const { return m_value(r2); }
+  float gradient_scale(float r2) const { return m_gradient_scale(r2); }
+  float laplacian(float r2) const { return m_laplacian(r2); }
+
+  optix::float3 gradient(optix::float3 dist_vec) const {
+    float scale = gradient_scale(optix::dot(dist_vec, dist_vec));
+    return optix::make_float3(scale * dist_vec.x, scale * dist_vec.y, scale * dist_vec.z);
+  }
+
+  size_t memory_usage() const {
+    return m_value.memory_usage() + m_gradient_scale.memory_usage() + m_laplacian.memory_usage();
+  }
+
+private:
+  KernelTable m_value;
+  KernelTable m_gradient_scale;
+  KernelTable m_laplacian;
+};
+
+class TabulatedSpikyKernel {
+public:
+  TabulatedSpikyKernel() : m_h2(0.0f) {}
+  TabulatedSpikyKernel(SphKernelConstants const& k, unsigned int samples);
+
+  float gradient_length(float r2) const { return m_gradient_length(r2); }
+
+  optix::float3 gradient(optix::float3 dist_vec) const {
+    float r2 = optix::dot(dist_vec, dist_vec);
+    if (r2 >= m_h2) {
+      return optix::make_float3(0.0f);
+    }
+    float gradient = gradient_length(r2);
+    optix::float3 direction = spiky_gradient_direction(dist_vec, sqrtf(r2));
+    return optix::make_float3(gradient * direction.x, gradient * direction.y, gradient * direction.z);
+  }
+
+  size_t memory_usage() const {
+    return m_gradient_length.memory_usage();
+  }
+
+private:
+  float m_h2;
+  KernelTable m_gradient_length;
+};
+
+class TabulatedViscosityKernel {
+public:
+  TabulatedViscosityKernel() {}
+  TabulatedViscosityKernel(SphKernelConstants const& k, unsigned int samples);
+
+  float laplacian(float r2) const { return m_laplacian(r2); }
+
+  size_t memory_usage() const {
+    return m_laplacian.memory_usage();
+  }
+
+private:
+  KernelTable m_laplacian;
+};
+
+// One kernel of each type, for the density (poly6), pressure (spiky), viscosity and surface tension (poly6) terms.
+template<typename Poly6, typename Spiky, typename Viscosity>
+struct SphKernelSet {
+  Poly6 poly6;
+  Spiky spiky;
+  Viscosity viscosity;
+};
+
+typedef SphKernelSet<Poly6Kernel, SpikyKernel, ViscosityKernel> AnalyticSphKernels;
+typedef SphKernelSet<TabulatedPoly6Kernel, TabulatedSpikyKernel, TabulatedViscosityKernel> TabulatedSphKernels;
+
+AnalyticSphKernels make_analytic_sph_kernels(SphKernelConstants const& k);
+
+// `samples` per table, at least 2.
+TabulatedSphKernels make_tabulated_sph_kernels(SphKernelConstants const& k, unsigned int samples);
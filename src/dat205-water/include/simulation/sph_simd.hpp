@@ -0,0 +1,64 @@
+#pragma once
+
+#include "simulation/neighbor_list.hpp"
+#include "simulation/particle_arrays.hpp"
+#include "simulation/sph_kernels.hpp"
+#include "simulation/water_simulation.hpp"
+
+// Instruction sets that the CPU backend can evaluate the SPH sums with.
+enum class SimdLevel {
+  SCALAR, // One neighbor at a time.
+  AVX2,   // 8 neighbors at a time.
+  AVX512, // 16 neighbors at a time.
+};
+
+// The best level that is both compiled in and supported by the CPU we are running on.
+SimdLevel detect_simd_level();
+const char* simd_level_name(SimdLevel level);
+
+// Everything the vectorized passes read and write.
+// Only raw arrays are passed, since the passes are compiled for other instruction sets than the rest of
+// the program and must therefore not share any inline functions with it (see sph_simd_impl.hpp).
+struct SphPassArguments {
+  SphPassArguments(ParticleArrays& particles,
+                   NeighborList const& neighbors,
+                   SphKernelConstants const& kernels,
+                   WaterSimulationParameters const& parameters);
+
+  float const* x;
+  float const* y;
+  float const* z;
+  float const* vx;
+  float const* vy;
+  float const* vz;
+
+  // Written by the density pass and read by the force pass.
+  float* density;
+  float* pressure;
+
+  // Written by the force pass.
+  float* fx;
+  float* fy;
+  float* fz;
+
+  // Particle `i` has the neighbors [neighbor_offsets[i], neighbor_offsets[i + 1]).
+  unsigned int const* neighbor_offsets;
+  unsigned int const* neighbor_indices;
+
+  // If set, the passes visit the particles `particle_indices[begin, end)` instead of [begin, end).
+  unsigned int const* particle_indices;
+
+  SphKernelConstants kernels;
+  WaterSimulationParameters parameters;
+};
+
+// Density and pressure of the particles [begin, end) (see `CpuWaterSimulation::update_particles_data`).
+// `level` must be one of the vectorized levels returned by `detect_simd_level`.
+void sph_density_pass(SimdLevel level, SphPassArguments const& args, size_t begin, size_t end);
+void sph_density_pass_avx2(SphPassArguments const& args, size_t begin, size_t end);
+void sph_density_pass_avx512(SphPassArguments const& args, size_t begin, size_t end);
+
+// Total force of the particles [begin, end) (see `CpuWaterSimulation::update_force`).
+void sph_force_pass(SimdLevel level, SphPassArguments const& args, size_t begin, size_t end);
+void sph_force_pass_avx2(SphPassArguments const& args, size_t begin, size_t end);
+void sph_force_pass_avx512(SphPassArguments const& args, size_t begin, size_t end);
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "shaders/cuda/common.cuh"
+#include "util/thread_pool.hpp"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct SurfaceReconstructionParameters {
+  float voxel_size;       // [m] Edge length of the marching cubes cells.
+  float smoothing_radius; // [m] Support of the kernel that splats each particle into the grid.
+  float particle_volume;  // [m^3] Makes the splatted field about 1 inside the water.
+  float iso_value;        // The surface is where the field crosses this value.
+};
+
+// Parameters that resolve the surface at the particle radius, for particles that are 2 radii apart.
+SurfaceReconstructionParameters create_surface_reconstruction_parameters(float particle_radius);
+
+// Indexed triangle mesh in the layout expected by `OptixScene::create_geometry`.
+struct SurfaceMesh {
+  std::vector<VertexData> vertices;
+  std::vector<unsigned int> indices; // 3 per triangle, counter-clockwise seen from outside the water.
+};
+
+// Extracts the water surface from the particles with marching cubes.
+//
+// Every particle is splatted into a smoothed color field that is only stored in blocks of
+// `BLOCK_CELLS`^3 cells within the smoothing radius of a particle. The blocks are evaluated and
+// polygonized in parallel. Each block owns the vertices on the cell edges that start at its nodes,
+// so vertices on block boundaries are shared and the mesh is closed. Blocks that are entirely inside
+// or outside the water are skipped after the field has been evaluated, so the polygonization cost
+// scales with the surface area.
+class SurfaceReconstructor {
+public:
+  static const int BLOCK_CELLS = 8;
+
+  // A `thread_count` of 0 uses every hardware thread.
+  SurfaceReconstructor(unsigned int thread_count = 0);
+
+  SurfaceReconstructionParameters const& parameters() const;
+  void set_parameters(SurfaceReconstructionParameters const& parameters);
+
+  // Replaces the contents of `mesh` with the surface of `particles`.
+  void reconstruct(std::vector<Particle> const& particles, SurfaceMesh& mesh);
+
+  // Statistics of the last reconstruction.
+  size_t active_block_count() const;
+  size_t memory_usage() const; // [bytes]
+
+private:
+  static const int BLOCK_NODES = BLOCK_CELLS + 1;
+
+  struct Block {
+    optix::int3 coord;
+
+    // The blocks at +x, +y, +z (bit 0, 1, 2) that own the vertices on this block's far faces (-1 if inactive).
+    int forward[8];
+
+    // Field value and gradient at each of the BLOCK_NODES^3 nodes (x fastest).
+    std::vector<float> values;
+    std::vector<optix::float3> gradients;
+    bool has_surface;
+
+    // Index into `vertices` for each owned edge (3 per node with coordinates below BLOCK_CELLS), or -1.
+    std::vector<int> edge_vertices;
+    std::vector<VertexData> vertices;
+    std::vector<unsigned int> indices; // Local to the block until they are offset by the vertex offsets.
+    unsigned int vertex_offset;
+    unsigned int index_offset;
+  };
+
+  ThreadPool m_pool;
+  SurfaceReconstructionParameters m_parameters;
+
+  // Particle positions counting sorted by the block they are in.
+  std::unordered_map<uint64_t, unsigned int> m_particle_bins;
+  std::vector<unsigned int> m_bin_start;
+  std::vector<optix::float3> m_sorted_positions;
+
+  std::unordered_map<uint64_t, unsigned int> m_block_indices;
+  std::vector<Block> m_blocks;
+  size_t m_active_blocks;
+
+  void sort_particles(std::vector<Particle> const& particles);
+  void activate_blocks();
+  void evaluate_field(Block& block) const;
+  void create_vertices(Block& block) const;
+  void create_triangles(Block& block) const;
+
+  int find_block(optix::int3 coord) const;
+  static uint64_t block_key(optix::int3 coord);
+};
+
+// Writes `mesh` as a Wavefront OBJ file (positions and normals). Returns false if the file could not be written.
+bool write_obj(std::string const& path, SurfaceMesh const& mesh);
@@ -0,0 +1,141 @@
+#pragma once
+
+#include "simulation/particle_arrays.hpp"
+#include "simulation/solver_profile.hpp"
+#include "util/thread_pool.hpp"
+
+#include <cstdint>
+#include <vector>
+
+// Neighbor search structure that counting sorts the particles by the grid cell they occupy.
+//
+// Unlike the fixed-slot `HashCell` table, every particle is stored exactly once, so no neighbors are lost
+// in crowded cells and memory grows linearly with the particle count. Cells are still hashed into a table
+// of buckets (eq 5.1, 5.2, 5.3), but each sorted entry remembers its exact cell so that particles from
+// colliding cells are skipped during lookup.
+//
+// Every bucket keeps a few spare entries behind its particles, so that `update` can move the particles that
+// changed cells without sorting the rest again. Each bucket stays sorted by particle index either way, so an
+// updated grid visits the same candidates in the same order as a freshly built one.
+class UniformGrid {
+public:
+  UniformGrid();
+
+  // Sorts `particles` into cells of side length `cell_size`.
+  // With `alive` flags, only the particles whose flag is set are sorted in (see `ParticlePool`).
+  void build(ParticleArrays const& particles, float cell_size, ThreadPool& pool, uint8_t const* alive = nullptr);
+
+  // Moves the particles that left their cell since the grid was last built or updated. Apart from finding
+  // them, this costs time in proportion to how many did (plus a sweep over the buckets whenever some
+  // run out of spare entries). Particles that were added or removed since are inserted or removed the
+  // same way. Falls back to `build` if particles were dropped from the end, the cell size changed, there
+  // are more particles than buckets, or too many particles moved.
+  void update(ParticleArrays const& particles, float cell_size, ThreadPool& pool, uint8_t const* alive = nullptr);
+
+  // Calls `f(particle_index)` for every particle in the 3x3x3 block of cells centered on `position`.
+  // These are all particles that are potentially within `cell_size` distance.
+  template<typename F>
+  void for_each_candidate(optix::float3 position, F f) const;
+
+  // The discretized position of `position` in the grid.
+  optix::int3 cell_position(optix::float3 position) const;
+
+  unsigned int bucket_count() const;
+  size_t memory_usage() const; // [bytes]
+
+  // Takes a sweep over every particle in the grid.
+  HashTableStatistics statistics() const;
+
+  // Particles that changed cells in the last `build` or `update` (every particle for a `build`).
+  // Added and removed particles count too.
+  unsigned int migration_count() const;
+
+private:
+  // The bucket of particles that are not in the grid.
+  static const unsigned int NO_BUCKET = ~0u;
+
+  float m_cell_size;
+  unsigned int m_bucket_count; // A prime, so that every bit of the hash picks the bucket.
+  unsigned int m_migration_count;
+
+  // Per particle (in the original order).
+  std::vector<unsigned int> m_particle_buckets;
+  std::vector<optix::int3> m_particle_cells;
+
+  // Per bucket: the particles are the sorted entries [m_bucket_start[b], m_bucket_start[b] + m_bucket_size[b]),
+  // followed by spare entries up to m_bucket_start[b + 1].
+  std::vector<unsigned int> m_bucket_start;
+  std::vector<unsigned int> m_bucket_size;
+
+  // Per sorted entry.
+  std::vector<unsigned int> m_sorted_indices;
+  std::vector<optix::int3> m_sorted_cells;
+
+  unsigned int hash(optix::int3 cell) const;
+
+  // Removes or inserts a particle while keeping its bucket sorted. Inserting needs a spare entry.
+  void remove(unsigned int particle_index);
+  void insert(unsigned int particle_index);
+  void make_room(std::vector<unsigned int> const& arrivals);
+};
+
+// The smallest prime that is at least `n`. Hash tables are sized to one, so that the modulo mixes every bit of the
+// hash into the index (both the `UniformGrid` and the OptiX hash cells).
+unsigned int next_prime(unsigned int n);
+
+template<typename F>
+void UniformGrid::for_each_candidate(optix::float3 position, F f) const {
+  if (m_sorted_indices.empty()) {
+    return;
+  }
+
+  optix::int3 center = cell_position(position);
+
+  for (int x = -1; x <= 1; x++) {
+    for (int y = -1; y <= 1; y++) {
+      for (int z = -1; z <= 1; z++) {
+        optix::int3 cell = optix::make_int3(center.x + x, center.y + y, center.z + z);
+        unsigned int bucket = hash(cell);
+
+        unsigned int end = m_bucket_start[bucket] + m_bucket_size[bucket];
+        for (unsigned int i = m_bucket_start[bucket]; i < end; i++) {
+          optix::int3 const& c = m_sorted_cells[i];
+
+          // Skip particles that only share the bucket due to a hash collision.
+          if (c.x == cell.x && c.y == cell.y && c.z == cell.z) {
+            f(m_sorted_indices[i]);
+          }
+        }
+      }
+    }
+  }
+}
+
+inline optix::int3 UniformGrid::cell_position(optix::float3 position) const {
+  // Flooring (rather than truncating) keeps the cells around the origin as large as all the others.
+  return optix::make_int3(int(floorf(position.x / m_cell_size)),
+                          int(floorf(position.y / m_cell_size)),
+                          int(floorf(position.z / m_cell_size)));
+}
+
+// See eq 5.1, 5.2, 5.3, but with the products summed rather than XORed, and mixed before the modulo. Around the
+// origin, where the negative coordinates wrap around, the XOR maps many cells to the same value, which no bucket
+// count can tell apart again. The sum keeps the cells of the water apart, and the
+// finalizer of MurmurHash3 spreads its regular steps along each axis over all buckets.
+inline unsigned int UniformGrid::hash(optix::int3 cell) const {
+  static const unsigned int p1 = 73856093;
+  static const unsigned int p2 = 19349663;
+  static const unsigned int p3 = 83492791;
+
+  unsigned int h = (unsigned int)cell.x * p1 + (unsigned int)cell.y * p2 + (unsigned int)cell.z * p3;
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  return h % m_bucket_count;
+}
+
+inline unsigned int UniformGrid::migration_count() const {
+  return m_migration_count;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <optixu/optixu_math_namespace.h>
+
+// A nozzle that adds water at a constant rate (CPU backend only, see `CpuWaterSimulation::set_emitters`).
+// Particles leave it in layers, one particle diameter apart, that fill a disc facing along the velocity.
+struct WaterEmitter {
+  optix::float3 position; // Center of the nozzle [m]
+  optix::float3 velocity; // Of the emitted particles [m / s]
+  float radius;           // [m]
+};
+
+// A drain that removes every particle that enters the box [min, max] (CPU backend only).
+struct WaterSink {
+  optix::float3 min; // [m]
+  optix::float3 max; // [m]
+};
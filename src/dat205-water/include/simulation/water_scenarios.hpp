@@ -0,0 +1,53 @@
+#pragma once
+
+#include "simulation/water_emitters.hpp"
+#include "simulation/water_simulation.hpp"
+
+#include <string>
+#include <vector>
+
+// Initial particle setups of the water simulation.
+enum class WaterScenario {
+  CENTER,       // A cube dropped in the middle of the box.
+  CORNER,       // A cube resting in a corner.
+  SIDE,         // A slab stretched along one of the walls.
+  SPLIT_VORTEX, // A cube whose halves move in opposite directions (creates a vague vortex).
+  FOUNTAIN,     // A shallow pool with a nozzle spraying upwards from its middle and a drain in a corner.
+  POUR,         // An empty box that a nozzle pours into from the side, with a drain in the opposite corner.
+};
+
+const char* water_scenario_name(WaterScenario scenario);
+
+// Accepts the names returned by `water_scenario_name`. Returns false for unknown names.
+bool parse_water_scenario(std::string const& name, WaterScenario& scenario);
+
+// Whether water is added and removed while simulating `scenario` (CPU backend only).
+bool water_scenario_has_emitters(WaterScenario scenario);
+
+// The glass box that contains the water, see `Application::create_background_geometry`.
+// The floor is at y = 0 and the walls are at +-width and +-depth.
+struct WaterBox {
+  float width;  // [m]
+  float height; // [m]
+  float depth;  // [m]
+};
+
+// The particles of `scenario`, arranged as a cube (or slab) with `side_length` particles along each side.
+// Scenarios with emitters start out with fewer (see `water_scenario_has_emitters`), and never hold more than
+// `side_length`^3 particles.
+std::vector<Particle> create_water_particles(WaterScenario scenario,
+                                             unsigned int side_length,
+                                             float particle_radius,
+                                             WaterBox const& box);
+
+// The nozzles and drains of `scenario` (none for the scenarios without emitters).
+std::vector<WaterEmitter> create_water_emitters(WaterScenario scenario,
+                                                unsigned int side_length,
+                                                float particle_radius,
+                                                WaterBox const& box);
+std::vector<WaterSink> create_water_sinks(WaterScenario scenario, float particle_radius, WaterBox const& box);
+
+// The physical constants that we simulate `particles_count` particles of water in `box` with.
+WaterSimulationParameters create_water_simulation_parameters(unsigned int particles_count,
+                                                             float particle_radius,
+                                                             WaterBox const& box);
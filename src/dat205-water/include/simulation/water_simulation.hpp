@@ -0,0 +1,145 @@
+#pragma once
+
+#include "shaders/cuda/common.cuh"
+#include "simulation/solver_profile.hpp"
+
+#include <vector>
+
+// The available implementations of the SPH solver.
+enum class WaterSimulationBackend {
+  CPU,   // Multithreaded C++ solver that runs on the host.
+  OPTIX, // The ray generation programs in water_simulation.cu.
+};
+
+// How the pressure that keeps the water incompressible is computed.
+enum class PressureSolver {
+  STATE_EQUATION, // Weakly compressible: p = k * (density - rest_density) (eq 4.12).
+  PCISPH,         // Predictive-corrective incompressible SPH (Solenthaler and Pajarola 2009). CPU backend only.
+};
+
+// Physical constants and boundaries of the water simulation.
+// These mirror the variables declared at the top of water_simulation.cu.
+struct WaterSimulationParameters {
+  float g;               // Gravity acceleration [m / s^2]
+
+  float cell_size;       // [m]
+  float support_radius;  // [m]
+  float particle_radius; // [m]
+
+  float particle_mass;   // [kg]
+  float rest_density;    // [kg / m^3]
+  float viscosity;       // [Pa * s]
+  float surface_tension; // [N / m]
+  float l_threshold;     // []
+  float gass_stiffness;  // [J]
+  float restitution;     // []
+  float friction;        // [] Coulomb friction coefficient of the walls and the obstacle (continuous collisions only).
+
+  // Sweep each particle's motion over the substep against the walls and the obstacle, and bounce it off the first
+  // surface in its way, instead of projecting it back once it has ended up outside (eq 4.58). A bounce reverses
+  // `restitution` of the velocity into the surface and takes up to `friction` times that impulse off the velocity
+  // along it, so fast particles at large steps neither tunnel through thin obstacles nor get stuck in corners.
+  bool continuous_collisions;
+
+  float neighbor_skin;   // [m] Extra search distance that lets the CPU backend reuse neighbor lists across steps.
+
+  // Neighbor list rebuilds between sorting the CPU backend's particles along a Morton curve of their grid cells,
+  // so that neighbors are also close in memory (0 never sorts them). The order of `get_particles` is unaffected.
+  unsigned int reorder_interval;
+
+  PressureSolver pressure_solver;
+  float pressure_tolerance;              // [] Largest average density error (relative to rest_density) PCISPH accepts.
+  unsigned int pressure_min_iterations;  // PCISPH corrections that are always made.
+  unsigned int pressure_max_iterations;  // PCISPH gives up on the tolerance after this many corrections.
+
+  // Particles that have stayed within `sleep_distance` of one spot for `sleep_steps` steps in a row, without a
+  // neighbor faster than `wake_speed`, fall asleep. Sleeping particles keep their last density and pressure for
+  // their neighbors, but skip every pass until a neighbor is faster than `wake_speed` again. CPU backend only.
+  bool sleeping;
+  unsigned int sleep_steps;
+  float sleep_distance; // [m]
+  float wake_speed;     // [m / s]
+
+  float cfl_number;          // [] Fraction of the support radius that information may travel per substep.
+  unsigned int max_substeps; // Upper bound on the substeps per frame (1 disables adaptive stepping).
+
+  // Visit the neighbors of every particle in order of their index (in `get_particles`), so that each sum over them is
+  // taken in the same order no matter how the particles were spread over threads, worker processes or memory (or
+  // raced into the OptiX hash cells).
+  // Together with the reductions, which are always taken in a fixed order, two runs from the same state are
+  // then bit-identical. The CPU backend also sticks to its scalar passes, whose rounding does not depend on
+  // the instruction sets of the CPU. OptiX can only guarantee this while no hash cell overflows.
+  bool deterministic;
+
+  // Samples per kernel table (CPU only). With more than 0, the smoothing kernels are looked up in tables indexed by
+  // the squared distance instead of evaluated, which only the scalar passes can do, so it also turns off the vector
+  // instruction sets. With 1024 samples, the poly6 kernel is accurate to about 1e-6 of its peak, and the spiky and
+  // viscosity kernels (which have a square root in r^2) to about 2e-4, or 2% for particles within h / 32 of each other.
+  unsigned int kernel_table_size;
+
+  float y_min; // The floor's y-level
+  float x_min; // Left wall
+  float x_max; // Right wall
+  float z_min; // Far wall
+  float z_max; // Near wall
+};
+
+struct WaterSimulationState;
+
+// A backend that time integrates a set of SPH particles.
+class WaterSimulation {
+public:
+  WaterSimulation();
+  virtual ~WaterSimulation() {}
+
+  virtual void set_parameters(WaterSimulationParameters const& parameters);
+  WaterSimulationParameters const& parameters() const;
+
+  // Replaces the simulated particles.
+  virtual void set_particles(std::vector<Particle> const& particles) = 0;
+
+  // Copies the current particle state into `particles`.
+  virtual void get_particles(std::vector<Particle>& particles) = 0;
+
+  // Advances the simulation by `dt` seconds.
+  virtual void step(float dt) = 0;
+
+  // Advances the simulation by `frame_dt` seconds in as many stable substeps as needed (at least one).
+  // Returns the amount of substeps that were taken.
+  unsigned int advance(float frame_dt);
+
+  // Simulated time [s] that has passed in calls to `advance`.
+  double time() const;
+
+  // Captures everything needed to continue the simulation later on exactly as if it had never stopped.
+  // Backends that keep state besides the particles add it as a section (see water_simulation_state.hpp).
+  virtual void save_state(WaterSimulationState& state);
+
+  // Continues from a state captured by `save_state`. Returns false if the state is not usable.
+  virtual bool restore_state(WaterSimulationState const& state);
+
+  // The largest substep that satisfies the CFL, force and viscous conditions for the current particles.
+  float stable_time_step();
+
+  unsigned int last_substep_count() const;
+
+  // Corrections made by an iterative pressure solver during the last step (0 for the state equation).
+  virtual unsigned int last_pressure_iterations() const;
+
+  // Where the time of the steps since the last reset went. Backends fill in what they can measure.
+  SolverProfile const& profile() const;
+  void reset_profile();
+
+protected:
+  WaterSimulationParameters m_parameters;
+  SolverProfile m_profile;
+
+  // The largest particle speed [m / s] and acceleration [m / s^2].
+  // Backends that already visit every particle during a step should override this to avoid another sweep.
+  virtual void measure_motion(float& max_speed, float& max_acceleration);
+
+private:
+  std::vector<Particle> m_motion_particles; // Scratch space of the default `measure_motion`.
+  unsigned int m_last_substep_count;
+  double m_time;
+};
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "simulation/water_simulation.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+// A snapshot of everything a backend needs to continue a simulation exactly where it left off
+// (see `WaterSimulation::save_state` and `WaterSimulation::restore_state`).
+struct WaterSimulationState {
+  WaterSimulationParameters parameters;
+  double time; // [s]
+  std::vector<Particle> particles;
+
+  // Backend specific state (e.g. the CPU backend's neighbor lists), by name.
+  std::map<std::string, std::vector<unsigned char>> sections;
+};
+
+// Writes `state` to `path` through a temporary file that then replaces `path`,
+// so that a crash while writing never destroys the previous checkpoint.
+bool write_water_simulation_state(std::string const& path, WaterSimulationState const& state);
+
+// Fails if the file is not a checkpoint of this version (or is corrupt).
+bool read_water_simulation_state(std::string const& path, WaterSimulationState& state);
+
+// Appends plain values and arrays to a state section.
+class StateSectionWriter {
+public:
+  explicit StateSectionWriter(std::vector<unsigned char>& data) : m_data(data) {}
+
+  template<typename T>
+  void write(T const& value) {
+    append(&value, sizeof(T));
+  }
+
+  template<typename T>
+  void write_vector(std::vector<T> const& values) {
+    write<uint64_t>(values.size());
+    append(values.data(), values.size() * sizeof(T));
+  }
+
+private:
+  std::vector<unsigned char>& m_data;
+
+  void append(const void* data, size_t size) {
+    size_t offset = m_data.size();
+    m_data.resize(offset + size);
+    if (size > 0) {
+      memcpy(&m_data[offset], data, size);
+    }
+  }
+};
+
+// Reads back what a `StateSectionWriter` wrote, in the same order.
+// Every read fails (returns false) once the section has been exhausted.
+class StateSectionReader {
+public:
+  explicit StateSectionReader(std::vector<unsigned char> const& data) : m_data(data), m_offset(0) {}
+
+  template<typename T>
+  bool read(T& value) {
+    return extract(&value, sizeof(T));
+  }
+
+  template<typename T>
+  bool read_vector(std::vector<T>& values) {
+    uint64_t size;
+    if (!read(size) || size > (m_data.size() - m_offset) / sizeof(T)) {
+      return false;
+    }
+    values.resize(size);
+    return extract(values.data(), size * sizeof(T));
+  }
+
+private:
+  std::vector<unsigned char> const& m_data;
+  size_t m_offset;
+
+  bool extract(void* data, size_t size) {
+    if (size > m_data.size() - m_offset) {
+      return false;
+    }
+    if (size > 0) {
+      memcpy(data, &m_data[m_offset], size);
+    }
+    m_offset += size;
+    return true;
+  }
+};
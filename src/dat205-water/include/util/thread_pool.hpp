@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads that cooperatively execute data-parallel loops.
+// The calling thread takes part in every loop, so a pool of size 1 has no workers at all.
+class ThreadPool {
+public:
+  // A `thread_count` of 0 uses every hardware thread.
+  ThreadPool(unsigned int thread_count = 0);
+  ~ThreadPool();
+
+  // Total amount of threads (including the caller) that execute each loop.
+  unsigned int size() const;
+
+  // Splits [0, count) into contiguous chunks and calls `f(begin, end)` once per chunk.
+  // Blocks until every chunk has been processed.
+  // NOTE: `f` must not call `parallel_for` on the same pool.
+  void parallel_for(size_t count, std::function<void(size_t, size_t)> const& f);
+
+private:
+  std::vector<std::thread> m_workers;
+
+  std::mutex m_mutex;
+  std::condition_variable m_work_available;
+  std::condition_variable m_work_done;
+
+  // The loop that is currently being executed.
+  std::function<void(size_t, size_t)> const* m_task;
+  size_t m_count;
+  size_t m_chunk_size;
+  std::atomic<size_t> m_next_chunk;
+
+  unsigned int m_busy_workers;
+  unsigned long m_generation; // Incremented for every new loop so that workers can tell it apart from the previous one.
+  bool m_stopping;
+
+  void worker_loop();
+  void run_chunks();
+};
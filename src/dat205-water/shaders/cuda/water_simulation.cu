@@ -10,6 +10,12 @@ rtDeclareVariable(float, cell_size      , , ); // [m]
 rtDeclareVariable(float, support_radius , , ); // [m]
 rtDeclareVariable(float, particle_radius, , ); // [m]
 
+// Normalization constants of the kernels, which only change with the support radius (see `SphKernelConstants`).
+rtDeclareVariable(float, poly6_constant              , , ); //  315 / (64 pi h^9)
+rtDeclareVariable(float, poly6_gradient_constant     , , ); // -945 / (32 pi h^9)
+rtDeclareVariable(float, spiky_gradient_constant     , , ); //  -45 / (pi h^6)
+rtDeclareVariable(float, viscosity_laplacian_constant, , ); //   45 / (pi h^6)
+
 rtDeclareVariable(float, particle_mass  , , ); // [kg]
 rtDeclareVariable(float, rest_density   , , ); // [kg / m^3]
 rtDeclareVariable(float, viscosity      , , ); // [Pa * s]
@@ -17,6 +23,8 @@ rtDeclareVariable(float, surface_tension, , ); // [N / m]
 rtDeclareVariable(float, l_threshold    , , ); // []
 rtDeclareVariable(float, gass_stiffness , , ); // [J]
 rtDeclareVariable(float, restitution    , , ); // []
+rtDeclareVariable(float, friction       , , ); // []
+rtDeclareVariable(int, continuous_collisions, , ); // Sweep the particles against the walls (see `swept_collision`).
 
 rtDeclareVariable(float, y_min, , ); // The floor's y-level
 rtDeclareVariable(float, x_min, , ); // Left wall
@@ -28,15 +36,36 @@ rtDeclareVariable(float, z_max, , ); // Near wall
 // In each cell we will store the particles that occupy that corresponding volume in space.
 rtBuffer<HashCell> hash_table;
 
+// Dense layout of the hash table over the cells of the box, or 0 dimensions to hash (see `update_hash_table`).
+rtDeclareVariable(int3, hash_grid_origin    , , ); // The first cell of the layout.
+rtDeclareVariable(uint3, hash_grid_dimensions, , ); // Cells along each axis, the layers along y repeat upwards.
+
 // Simulated particles.
 rtBuffer<Particle> particles_buffer;
 
+// Counters of the current step that are read back for profiling (cleared by the host before every step).
+// [0]: hash cells that overflowed, [1]: neighbor candidates summed over the particles, [2]: most neighbor candidates of any particle,
+// [3]: hash cells that hold at least one particle.
+rtBuffer<uint> solver_counters;
+
 
 // Converts a discretized 3D position into a hash table index.
 // We use this to decide where in the hash table to store each particle for neighbor detection.
 //
 // See: eq 5.1, 5.2, 5.3
 RT_FUNCTION uint hash(int3 pos) {
+  // Dense layout: cells past the walls are clamped into the border, which keeps every pair of neighboring
+  // cells in the same or neighboring hash cells. Only the layers wrap around.
+  if (hash_grid_dimensions.x > 0) {
+    int x = min(max(pos.x - hash_grid_origin.x, 0), int(hash_grid_dimensions.x) - 1);
+    int z = min(max(pos.z - hash_grid_origin.z, 0), int(hash_grid_dimensions.z) - 1);
+    int y = (pos.y - hash_grid_origin.y) % int(hash_grid_dimensions.y);
+    if (y < 0) {
+      y += hash_grid_dimensions.y;
+    }
+    return (uint(y) * hash_grid_dimensions.z + uint(z)) * hash_grid_dimensions.x + uint(x);
+  }
+
   // Primes
   static const int p1 = 73856093;
   static const int p2 = 19349663;
@@ -77,12 +106,17 @@ RT_PROGRAM void update_nearest_neighbors() {
 
   // Increase the particle occupaciation count.
   uint prev_particle_count = atomicAdd(&cell[0], 1);
+  if (prev_particle_count == 0) {
+    atomicAdd(&solver_counters[3], 1);
+  }
 
   // Were we already at max before trying to add this new particle?
   // NOTE: first entry is for count so there are only `HASH_CELL_SIZE-1` particle slots.
+  // The count is left past the max (and clamped when read), so exactly one particle sees the cell overflow.
   if (prev_particle_count >= HASH_CELL_SIZE-1) {
-    // Revert the count to max (idempotent operation).
-    atomicMin(&cell[0], HASH_CELL_SIZE-1);
+    if (prev_particle_count == HASH_CELL_SIZE-1) {
+      atomicAdd(&solver_counters[0], 1);
+    }
   }
 
   // Otherwise, we have now reserved a spot (prev_particle_count) in the hash cell
@@ -93,6 +127,25 @@ RT_PROGRAM void update_nearest_neighbors() {
   }
 }
 
+// Sorts the particles of each hash cell by index (deterministic mode only, launched once per hash cell).
+// Otherwise they are in whichever order the atomicAdd above handed out the slots, which changes from run to run
+// and with it the order that every sum over the neighbors is taken in.
+RT_PROGRAM void sort_nearest_neighbors() {
+  HashCell& cell = hash_table[launch_index];
+  uint n_particles_in_cell = min(cell[0], HASH_CELL_SIZE-1);
+
+  // Insertion sort, as most cells only hold a few particles.
+  for (uint i = 2; i <= n_particles_in_cell; i++) {
+    uint particle_index = cell[i];
+    uint j = i;
+    while (j > 1 && cell[j - 1] > particle_index) {
+      cell[j] = cell[j - 1];
+      j--;
+    }
+    cell[j] = particle_index;
+  }
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
@@ -115,8 +168,8 @@ RT_FUNCTION void nearest_neighbor_search(Particle& p,
         uint cell_index = hash(cell_position);
         HashCell& cell = hash_table[cell_index];
 
-        // Iterate all particles in the cell.
-        uint n_particles_in_cell = cell[0];
+        // Iterate all particles in the cell (the count includes those that did not fit).
+        uint n_particles_in_cell = min(cell[0], HASH_CELL_SIZE-1);
         for (int i = 1; i <= n_particles_in_cell; i++) {
 
           if (cell[i] != launch_index) {
@@ -138,7 +191,8 @@ RT_FUNCTION float poly6_kernel(float distance) {
   if (distance >= support_radius) {
     return 0.0f;
   } else {
-    return (315.0f / (64.0f * M_PIf * powf(support_radius, 9.0f))) * powf(powf(support_radius, 2.0f) - powf(distance, 2.0f), 3.0f);
+    float q = support_radius * support_radius - distance * distance;
+    return poly6_constant * q * q * q;
   }
 }
 
@@ -149,7 +203,8 @@ RT_FUNCTION float3 poly6_kernel_gradient(float3 dist_vec) {
   if (distance >= support_radius) {
     return make_float3(0.0f);
   } else {
-    return -(945.0f / (32.0f * M_PIf * powf(support_radius, 9.0f))) * dist_vec * powf(powf(support_radius, 2.0f) - powf(distance, 2.0f), 2.0f);
+    float q = support_radius * support_radius - distance * distance;
+    return poly6_gradient_constant * dist_vec * q * q;
   }
 }
 
@@ -159,7 +214,9 @@ RT_FUNCTION float poly6_kernel_laplacian(float distance) {
   if (distance >= support_radius) {
     return 0.0f;
   } else {
-    return -(945.0f / (32.0f * M_PIf * powf(support_radius, 9.0f))) * (powf(support_radius, 2.0f) - powf(distance, 2.0f)) * (3.0f * powf(support_radius, 2.0f) - 7.0f * powf(distance, 2.0f));
+    float h2 = support_radius * support_radius;
+    float r2 = distance * distance;
+    return poly6_gradient_constant * (h2 - r2) * (3.0f * h2 - 7.0f * r2);
   }
 }
 
@@ -201,6 +258,8 @@ RT_PROGRAM void update_particles_data() {
   unsigned int nn_count = 0;
   unsigned int nn[3 * 3 * 3 * HASH_CELL_SIZE];
   nearest_neighbor_search(p, nn_count, nn);
+  atomicAdd(&solver_counters[1], nn_count);
+  atomicMax(&solver_counters[2], nn_count);
 
   // Update density and pressure for each particle.
   update_density(p, nn_count, nn);
@@ -222,10 +281,13 @@ RT_FUNCTION float3 pressure_kernel_gradient(float3 dist_vec) {
   float distance = optix::length(dist_vec);
   if (distance >= support_radius) {
     return make_float3(0.0f);
-  } else if (distance < 1e-3) {
-    return -(45.0f / (M_PIf * powf(support_radius, 6.0f))) * make_float3(sign(dist_vec.x), sign(dist_vec.y), sign(dist_vec.z)) * powf(support_radius - distance, 2.0f);
+  }
+
+  float h_minus_r = support_radius - distance;
+  if (distance < 1e-3f) {
+    return spiky_gradient_constant * make_float3(sign(dist_vec.x), sign(dist_vec.y), sign(dist_vec.z)) * h_minus_r * h_minus_r;
   } else {
-    return -(45.0f / (M_PIf * powf(support_radius, 6.0f))) * (dist_vec / distance) * powf(support_radius - distance, 2.0f);
+    return spiky_gradient_constant * (dist_vec / distance) * h_minus_r * h_minus_r;
   }
 }
 
@@ -242,7 +304,7 @@ RT_FUNCTION float3 pressure_force(const Particle& p,
     // Higher pressure between the two particles results in stronger force.
     // The density divisions are used to ensure symmetry.
     // NOTE: eq 4.11 is a bit easier to analyze, but appears to perform worse.
-    force += particle_mass * (p.pressure / powf(p.density, 2.0f) + pi.pressure / powf(pi.density, 2.0f)) * pressure_kernel_gradient(dist_vec);
+    force += particle_mass * (p.pressure / (p.density * p.density) + pi.pressure / (pi.density * pi.density)) * pressure_kernel_gradient(dist_vec);
   }
   force *= -1.0f * p.density; // We negate to convert the vector back to facing towards `p` again.
   return force;
@@ -255,7 +317,7 @@ RT_FUNCTION float viscosity_kernel_laplacian(float distance) {
   if (distance >= support_radius) {
     return 0.0f;
   } else {
-    return (45.0f / (M_PIf * powf(support_radius, 6.0f))) * (support_radius - distance);
+    return viscosity_laplacian_constant * (support_radius - distance);
   }
 }
 
@@ -386,13 +448,82 @@ RT_FUNCTION void collision_detection(Particle& p) {
   p.position = contact_point + 0.000001f * p.velocity;
 }
 
+// Reverses `restitution` of the velocity into the surface, and takes up to `friction` times that impulse off the
+// velocity along it (Coulomb friction).
+RT_FUNCTION float3 collision_response(float3 velocity, float3 surface_normal) {
+  float approach = optix::dot(velocity, surface_normal);
+  if (approach >= 0.0f) {
+    return velocity;
+  }
+
+  float3 normal_velocity = approach * surface_normal;
+  float3 tangential_velocity = velocity - normal_velocity;
+  float tangential_speed = optix::length(tangential_velocity);
+
+  float normal_impulse = -(1.0f + restitution) * approach;
+  float friction_scale = tangential_speed > 0.0f ? max(0.0f, 1.0f - friction * normal_impulse / tangential_speed) : 0.0f;
+  return friction_scale * tangential_velocity - restitution * normal_velocity;
+}
+
+// Moves the particle from `previous` along its velocity for the step, and bounces it off the first wall in its way.
+// What is left of the step continues from the contact, up to 4 times (for corners).
+// Same as `CpuWaterSimulation::swept_collision`, without the obstacle.
+RT_FUNCTION void swept_collision(Particle& p, float3 previous) {
+  const float3 normals[5] = {
+    make_float3(1.0f, 0.0f, 0.0f), make_float3(-1.0f, 0.0f, 0.0f),
+    make_float3(0.0f, 1.0f, 0.0f),
+    make_float3(0.0f, 0.0f, 1.0f), make_float3(0.0f, 0.0f, -1.0f),
+  };
+
+  float3 start = previous;
+  float remaining = dt; // [s]
+
+  for (int bounce = 0; bounce < 4 && remaining > 0.0f; bounce++) {
+    float3 end = start + remaining * p.velocity;
+
+    // Signed distances into the box at both ends.
+    const float d0[5] = { start.x - x_min, x_max - start.x, start.y - y_min, start.z - z_min, z_max - start.z };
+    const float d1[5] = { end.x - x_min, x_max - end.x, end.y - y_min, end.z - z_min, z_max - end.z };
+
+    float toi = 1.0f;
+    int wall = -1;
+    for (int w = 0; w < 5; w++) {
+      if (d1[w] < 0.0f && optix::dot(p.velocity, normals[w]) < 0.0f) {
+        float t = d0[w] > 0.0f ? d0[w] / (d0[w] - d1[w]) : 0.0f;
+        if (t < toi) {
+          toi = t;
+          wall = w;
+        }
+      }
+    }
+
+    if (wall < 0) {
+      start = end;
+      break;
+    }
+
+    start = start + toi * (end - start);
+    remaining *= 1.0f - toi;
+    p.velocity = collision_response(p.velocity, normals[wall]);
+  }
+
+  // Out of bounces, the particle stays at its last contact.
+  p.position = start;
+  collision_detection(p);
+}
+
 // Time integrates each particle and handles boundary collisions.
 RT_PROGRAM void update_particles() {
     Particle& p = particles_buffer[launch_index];
+    float3 previous = p.position;
 
     // Integrate forces over time
     euler_cromer(p, p.force);
 
     // Handle potential collisions
-    collision_detection(p);
+    if (continuous_collisions) {
+      swept_collision(p, previous);
+    } else {
+      collision_detection(p);
+    }
 }
\ No newline at end of file
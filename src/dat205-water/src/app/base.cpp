@@ -16,6 +16,9 @@ Application::Application(ApplicationCreateInfo create_info) {
   // GUI
   m_show_gui = true;
 
+  // Profiling
+  setup_profiling(create_info.profile_path);
+
   // IO
   glfwSetWindowUserPointer(m_window, reinterpret_cast<void*>(this));
   glfwSetKeyCallback(m_window, [](GLFWwindow* window, int key, int scancode, int action, int mods) {
@@ -31,6 +34,15 @@ Application::Application(ApplicationCreateInfo create_info) {
   create_scene();
 
   // Water Simulation
+  m_simulation_backend = create_info.simulation_backend;
+  m_pressure_solver = create_info.pressure_solver;
+  m_scenario = create_info.scenario;
+  m_render_surface = create_info.render_surface;
+  m_obstacle_path = create_info.obstacle_path;
+  m_obstacle_scale = create_info.obstacle_scale;
+  m_obstacle_offset = create_info.obstacle_offset;
+  m_pipelined = create_info.pipelined;
+  m_deterministic = create_info.deterministic;
   setup_water_simulation();
   update_water_simulation(0.0f);
 
@@ -54,6 +66,7 @@ void Application::run() {
     update_scene();
 
     render_scene();
+    record_frame_profile();
     render_gui(prev_fps);
 
     // Swap the front and back buffers of the default (double-buffered) framebuffer.
@@ -70,5 +83,9 @@ void Application::run() {
       start = now;
     }
   }
+
+  // The frame in flight has to be finished before the simulation goes away.
+  m_simulation_pipeline.reset();
+  m_profile_writer.reset();
   m_ctx->destroy();
 }
\ No newline at end of file
@@ -38,7 +38,7 @@ void Application::setup_optix_rendering() {
   }
 
   // Init renderer
-  m_ctx->setEntryPointCount(6);
+  m_ctx->setEntryPointCount(7);
   m_ctx->setRayTypeCount(2);
   m_ctx->setStackSize(2048);
 
@@ -1,5 +1,7 @@
 #include "app.hpp"
 
+#include <chrono>
+
 using namespace optix;
 
 void Application::create_scene() {
@@ -18,6 +20,7 @@ void Application::create_scene() {
 
 void Application::update_scene() {
   if (m_paused) {
+    m_frame_profile.reset(); // Nothing was simulated for this frame.
     return;
   }
 
@@ -46,7 +49,10 @@ void Application::render_scene() {
     m_ctx["camera_forward"]->setFloat(camera_forward);
   }
 
+  // Launches block until they are done, so they can be timed from the host.
+  auto start = std::chrono::steady_clock::now();
   m_ctx->launch(0, m_window_width, m_window_height);
+  m_render_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 
   // Unpack pixel data from CUDA to output texture.
   glActiveTexture(GL_TEXTURE0);
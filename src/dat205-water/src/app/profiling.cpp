@@ -0,0 +1,75 @@
+#include "app.hpp"
+
+#include <cfloat>
+#include <cstdio>
+#include <iostream>
+
+void Application::setup_profiling(std::string const& profile_path) {
+  m_render_seconds = 0.0;
+  for (unsigned int pass = 0; pass < SOLVER_PASS_COUNT; pass++) {
+    m_pass_history[pass].assign(PROFILE_HISTORY, 0.0f);
+  }
+  m_render_history.assign(PROFILE_HISTORY, 0.0f);
+  m_history_offset = 0;
+  m_profiled_frames = 0;
+
+  if (!profile_path.empty()) {
+    m_profile_writer = std::unique_ptr<SolverProfileWriter>(new SolverProfileWriter(profile_path));
+    if (m_profile_writer->is_open()) {
+      std::cout << "Writing the cost of every frame to '" << profile_path << "'." << std::endl;
+    } else {
+      std::cout << "Could not open '" << profile_path << "' for writing." << std::endl;
+      m_profile_writer.reset();
+    }
+  }
+}
+
+// Called once per rendered frame, after the simulation has been updated and the frame has been rendered.
+void Application::record_frame_profile() {
+  for (unsigned int pass = 0; pass < SOLVER_PASS_COUNT; pass++) {
+    m_pass_history[pass][m_history_offset] = (float) (1e3 * m_frame_profile.pass_seconds[pass]);
+  }
+  m_render_history[m_history_offset] = (float) (1e3 * m_render_seconds);
+  m_history_offset = (m_history_offset + 1) % PROFILE_HISTORY;
+
+  if (m_profile_writer) {
+    m_profile_writer->write(m_profiled_frames, m_simulation_time, m_frame_profile, m_render_seconds);
+  }
+  m_profiled_frames++;
+}
+
+void Application::render_profile_gui() {
+  if (!ImGui::CollapsingHeader("Profile")) {
+    return;
+  }
+
+  // The newest frame is right before the oldest one in the ring buffers.
+  unsigned int newest = (m_history_offset + PROFILE_HISTORY - 1) % PROFILE_HISTORY;
+  char overlay[64];
+
+  for (unsigned int pass = 0; pass < SOLVER_PASS_COUNT; pass++) {
+    std::vector<float> const& history = m_pass_history[pass];
+    snprintf(overlay, sizeof(overlay), "%s: %.2f ms", solver_pass_name((SolverPass) pass), history[newest]);
+
+    ImGui::PushID((int) pass);
+    ImGui::PlotHistogram("##pass", history.data(), PROFILE_HISTORY, m_history_offset, overlay, 0.0f, FLT_MAX, ImVec2(0.0f, 40.0f));
+    ImGui::PopID();
+  }
+
+  snprintf(overlay, sizeof(overlay), "render: %.2f ms", m_render_history[newest]);
+  ImGui::PlotHistogram("##render", m_render_history.data(), PROFILE_HISTORY, m_history_offset, overlay, 0.0f, FLT_MAX, ImVec2(0.0f, 40.0f));
+
+  SolverProfile const& profile = m_frame_profile;
+  ImGui::Text("Particles per step: %.0f", profile.average_particles());
+  for (unsigned int pass = 0; pass < SOLVER_PASS_COUNT; pass++) {
+    ImGui::Text("  %s: %.0f", solver_pass_name((SolverPass) pass), profile.average_particles((SolverPass) pass));
+  }
+  ImGui::Text("Neighbors: %.1f average, %u max", profile.average_neighbors(), profile.max_neighbors);
+  ImGui::Text("Overflowed cells: %llu", profile.overflowed_cells);
+  ImGui::Text("Hash table: %u buckets, %.1f%% in use", profile.hash_table.buckets, 100.0 * profile.hash_table.load_factor());
+  if (profile.hash_table.occupied_cells > 0) {
+    ImGui::Text("  %.1f%% of the cells collide", 100.0 * profile.hash_table.collision_rate());
+  }
+  ImGui::Text("Neighbor rebuilds: %llu", profile.neighbor_rebuilds);
+  ImGui::Text("Memory: %.1f MiB", profile.memory_usage / (1024.0 * 1024.0));
+}
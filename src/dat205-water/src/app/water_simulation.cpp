@@ -1,4 +1,11 @@
 #include "app.hpp"
+#include "simulation/cpu_water_simulation.hpp"
+#include "simulation/optix_water_simulation.hpp"
+#include "simulation/signed_distance_field.hpp"
+#include "simulation/water_scenarios.hpp"
+
+#include <algorithm>
+#include <iostream>
 
 using namespace optix;
 
@@ -8,109 +15,62 @@ void Application::setup_water_simulation() {
   setup_water_particles();
   setup_water_geometry();
   setup_water_physics();
+  setup_water_surface();
+  setup_obstacle();
+
+  // The OptiX backend shares the context with the renderer, so only the CPU backend can run alongside it.
+  if (m_pipelined && m_simulation_backend == WaterSimulationBackend::CPU) {
+    std::cout << "Simulating the next frame while rendering the current one." << std::endl;
+    m_simulation_pipeline = std::unique_ptr<SimulationPipeline>(new SimulationPipeline(*m_simulation));
+  }
 }
 
 void Application::setup_water_particles() {
 
-  // Setup CUDA functions (we'll use OptiX for convenience).
-  m_ctx->setRayGenerationProgram(1, m_ctx->createProgramFromPTXFile(ptxPath("water_simulation.cu"), "reset_nearest_neighbors"));
-  m_ctx->setRayGenerationProgram(2, m_ctx->createProgramFromPTXFile(ptxPath("water_simulation.cu"), "update_nearest_neighbors"));
-  m_ctx->setRayGenerationProgram(3, m_ctx->createProgramFromPTXFile(ptxPath("water_simulation.cu"), "update_particles_data"));
-  m_ctx->setRayGenerationProgram(4, m_ctx->createProgramFromPTXFile(ptxPath("water_simulation.cu"), "update_force"));
-  m_ctx->setRayGenerationProgram(5, m_ctx->createProgramFromPTXFile(ptxPath("water_simulation.cu"), "update_particles"));
-
   // Setup particles.
   int side_length = 20; // ~8k particles
-  m_particles_count = side_length * side_length * side_length;
-  std::vector<Particle> particles(m_particles_count);
+  m_max_particles_count = side_length * side_length * side_length;
 
   // We will use a fixed particle radius because the density-based approach (eq 5.20) is quite expensive (involves a cube root).
   // NOTE: should be less than the support radius (not for physical reasons, but for visual reasons).
   m_particles_radius = 0.0135f;
   m_ctx["particle_radius"]->setFloat(m_particles_radius); // [m]
 
-  // Water simulation setup: center setup with no velocity.
-  {
-    float3 offset = make_float3(0.0f, 1.0f, 0.0f) - make_float3((side_length / 2) * 2.0f * m_particles_radius);
-    for (int x = 0; x < side_length; x++) {
-      for (int y = 0; y < side_length; y++) {
-        for (int z = 0; z < side_length; z++) {
-          Particle& p = particles[x * side_length * side_length + y * side_length + z];
-          p.position = offset + 2.0f * m_particles_radius * make_float3(x, y, z);
-          p.velocity = make_float3(0.0f);
-        }
-      }
-    }
-  }
-
-  // Water simulation setup: corner setup with no velocity.
-  // {
-  //   float3 offset = make_float3(-m_box_width + 2.0f * m_particles_radius, 2.0f * m_particles_radius, -m_box_depth + 2.0f * m_particles_radius);
-  //   for (int x = 0; x < side_length; x++) {
-  //     for (int y = 0; y < side_length; y++) {
-  //       for (int z = 0; z < side_length; z++) {
-  //         Particle& p = particles[x * side_length * side_length + y * side_length + z];
-  //         p.position = offset + 2.0f * m_particles_radius * make_float3(x, y, z);
-  //         p.velocity = make_float3(0.0f);
-  //       }
-  //     }
-  //   }
-  // }
-
-  // Water simulation setup: side setup with no velocity.
-  // {
-  //   float3 offset = make_float3(-m_box_width + 2.0f * m_particles_radius, 2.0f * m_particles_radius, -m_box_depth + 2.0f * m_particles_radius);
-  //   for (int x = 0; x < side_length; x++) {
-  //     for (int y = 0; y < side_length; y++) {
-  //       for (int z = 0; z < side_length; z++) {
-  //         Particle& p = particles[x * side_length * side_length + y * side_length + z];
-  //         p.position = offset + m_particles_radius * make_float3(x, y, 3.5f * z);
-  //         p.velocity = make_float3(0.0f);
-  //       }
-  //     }
-  //   }
-  // }
-
-  // Water simulation setup: split cube by velocity (creates a vague vortex).
-  {
-    float3 offset = make_float3(0.0f, 0.5f, 0.0f) - make_float3((side_length / 2) * 2.0f * m_particles_radius);
-    for (int x = 0; x < side_length; x++) {
-      for (int y = 0; y < side_length; y++) {
-        for (int z = 0; z < side_length; z++) {
-          Particle& p = particles[x * side_length * side_length + y * side_length + z];
-          p.position = offset + 2.0f * m_particles_radius * make_float3(x, y, z);
-          p.velocity = make_float3(0.0f, 0.0f, 5.0f * (p.position.x < 0.0f ? 1.0f : -1.0f));
-        }
-      }
-    }
-  }
+  std::cout << "Water scenario: " << water_scenario_name(m_scenario) << std::endl;
+  std::vector<Particle> particles = create_water_particles(m_scenario, side_length, m_particles_radius, water_box());
+  m_particles_count = particles.size();
 
   // Create particles buffer.
   m_particles_buffer = m_ctx->createBuffer(RT_BUFFER_INPUT);
   m_particles_buffer->setFormat(RT_FORMAT_USER);
   m_particles_buffer->setElementSize(sizeof(Particle));
   m_particles_buffer->setSize(particles.size());
+  m_particles_capacity = particles.size();
 
-  // Upload particles data to the GPU buffer.
+  // Upload particles data to the GPU buffer (it is always needed for rendering).
   memcpy(m_particles_buffer->map(), particles.data(), sizeof(Particle) * particles.size());
   m_particles_buffer->unmap();
 
-  // Determine suitable hash table size using eq 5.4: nextPrime(2 * m_particles_count)
-  std::vector<HashCell> hash_table(54001); // Based on 30^3. Prime manually picked from: http://compoasso.free.fr/primelistweb/page/prime/liste_online_en.php
+  m_ctx["particles_buffer"]->setBuffer(m_particles_buffer);
 
-  // Create hash table buffer.
-  m_hash_buffer = m_ctx->createBuffer(RT_BUFFER_INPUT);
-  m_hash_buffer->setFormat(RT_FORMAT_USER);
-  m_hash_buffer->setElementSize(sizeof(HashCell));
-  m_hash_buffer->setSize(hash_table.size());
+  // Create the solver.
+  if (m_simulation_backend == WaterSimulationBackend::CPU) {
+    std::cout << "Simulating water on the CPU." << std::endl;
+    m_simulation = std::unique_ptr<WaterSimulation>(new CpuWaterSimulation());
+  } else {
+    std::cout << "Simulating water with OptiX." << std::endl;
+    m_simulation = std::unique_ptr<WaterSimulation>(new OptixWaterSimulation(m_ctx, m_particles_buffer));
+  }
+  m_simulation->set_particles(particles);
 
-  // Upload initial (empty) hash table data.
-  memcpy(m_hash_buffer->map(), hash_table.data(), sizeof(HashCell) * hash_table.size());
-  m_hash_buffer->unmap();
+  // The CPU backend's particles are kept on the host for rendering. Only it adds and removes water (see main).
+  if (m_simulation_backend == WaterSimulationBackend::CPU) {
+    m_particles = particles;
 
-  // Store the buffers in our OptiX context.
-  m_ctx["particles_buffer"]->setBuffer(m_particles_buffer);
-  m_ctx["hash_table"]->setBuffer(m_hash_buffer);
+    CpuWaterSimulation* simulation = static_cast<CpuWaterSimulation*>(m_simulation.get());
+    simulation->set_emitters(create_water_emitters(m_scenario, side_length, m_particles_radius, water_box()), m_max_particles_count);
+    simulation->set_sinks(create_water_sinks(m_scenario, m_particles_radius, water_box()));
+  }
 }
 
 void Application::setup_water_geometry() {
@@ -125,94 +85,239 @@ void Application::setup_water_geometry() {
   mat->setClosestHitProgram(0, m_ctx->createProgramFromPTXFile(ptxPath("water_rendering.cu"), "closest_hit"));
 
   // Minimal OptiX Geometry Group Setup
-  GeometryInstance geometry_instance = m_ctx->createGeometryInstance();
-  geometry_instance->setMaterialCount(1);
-  geometry_instance->setMaterial(0, mat);
-  geometry_instance->setGeometry(geometry);
+  m_particles_instance = m_ctx->createGeometryInstance();
+  m_particles_instance->setMaterialCount(1);
+  m_particles_instance->setMaterial(0, mat);
+  m_particles_instance->setGeometry(geometry);
 
   m_water_acceleration = m_ctx->createAcceleration(ACC_TYPE);
 
-  GeometryGroup geometry_group = m_ctx->createGeometryGroup();
-  geometry_group->setAcceleration(m_water_acceleration);
-  geometry_group->addChild(geometry_instance);
+  // Holds either the particles or the surface (see set_render_surface).
+  m_water_group = m_ctx->createGeometryGroup();
+  m_water_group->setAcceleration(m_water_acceleration);
+  m_water_group->addChild(m_particles_instance);
 
-  m_root_group->addChild(geometry_group);
+  m_root_group->addChild(m_water_group);
 }
 
 void Application::setup_water_physics() {
+  WaterSimulationParameters params = create_water_simulation_parameters(m_max_particles_count, m_particles_radius, water_box());
+  params.pressure_solver = m_pressure_solver;
+  params.deterministic = m_deterministic;
+  m_simulation->set_parameters(params);
+}
+
+WaterBox Application::water_box() const {
+  WaterBox box;
+  box.width = m_box_width;
+  box.height = m_box_height;
+  box.depth = m_box_depth;
+  return box;
+}
 
-  // Simulation Boundaries (i.e. the glass floor and walls)
-  float margin = m_particles_radius + 0.01f;
-  m_ctx["y_min"]->setFloat(0.0f + margin);
-  m_ctx["x_min"]->setFloat(-m_box_width + margin);
-  m_ctx["x_max"]->setFloat(m_box_width - margin);
-  m_ctx["z_min"]->setFloat(-m_box_depth + margin);
-  m_ctx["z_max"]->setFloat(m_box_depth - margin);
+void Application::update_water_simulation(float dt) {
+  if (m_simulation_pipeline) {
+    // Show the frame that was simulated while the previous one rendered, and start on the next one.
+    // The first call has no finished frame yet and shows the initial particles instead.
+    m_simulation_pipeline->finish(m_particles);
+    capture_water_simulation_stats();
+    m_simulation_pipeline->start(dt);
+  } else {
+    m_simulation->advance(dt);
+    capture_water_simulation_stats();
+    if (m_simulation_backend == WaterSimulationBackend::CPU) {
+      m_simulation->get_particles(m_particles);
+    }
+  }
 
-  // Gravity Acceleration Constant
-  m_ctx["g"]->setFloat(-9.82f); // [m / s^2]
+  // The OptiX backend simulates directly in the particles buffer, but the CPU backend's result has to be uploaded.
+  // Its emitters and drains may have changed how many particles there are to render. The buffer grows with the
+  // solver's capacity, so only the primitive count changes while water flows in.
+  if (m_simulation_backend == WaterSimulationBackend::CPU) {
+    if (m_particles.size() > m_particles_capacity) {
+      CpuWaterSimulation* simulation = static_cast<CpuWaterSimulation*>(m_simulation.get());
+      m_particles_capacity = std::max(m_particles.size(), simulation->particle_capacity());
+      m_particles_buffer->setSize(m_particles_capacity);
+    }
+    if (m_particles.size() != (size_t) m_particles_count) {
+      m_particles_count = m_particles.size();
+      m_particles_instance->getGeometry()->setPrimitiveCount(m_particles_count);
+    }
+    memcpy(m_particles_buffer->map(), m_particles.data(), sizeof(Particle) * m_particles.size());
+    m_particles_buffer->unmap();
+  }
 
-  // Mass-density of water.
-  float rest_density = 998.29f; // [kg / m^3]
-  m_ctx["rest_density"]->setFloat(rest_density); // [kg / m^3]
+  update_water_surface();
 
-  // The volume of water that our particles are together representing.
-  // The current setup is a bit arbitrary, but roughly mimics the cube we start with in setup 1.
-  float fluid_volume = m_particles_count * pow(2.0f * m_particles_radius, 3.0f); // [m^3]
+  // Mark particle bounding boxes as outdated.
+  m_water_acceleration->markDirty();
+}
 
-  // The mass-per-particle amount that follows from this volume.
-  float particle_mass = (fluid_volume / m_particles_count) * rest_density; // [kg]
-  m_ctx["particle_mass"]->setFloat(particle_mass); // [kg]
+// Must be called before using the simulation from outside of `update_water_simulation`.
+void Application::wait_for_water_simulation() {
+  if (m_simulation_pipeline) {
+    m_simulation_pipeline->wait();
+  }
+}
 
-  // Upper bound on pair-wise direct interaction range between particles.
-  // Will produce values very close to 0.0457f (See table on p51)
-  // See eq 5.14 and fig 5.3
-  float average_neighbor_count = 30; // The average amount of neighboring particles we use (at rest density).
-  float support_radius = pow(3.0f * fluid_volume * average_neighbor_count / (4.0f * M_PI * m_particles_count), 1.0f / 3.0f); // [m]
+void Application::capture_water_simulation_stats() {
+  m_substep_count = m_simulation->last_substep_count();
+  m_pressure_iterations = m_simulation->last_pressure_iterations();
+  m_awake_particle_count = m_particles_count;
+  if (m_simulation_backend == WaterSimulationBackend::CPU) {
+    m_awake_particle_count = static_cast<CpuWaterSimulation*>(m_simulation.get())->awake_particle_count();
+  }
+  m_simulation_time = m_simulation->time();
 
-  m_ctx["support_radius"]->setFloat(support_radius); // [m]
+  // Every frame is profiled on its own.
+  m_frame_profile = m_simulation->profile();
+  m_simulation->reset_profile();
+}
 
-  // The side length of the voxel that each hash cell represents.
-  m_ctx["cell_size"]->setFloat(support_radius); // [m], see eq 5.5
+void Application::set_pressure_solver(PressureSolver pressure_solver) {
+  wait_for_water_simulation();
+  m_pressure_solver = pressure_solver;
 
-  // Visocity is slightly exaggerated due to small particle count compared to reality.
-  m_ctx["viscosity"]->setFloat(3.5f); // [Pa * s]
-  // m_ctx["viscosity"]->setFloat(5.0f); // Looks pretty good.
+  WaterSimulationParameters params = m_simulation->parameters();
+  params.pressure_solver = pressure_solver;
+  m_simulation->set_parameters(params);
+}
 
-  // Assuming water (at ~20 celsius) against air. See https://www.wikiwand.com/en/Surface_tension
-  m_ctx["surface_tension"]->setFloat(0.0728f); // [N / m]
+void Application::set_sleeping(bool sleeping) {
+  wait_for_water_simulation();
+  WaterSimulationParameters params = m_simulation->parameters();
+  params.sleeping = sleeping;
+  m_simulation->set_parameters(params);
+}
 
-  // Minimum magnitude of inward surface normals we will consider for surface tension.
-  m_ctx["l_threshold"]->setFloat(7.065f); // []
+void Application::setup_water_surface() {
+  m_surface_reconstructor = std::unique_ptr<SurfaceReconstructor>(new SurfaceReconstructor());
+  m_surface_reconstructor->set_parameters(create_surface_reconstruction_parameters(m_particles_radius));
 
-  // Gass stiffness constant `k` is given by the ideal gas law (eq 5.15): k = PV = nRT
-  // However, its true value would be very large and force an unreasonably small step size.
-  // So, we instead use it as a design param that should be kept as large as possible, without causing instabilities.
-  m_ctx["gass_stiffness"]->setFloat(3.0f); // [J]
+  // Water is a clear dielectric that is mostly seen through.
+  Material mat = m_ctx->createMaterial();
+  mat->setClosestHitProgram(0, m_ctx->createProgramFromPTXFile(ptxPath("closest_hit.cu"), "closest_hit"));
+  mat->setAnyHitProgram(1, m_ctx->createProgramFromPTXFile(ptxPath("any_hit.cu"), "any_hit"));
+  mat["mat_color"]->setFloat(0.3f, 0.55f, 0.9f);
+  mat["mat_emission"]->setFloat(0.0f);
+  mat["mat_metalness"]->setFloat(0.0f);
+  mat["mat_shininess"]->setFloat(60.0f);
+  mat["mat_transparency"]->setFloat(0.8f);
+  mat["mat_reflectivity"]->setFloat(0.5f);
+  mat["mat_fresnel"]->setFloat(0.02f);
+  mat["mat_refractive_index"]->setFloat(1.33f);
+
+  m_surface_instance = m_ctx->createGeometryInstance();
+  m_surface_instance->setMaterialCount(1);
+  m_surface_instance->setMaterial(0, mat);
+
+  set_render_surface(m_render_surface);
+}
 
-  // Conservasion of kinetic energy after collision against boundaries.
-  m_ctx["restitution"]->setFloat(0.5f); // []
+void Application::update_water_surface() {
+  if (!m_render_surface) {
+    return;
+  }
 
+  // The CPU backend's particles have already been downloaded for rendering.
+  if (m_simulation_backend != WaterSimulationBackend::CPU) {
+    m_simulation->get_particles(m_particles);
+  }
+  m_surface_reconstructor->reconstruct(m_particles, m_surface_mesh);
+
+  // The mesh changes size every frame, so it is replaced along with its buffers.
+  Geometry previous = m_surface_geometry;
+  m_surface_geometry = m_scene->create_geometry(m_surface_mesh.vertices, m_surface_mesh.indices);
+  m_surface_instance->setGeometry(m_surface_geometry);
+
+  if (previous.get()) {
+    run_unsafe_optix_code([&]() {
+      previous["vertex_buffer"]->getBuffer()->destroy();
+      previous["index_buffer"]->getBuffer()->destroy();
+      previous->destroy();
+    });
+  }
 }
 
-void Application::update_water_simulation(float dt) {
-  m_ctx["dt"]->setFloat(dt);
+void Application::set_render_surface(bool render_surface) {
+  m_render_surface = render_surface;
 
-  // Reset the hash table to not contain any particles.
-  m_ctx->launch(1, m_particles_count);
+  if (m_render_surface) {
+    update_water_surface();
+    m_water_group->setChild(0, m_surface_instance);
+  } else {
+    m_water_group->setChild(0, m_particles_instance);
+  }
 
-  // (Re)build the hash table.
-  m_ctx->launch(2, m_particles_count);
+  m_water_acceleration->markDirty();
+}
 
-  // Update particle data.
-  m_ctx->launch(3, m_particles_count);
+void Application::setup_obstacle() {
+  if (m_obstacle_path.empty()) {
+    return;
+  }
 
-  // Update particle forces.
-  m_ctx->launch(4, m_particles_count);
+  TriangleMesh mesh;
+  if (!load_triangle_mesh(m_obstacle_path, m_obstacle_scale, m_obstacle_offset, mesh)) {
+    std::cout << "Could not load the obstacle '" << m_obstacle_path << "'." << std::endl;
+    return;
+  }
 
-  // Update simulation by one timestep.
-  m_ctx->launch(5, m_particles_count);
+  // Sampled at the particle radius, and far enough out that a particle can not pass the band in one substep.
+  ThreadPool pool;
+  std::shared_ptr<SignedDistanceField> obstacle = std::make_shared<SignedDistanceField>();
+  obstacle->build(mesh, m_particles_radius, 4.0f * m_particles_radius, pool);
+  // Only the CPU backend is given an obstacle (see main).
+  static_cast<CpuWaterSimulation*>(m_simulation.get())->set_obstacle(obstacle);
+  std::cout << "Obstacle: " << mesh.indices.size() / 3 << " triangles." << std::endl;
+
+  // Smooth shading with area weighted vertex normals.
+  std::vector<VertexData> vertices(mesh.positions.size());
+  for (size_t i = 0; i < mesh.positions.size(); i++) {
+    vertices[i].position = mesh.positions[i];
+    vertices[i].tangent = make_float3(1.0f, 0.0f, 0.0f);
+    vertices[i].normal = make_float3(0.0f);
+    vertices[i].uv = make_float3(0.0f);
+  }
+  for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+    VertexData& a = vertices[mesh.indices[i]];
+    VertexData& b = vertices[mesh.indices[i + 1]];
+    VertexData& c = vertices[mesh.indices[i + 2]];
+    float3 n = cross(b.position - a.position, c.position - a.position);
+    a.normal += n;
+    b.normal += n;
+    c.normal += n;
+  }
+  for (VertexData& v : vertices) {
+    v.normal = dot(v.normal, v.normal) > 0.0f ? normalize(v.normal) : make_float3(0.0f, 1.0f, 0.0f);
+  }
 
-  // Mark particle bounding boxes as outdated.
-  m_water_acceleration->markDirty();
+  // An opaque, slightly glossy solid.
+  Material mat = m_ctx->createMaterial();
+  mat->setClosestHitProgram(0, m_ctx->createProgramFromPTXFile(ptxPath("closest_hit.cu"), "closest_hit"));
+  mat->setAnyHitProgram(1, m_ctx->createProgramFromPTXFile(ptxPath("any_hit.cu"), "any_hit"));
+  mat["mat_color"]->setFloat(0.8f, 0.45f, 0.3f);
+  mat["mat_emission"]->setFloat(0.0f);
+  mat["mat_metalness"]->setFloat(0.0f);
+  mat["mat_shininess"]->setFloat(20.0f);
+  mat["mat_transparency"]->setFloat(0.0f);
+  mat["mat_reflectivity"]->setFloat(0.1f);
+  mat["mat_fresnel"]->setFloat(0.0f);
+  mat["mat_refractive_index"]->setFloat(1.0f);
+
+  run_unsafe_optix_code([&]() {
+    GeometryInstance geometry_instance = m_ctx->createGeometryInstance();
+    geometry_instance->setGeometry(m_scene->create_geometry(vertices, mesh.indices));
+    geometry_instance->setMaterialCount(1);
+    geometry_instance->setMaterial(0, mat);
+
+    Acceleration acceleration = m_ctx->createAcceleration(ACC_TYPE);
+    set_acceleration_properties(acceleration);
+
+    GeometryGroup geometry_group = m_ctx->createGeometryGroup();
+    geometry_group->setAcceleration(acceleration);
+    geometry_group->addChild(geometry_instance);
+
+    m_root_group->addChild(geometry_group);
+  });
 }
@@ -10,6 +10,34 @@ void Application::render_gui(unsigned int fps) {
       } else {
         ImGui::Text("Simulation active.");
       }
+      ImGui::Text("Substeps: %u", m_substep_count);
+
+      // Only the CPU backend implements the iterative pressure solver and sleeping.
+      if (m_simulation_backend == WaterSimulationBackend::CPU) {
+        int pressure_solver = (int) m_pressure_solver;
+        bool changed = ImGui::RadioButton("State equation", &pressure_solver, (int) PressureSolver::STATE_EQUATION);
+        changed |= ImGui::RadioButton("PCISPH", &pressure_solver, (int) PressureSolver::PCISPH);
+        if (changed) {
+          set_pressure_solver((PressureSolver) pressure_solver);
+        }
+        ImGui::Text("Pressure iterations: %u", m_pressure_iterations);
+
+        bool sleeping = m_simulation->parameters().sleeping;
+        if (ImGui::Checkbox("Sleeping", &sleeping)) {
+          set_sleeping(sleeping);
+        }
+        ImGui::Text("Awake particles: %zu of %d", m_awake_particle_count, m_particles_count);
+      }
+
+      bool render_surface = m_render_surface;
+      if (ImGui::Checkbox("Surface", &render_surface)) {
+        set_render_surface(render_surface);
+      }
+      if (m_render_surface) {
+        ImGui::Text("Surface triangles: %zu", m_surface_mesh.indices.size() / 3);
+      }
+
+      render_profile_gui();
       ImGui::End();
     }
   });
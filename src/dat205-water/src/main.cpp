@@ -1,10 +1,83 @@
 #include "app.hpp"
 
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 
-int main() {
+int main(int argc, char** argv) {
   std::cout << "DAT205 application started." << std::endl;
 
+  // The water is simulated on the GPU unless `--cpu` is given.
+  // The water is kept incompressible with PCISPH instead of the state equation if `--pcisph` is given (CPU only).
+  WaterSimulationBackend simulation_backend = WaterSimulationBackend::OPTIX;
+  PressureSolver pressure_solver = PressureSolver::STATE_EQUATION;
+
+  // The initial setup of the water can be picked with `--scenario <name>`.
+  WaterScenario scenario = WaterScenario::SPLIT_VORTEX;
+
+  // The water is rendered as a reconstructed surface instead of one sphere per particle if `--surface` is given.
+  bool render_surface = false;
+
+  // A mesh that the water collides with can be added with `--obstacle <path>` (CPU only), and placed with
+  // `--obstacle-scale <s>` and `--obstacle-offset <x,y,z>`.
+  std::string obstacle_path;
+  float obstacle_scale = 1.0f;
+  optix::float3 obstacle_offset = optix::make_float3(0.0f);
+
+  // The CPU backend simulates the next frame while the current one renders, unless `--sequential` is given.
+  bool pipelined = true;
+
+  // The cost of every solver pass and render launch is dumped per frame with `--profile <path>` (.csv or .json).
+  std::string profile_path;
+
+  // Every run from the same setup simulates the exact same water if `--deterministic` is given.
+  bool deterministic = false;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--cpu") == 0) {
+      simulation_backend = WaterSimulationBackend::CPU;
+    } else if (strcmp(argv[i], "--pcisph") == 0) {
+      pressure_solver = PressureSolver::PCISPH;
+    } else if (strcmp(argv[i], "--sequential") == 0) {
+      pipelined = false;
+    } else if (strcmp(argv[i], "--deterministic") == 0) {
+      deterministic = true;
+    } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+      profile_path = argv[++i];
+    } else if (strcmp(argv[i], "--surface") == 0) {
+      render_surface = true;
+    } else if (strcmp(argv[i], "--obstacle") == 0 && i + 1 < argc) {
+      obstacle_path = argv[++i];
+    } else if (strcmp(argv[i], "--obstacle-scale") == 0 && i + 1 < argc) {
+      obstacle_scale = strtof(argv[++i], nullptr);
+    } else if (strcmp(argv[i], "--obstacle-offset") == 0 && i + 1 < argc) {
+      optix::float3& o = obstacle_offset;
+      if (sscanf(argv[++i], "%f,%f,%f", &o.x, &o.y, &o.z) != 3) {
+        std::cout << "Invalid obstacle offset '" << argv[i] << "', using 0,0,0." << std::endl;
+        o = optix::make_float3(0.0f);
+      }
+    } else if (strcmp(argv[i], "--scenario") == 0 && i + 1 < argc) {
+      if (!parse_water_scenario(argv[++i], scenario)) {
+        std::cout << "Unknown scenario '" << argv[i] << "', using " << water_scenario_name(scenario) << "." << std::endl;
+      }
+    }
+  }
+
+  if (pressure_solver == PressureSolver::PCISPH && simulation_backend != WaterSimulationBackend::CPU) {
+    std::cout << "PCISPH is only implemented by the CPU backend, falling back to the state equation." << std::endl;
+    pressure_solver = PressureSolver::STATE_EQUATION;
+  }
+
+  if (water_scenario_has_emitters(scenario) && simulation_backend != WaterSimulationBackend::CPU) {
+    std::cout << "Emitters and drains are only implemented by the CPU backend, using the center scenario instead." << std::endl;
+    scenario = WaterScenario::CENTER;
+  }
+
+  if (!obstacle_path.empty() && simulation_backend != WaterSimulationBackend::CPU) {
+    std::cout << "Obstacles are only implemented by the CPU backend, ignoring '" << obstacle_path << "'." << std::endl;
+    obstacle_path.clear();
+  }
+
   unsigned int window_width = 1280;
   unsigned int window_height = 720;
 
@@ -22,6 +95,16 @@ int main() {
         .window = window,
         .window_width = window_width,
         .window_height = window_height,
+        .simulation_backend = simulation_backend,
+        .pressure_solver = pressure_solver,
+        .scenario = scenario,
+        .render_surface = render_surface,
+        .obstacle_path = obstacle_path,
+        .obstacle_scale = obstacle_scale,
+        .obstacle_offset = obstacle_offset,
+        .pipelined = pipelined,
+        .profile_path = profile_path,
+        .deterministic = deterministic,
       };
       Application app(create_info);
 
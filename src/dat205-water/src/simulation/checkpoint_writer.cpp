@@ -0,0 +1,87 @@
+#include "simulation/checkpoint_writer.hpp"
+
+CheckpointWriter::CheckpointWriter()
+  : m_has_pending(false),
+    m_writing(false),
+    m_stopping(false),
+    m_checkpoints_written(0),
+    m_checkpoints_replaced(0),
+    m_failed(false) {
+
+  m_thread = std::thread([this]() { writer_loop(); });
+}
+
+CheckpointWriter::~CheckpointWriter() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopping = true;
+  }
+  m_checkpoint_available.notify_one();
+  m_thread.join();
+}
+
+void CheckpointWriter::write(std::string const& path, WaterSimulationState& state) {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_has_pending) {
+      m_checkpoints_replaced++;
+    }
+
+    // The previous pending (or written) state is handed back, which keeps its buffers allocated.
+    std::swap(m_pending, state);
+    m_pending_path = path;
+    m_has_pending = true;
+  }
+  m_checkpoint_available.notify_one();
+}
+
+void CheckpointWriter::wait() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_idle.wait(lock, [&]() { return !m_has_pending && !m_writing; });
+}
+
+unsigned int CheckpointWriter::checkpoints_written() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_checkpoints_written;
+}
+
+unsigned int CheckpointWriter::checkpoints_replaced() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_checkpoints_replaced;
+}
+
+bool CheckpointWriter::failed() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_failed;
+}
+
+void CheckpointWriter::writer_loop() {
+  WaterSimulationState state;
+  std::string path;
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (true) {
+    m_checkpoint_available.wait(lock, [&]() { return m_has_pending || m_stopping; });
+    if (!m_has_pending) {
+      break; // Stopping, and everything has been written.
+    }
+
+    std::swap(state, m_pending);
+    path.swap(m_pending_path);
+    m_has_pending = false;
+    m_writing = true;
+
+    // The simulation may queue the next checkpoint while this one is written.
+    lock.unlock();
+    bool ok = write_water_simulation_state(path, state);
+    lock.lock();
+
+    if (ok) {
+      m_checkpoints_written++;
+    } else {
+      m_failed = true;
+    }
+    m_writing = false;
+    m_idle.notify_all();
+  }
+}
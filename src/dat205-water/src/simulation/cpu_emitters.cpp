@@ -0,0 +1,245 @@
+#include "simulation/cpu_water_simulation.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace optix;
+
+// Emitters and sinks.
+//
+// Particles come and go through the `ParticlePool`, which keeps every other particle in its slot. A removed
+// particle leaves a gap in the per-particle arrays that is kept asleep (and therefore skipped by every pass)
+// until a new particle takes its place. Either way the neighbor lists no longer match the particles, so they
+// are rebuilt in the next step.
+
+void CpuWaterSimulation::set_emitters(std::vector<WaterEmitter> const& emitters, size_t max_particles) {
+  m_emitters = emitters;
+  m_max_particles = max_particles;
+  m_emitter_progress.resize(emitters.size(), 0.0f);
+  m_emitter_layers.resize(emitters.size(), 0);
+}
+
+void CpuWaterSimulation::set_sinks(std::vector<WaterSink> const& sinks) {
+  m_sinks = sinks;
+}
+
+uint8_t const* CpuWaterSimulation::alive_flags() const {
+  return m_particle_pool.has_holes() ? m_particle_pool.alive_flags() : nullptr;
+}
+
+// Moves each emitter's last layer along by a step, and emits a new layer behind it whenever it has moved
+// a particle diameter. The layers are turned by the golden angle so that they do not stack up into columns.
+void CpuWaterSimulation::emit_particles(float dt) {
+  const float spacing = 2.0f * m_parameters.particle_radius;
+  if (spacing <= 0.0f) {
+    return;
+  }
+
+  bool emitted = false;
+  for (size_t e = 0; e < m_emitters.size(); e++) {
+    WaterEmitter const& emitter = m_emitters[e];
+    float speed = length(emitter.velocity);
+    if (speed <= 0.0f) {
+      continue;
+    }
+
+    // Any two directions perpendicular to the velocity span the nozzle.
+    float3 direction = emitter.velocity / speed;
+    float3 up = fabsf(direction.y) < 0.9f ? make_float3(0.0f, 1.0f, 0.0f) : make_float3(1.0f, 0.0f, 0.0f);
+    float3 u = normalize(cross(direction, up));
+    float3 w = cross(direction, u);
+
+    const int n = (int) floorf(emitter.radius / spacing);
+    const float radius2 = emitter.radius * emitter.radius;
+
+    m_emitter_progress[e] += speed * dt;
+    while (m_emitter_progress[e] >= spacing) {
+      m_emitter_progress[e] -= spacing;
+
+      float angle = 2.39996323f * m_emitter_layers[e]++;
+      float3 a = cosf(angle) * u + sinf(angle) * w;
+      float3 b = cross(direction, a);
+      float3 center = emitter.position + m_emitter_progress[e] * direction;
+
+      for (int x = -n; x <= n; x++) {
+        for (int y = -n; y <= n; y++) {
+          float3 offset = spacing * (x * a + y * b);
+          if (dot(offset, offset) > radius2 || m_particle_pool.live_count() >= m_max_particles) {
+            continue;
+          }
+
+          add_particle(center + offset, emitter.velocity);
+          emitted = true;
+        }
+      }
+    }
+  }
+
+  if (emitted) {
+    m_neighbors.clear();
+    m_motion_valid = false;
+    update_awake_particles();
+  }
+}
+
+// Removes the awake particles within a sink. Sleeping particles are never in one, as they stopped somewhere else.
+void CpuWaterSimulation::drain_particles() {
+  if (m_sinks.empty()) {
+    return;
+  }
+
+  bool drained = false;
+  for (unsigned int i : m_awake_particles) {
+    float3 position = m_particles.position(i);
+    for (WaterSink const& sink : m_sinks) {
+      if (sink.min.x <= position.x && position.x <= sink.max.x &&
+          sink.min.y <= position.y && position.y <= sink.max.y &&
+          sink.min.z <= position.z && position.z <= sink.max.z) {
+        m_particle_pool.release(i);
+        m_particles.set_velocity(i, make_float3(0.0f));
+        m_asleep[i] = 1;
+        m_moving[i] = 0;
+        m_still_steps[i] = 0;
+        drained = true;
+        break;
+      }
+    }
+  }
+
+  if (drained) {
+    auto removed = [&](unsigned int i) { return !m_particle_pool.alive(i); };
+    m_output_order.erase(std::remove_if(m_output_order.begin(), m_output_order.end(), removed), m_output_order.end());
+
+    m_neighbors.clear();
+    update_awake_particles();
+  }
+}
+
+// Expects `update_awake_particles` to be called once all particles have been added.
+void CpuWaterSimulation::add_particle(float3 position, float3 velocity) {
+  unsigned int i = m_particle_pool.allocate();
+  if (i >= m_particles.size()) {
+    resize_particle_slots();
+  }
+
+  m_particles.set_position(i, position);
+  m_particles.set_velocity(i, velocity);
+  m_particles.set_force(i, make_float3(0.0f));
+  m_particles.density[i] = m_parameters.rest_density;
+  m_particles.pressure[i] = 0.0f;
+
+  m_asleep[i] = 0;
+  m_moving[i] = 1;
+  m_still_steps[i] = 0;
+  m_rest_positions[i] = position;
+
+  m_output_order.push_back(i);
+}
+
+// Gives every per-particle array as many slots as the pool, and room for as many as its capacity so that
+// adding particles does not reallocate the arrays again until the capacity doubles.
+// The solver scratch space follows on its own (see `update_pressure_pcisph`).
+void CpuWaterSimulation::resize_particle_slots() {
+  const size_t count = m_particle_pool.size();
+  const size_t capacity = m_particle_pool.capacity();
+
+  m_particles.reserve(capacity);
+  m_asleep.reserve(capacity);
+  m_moving.reserve(capacity);
+  m_still_steps.reserve(capacity);
+  m_rest_positions.reserve(capacity);
+  m_awake_particles.reserve(capacity);
+
+  m_particles.resize(count);
+  m_asleep.resize(count, 1);
+  m_moving.resize(count, 0);
+  m_still_steps.resize(count, 0);
+  m_rest_positions.resize(count);
+}
+
+// Fills the gaps with the particles at the end of the arrays.
+void CpuWaterSimulation::compact_particles() {
+  std::vector<unsigned int> new_slots(m_particle_pool.size());
+  for (size_t i = 0; i < new_slots.size(); i++) {
+    new_slots[i] = i;
+  }
+
+  m_particle_pool.compact([&](unsigned int from, unsigned int to) {
+    new_slots[from] = to;
+    m_particles.move(from, to);
+    m_asleep[to] = m_asleep[from];
+    m_moving[to] = m_moving[from];
+    m_still_steps[to] = m_still_steps[from];
+    m_rest_positions[to] = m_rest_positions[from];
+  });
+  resize_particle_slots();
+
+  for (unsigned int& i : m_output_order) {
+    i = new_slots[i];
+  }
+
+  // Sleeping particles are predicted to stay where they are, which is now somewhere else in the arrays.
+  m_predicted_x.clear();
+  m_predicted_y.clear();
+  m_predicted_z.clear();
+
+  m_neighbors.clear();
+  update_awake_particles();
+}
+
+void CpuWaterSimulation::save_particle_pool(StateSectionWriter& writer) const {
+  m_particle_pool.save(writer);
+  writer.write_vector(m_output_order);
+  writer.write_vector(m_emitter_progress);
+  writer.write_vector(m_emitter_layers);
+}
+
+// Spreads the restored particles (in the order of `get_particles`) back out over their slots.
+bool CpuWaterSimulation::restore_particle_pool(StateSectionReader& reader) {
+  ParticlePool pool;
+  std::vector<unsigned int> order;
+  std::vector<float> progress;
+  std::vector<unsigned int> layers;
+  if (!pool.restore(reader) ||
+      !reader.read_vector(order) ||
+      !reader.read_vector(progress) ||
+      !reader.read_vector(layers) ||
+      pool.live_count() != m_particles.size() ||
+      order.size() != m_particles.size() ||
+      progress.size() != layers.size()) {
+    return false;
+  }
+
+  // Every particle must have a slot of its own.
+  std::vector<uint8_t> taken(pool.size(), 0);
+  for (unsigned int i : order) {
+    if (i >= pool.size() || !pool.alive(i) || taken[i]) {
+      return false;
+    }
+    taken[i] = 1;
+  }
+
+  m_reorder_scratch = m_particles;
+  m_particle_pool = pool;
+  m_particles.reserve(pool.capacity());
+  m_particles.resize(pool.size());
+  for (size_t n = 0; n < order.size(); n++) {
+    unsigned int i = order[n];
+    m_particles.set_position(i, m_reorder_scratch.position(n));
+    m_particles.set_velocity(i, m_reorder_scratch.velocity(n));
+    m_particles.set_force(i, m_reorder_scratch.force(n));
+    m_particles.density[i] = m_reorder_scratch.density[n];
+    m_particles.pressure[i] = m_reorder_scratch.pressure[n];
+  }
+  m_output_order = order;
+  resize_particle_slots();
+  wake_all_particles();
+
+  m_emitter_progress = progress;
+  m_emitter_layers = layers;
+  if (!m_emitters.empty()) {
+    m_emitter_progress.resize(m_emitters.size(), 0.0f);
+    m_emitter_layers.resize(m_emitters.size(), 0);
+  }
+  return true;
+}
@@ -0,0 +1,94 @@
+#include "simulation/cpu_water_simulation.hpp"
+
+using namespace optix;
+
+// Particles of the slab workers in `DistributedWaterSimulation`.
+//
+// A worker simulates its slab and a halo around it, and the particles in there only change when the workers
+// exchange them. Between exchanges, the ghosts in the halo are updated in place with what their owners stepped,
+// so the grid, the neighbor lists and the Morton order carry over from step to step like for all of the water.
+// Each particle is known by an id (its index in the arrays that the workers share), and the ids of the last
+// exchange are kept in the order of `get_particles`.
+
+void CpuWaterSimulation::exchange_particles(std::vector<unsigned int> const& ids, Particle const* particles) {
+  // Particles that were set or emitted since have no ids, so they are all replaced.
+  if (m_particle_ids.size() != m_output_order.size()) {
+    set_particles(std::vector<Particle>());
+  }
+
+  // Both lists of ids are in increasing order, so a merge finds the particles that stay, leave and arrive.
+  // Those that leave are released first, so that the ones that arrive can take their slots.
+  std::vector<unsigned int> order;
+  order.reserve(ids.size());
+  bool changed = false;
+
+  size_t previous = 0;
+  for (unsigned int id : ids) {
+    while (previous < m_particle_ids.size() && m_particle_ids[previous] < id) {
+      unsigned int i = m_output_order[previous++];
+      m_particle_pool.release(i);
+      m_asleep[i] = 1;
+      m_moving[i] = 0;
+      m_still_steps[i] = 0;
+      changed = true;
+    }
+
+    if (previous < m_particle_ids.size() && m_particle_ids[previous] == id) {
+      order.push_back(m_output_order[previous++]);
+    } else {
+      order.push_back(~0u);
+      changed = true;
+    }
+  }
+  for (; previous < m_particle_ids.size(); previous++) {
+    unsigned int i = m_output_order[previous];
+    m_particle_pool.release(i);
+    m_asleep[i] = 1;
+    m_moving[i] = 0;
+    m_still_steps[i] = 0;
+    changed = true;
+  }
+
+  for (size_t n = 0; n < ids.size(); n++) {
+    if (order[n] == ~0u) {
+      unsigned int i = m_particle_pool.allocate();
+      if (i >= m_particles.size()) {
+        resize_particle_slots();
+      }
+
+      m_asleep[i] = 0;
+      m_moving[i] = 1;
+      m_still_steps[i] = 0;
+      m_rest_positions[i] = particles[ids[n]].position;
+      order[n] = i;
+    }
+    load_particle(order[n], particles[ids[n]]);
+  }
+
+  m_output_order.swap(order);
+  m_particle_ids = ids;
+  m_motion_valid = false;
+
+  if (changed) {
+    // Sleeping particles are predicted to stay where they are, which may now be another particle's slot.
+    m_predicted_x.clear();
+    m_predicted_y.clear();
+    m_predicted_z.clear();
+
+    m_neighbors.clear();
+    update_awake_particles();
+  }
+}
+
+void CpuWaterSimulation::set_particle(size_t n, Particle const& particle) {
+  load_particle(m_output_order[n], particle);
+  m_motion_valid = false;
+}
+
+void CpuWaterSimulation::load_particle(unsigned int i, Particle const& particle) {
+  m_particles.set_position(i, particle.position);
+  m_particles.set_velocity(i, particle.velocity);
+  m_particles.set_force(i, particle.force);
+  m_particles.density[i] = particle.density;
+  m_particles.pressure[i] = particle.pressure;
+}
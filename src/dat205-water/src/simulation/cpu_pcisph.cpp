@@ -0,0 +1,215 @@
+#include "simulation/cpu_water_simulation.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace optix;
+
+// Predictive-corrective incompressible SPH (Solenthaler and Pajarola 2009).
+//
+// Instead of deriving the pressure from a (necessarily soft) state equation, the pressure is corrected
+// iteratively until the densities predicted for the end of the step are close to the rest density.
+// Every correction reuses the neighbor lists of the step, so each iteration costs about as much as
+// a density pass and the step size is only limited by how far the particles move (see `stable_time_step`).
+
+// The pressure that cancels one unit of density error, for a particle with a full neighborhood (eq 8).
+// The particles start out on a lattice with a spacing of one particle diameter, which is used as that
+// neighborhood. The result is independent of the step size up to a factor of 1 / dt^2, which is left out.
+float CpuWaterSimulation::pcisph_delta() const {
+  const float spacing = 2.0f * m_parameters.particle_radius;
+  if (spacing <= 0.0f || m_parameters.rest_density <= 0.0f) {
+    return 0.0f;
+  }
+
+  float3 gradient_sum = make_float3(0.0f);
+  float gradient_dot_sum = 0.0f;
+
+  int n = (int) ceilf(m_kernels.h / spacing);
+  for (int x = -n; x <= n; x++) {
+    for (int y = -n; y <= n; y++) {
+      for (int z = -n; z <= n; z++) {
+        float3 dist_vec = spacing * make_float3((float) x, (float) y, (float) z);
+        float distance = length(dist_vec);
+        if (distance == 0.0f || distance >= m_kernels.h) {
+          continue;
+        }
+
+        float3 gradient = m_analytic_kernels.spiky.gradient(dist_vec);
+        gradient_sum += gradient;
+        gradient_dot_sum += dot(gradient, gradient);
+      }
+    }
+  }
+
+  float mass_over_rest_density = m_parameters.particle_mass / m_parameters.rest_density;
+  float beta = 2.0f * mass_over_rest_density * mass_over_rest_density;
+  float denominator = beta * (dot(gradient_sum, gradient_sum) + gradient_dot_sum);
+  return denominator > 0.0f ? 1.0f / denominator : 0.0f;
+}
+
+// Replaces the state equation pressure with the PCISPH pressure and adds its force.
+// Expects the forces to hold every other force (see `step`).
+// Only the awake particles are corrected. Sleeping ones have no pressure and are predicted to stay put.
+void CpuWaterSimulation::update_pressure_pcisph(float dt) {
+  const size_t count = m_particles.size();
+
+  if (m_predicted_x.size() != count) {
+    m_predicted_x = m_particles.x;
+    m_predicted_y = m_particles.y;
+    m_predicted_z = m_particles.z;
+  }
+  m_predicted_density.resize(count);
+  m_density_error.resize(count);
+  m_pressure_ax.resize(count);
+  m_pressure_ay.resize(count);
+  m_pressure_az.resize(count);
+  for (unsigned int i : m_awake_particles) {
+    m_pressure_ax[i] = 0.0f;
+    m_pressure_ay[i] = 0.0f;
+    m_pressure_az[i] = 0.0f;
+  }
+
+  m_pressure_iterations = 0;
+  if (m_awake_particles.empty() || dt <= 0.0f) {
+    return;
+  }
+
+  const float delta = m_pcisph_delta / (dt * dt);
+  const unsigned int min_iterations = m_parameters.pressure_min_iterations;
+  const unsigned int max_iterations = std::max(min_iterations, m_parameters.pressure_max_iterations);
+
+  while (true) {
+    predict_positions(dt);
+    float error = predict_density_error();
+
+    if (m_pressure_iterations >= max_iterations ||
+        (m_pressure_iterations >= min_iterations && error <= m_parameters.pressure_tolerance)) {
+      break;
+    }
+
+    // Only compression is corrected, so that the free surface is not pulled together (negative pressure).
+    m_pool.parallel_for(m_awake_particles.size(), [&](size_t begin, size_t end) {
+      for (size_t n = begin; n < end; n++) {
+        unsigned int i = m_awake_particles[n];
+        m_particles.pressure[i] = std::max(0.0f, m_particles.pressure[i] + delta * m_density_error[i]);
+      }
+    });
+
+    update_pressure_acceleration();
+    m_pressure_iterations++;
+  }
+
+  // The integration divides the forces by the density again.
+  m_pool.parallel_for(m_awake_particles.size(), [&](size_t begin, size_t end) {
+    for (size_t n = begin; n < end; n++) {
+      unsigned int i = m_awake_particles[n];
+      float density = m_particles.density[i];
+      m_particles.fx[i] += density * m_pressure_ax[i];
+      m_particles.fy[i] += density * m_pressure_ay[i];
+      m_particles.fz[i] += density * m_pressure_az[i];
+    }
+  });
+}
+
+// Where the particles would end up with the current pressure (Euler-Cromer, without collisions).
+void CpuWaterSimulation::predict_positions(float dt) {
+  m_pool.parallel_for(m_awake_particles.size(), [&](size_t begin, size_t end) {
+    for (size_t n = begin; n < end; n++) {
+      unsigned int i = m_awake_particles[n];
+      float3 acceleration = m_particles.force(i) / m_particles.density[i] + make_float3(m_pressure_ax[i], m_pressure_ay[i], m_pressure_az[i]);
+      float3 position = m_particles.position(i) + dt * (m_particles.velocity(i) + dt * acceleration);
+
+      m_predicted_x[i] = position.x;
+      m_predicted_y[i] = position.y;
+      m_predicted_z[i] = position.z;
+    }
+  });
+}
+
+// Density of the predicted positions minus the rest density. Returns the average relative compression.
+// The sums run over the neighbors of the step (as in PCISPH itself), not those of the predicted positions: a substep
+// can move a particle further than the neighbor skin covers, so pairs that only come within reach are left out.
+float CpuWaterSimulation::predict_density_error() {
+  const size_t count = m_awake_particles.size();
+
+  const SimdLevel level = pass_simd_level();
+  if (level != SimdLevel::SCALAR) {
+    // The density pass writes `gass_stiffness * (density - rest_density)` as the pressure, which with
+    // a stiffness of 1 is exactly the density error.
+    SphPassArguments args(m_particles, m_neighbors, m_kernels, m_parameters);
+    args.x = m_predicted_x.data();
+    args.y = m_predicted_y.data();
+    args.z = m_predicted_z.data();
+    args.density = m_predicted_density.data();
+    args.pressure = m_density_error.data();
+    args.parameters.gass_stiffness = 1.0f;
+    args.particle_indices = m_awake_particles.data();
+
+    m_pool.parallel_for(count, [&](size_t begin, size_t end) {
+      sph_density_pass(level, args, begin, end);
+    });
+  } else if (m_parameters.kernel_table_size > 0) {
+    predicted_density_pass(m_tabulated_kernels);
+  } else {
+    predicted_density_pass(m_analytic_kernels);
+  }
+
+  // Summed in particle order so that the iteration count does not depend on the thread count.
+  double compression = 0.0;
+  for (unsigned int i : m_awake_particles) {
+    compression += std::max(0.0f, m_density_error[i]);
+  }
+  return (float) (compression / (count * m_parameters.rest_density));
+}
+
+template<typename Kernels>
+void CpuWaterSimulation::predicted_density_pass(Kernels const& kernels) {
+  float const* x = m_predicted_x.data();
+  float const* y = m_predicted_y.data();
+  float const* z = m_predicted_z.data();
+
+  m_pool.parallel_for(m_awake_particles.size(), [&](size_t begin, size_t end) {
+    for (size_t n = begin; n < end; n++) {
+      unsigned int i = m_awake_particles[n];
+      float density = m_parameters.particle_mass * kernels.poly6.value(0.0f);
+      for (unsigned int j : m_neighbors.neighbors(i)) {
+        float3 dist_vec = make_float3(x[i] - x[j], y[i] - y[j], z[i] - z[j]);
+        density += m_parameters.particle_mass * kernels.poly6.value(dot(dist_vec, dist_vec));
+      }
+
+      m_predicted_density[i] = density;
+      m_density_error[i] = density - m_parameters.rest_density;
+    }
+  });
+}
+
+// Acceleration caused by the current pressure (eq 4.10 with the rest density, which eq 8 assumes).
+void CpuWaterSimulation::update_pressure_acceleration() {
+  if (m_parameters.kernel_table_size > 0) {
+    pressure_acceleration_pass(m_tabulated_kernels);
+  } else {
+    pressure_acceleration_pass(m_analytic_kernels);
+  }
+}
+
+template<typename Kernels>
+void CpuWaterSimulation::pressure_acceleration_pass(Kernels const& kernels) {
+  ParticleArrays const& ps = m_particles;
+  const float scale = -m_parameters.particle_mass / (m_parameters.rest_density * m_parameters.rest_density);
+
+  m_pool.parallel_for(m_awake_particles.size(), [&](size_t begin, size_t end) {
+    for (size_t n = begin; n < end; n++) {
+      unsigned int i = m_awake_particles[n];
+      float3 acceleration = make_float3(0.0f);
+      for (unsigned int j : m_neighbors.neighbors(i)) {
+        float3 dist_vec = make_float3(ps.x[i] - ps.x[j], ps.y[i] - ps.y[j], ps.z[i] - ps.z[j]);
+        acceleration += (ps.pressure[i] + ps.pressure[j]) * kernels.spiky.gradient(dist_vec);
+      }
+      acceleration *= scale;
+
+      m_pressure_ax[i] = acceleration.x;
+      m_pressure_ay[i] = acceleration.y;
+      m_pressure_az[i] = acceleration.z;
+    }
+  });
+}
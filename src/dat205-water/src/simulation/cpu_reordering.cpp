@@ -0,0 +1,98 @@
+#include "simulation/cpu_water_simulation.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+using namespace optix;
+
+// Spatial sorting of the particle arrays.
+//
+// Particles start out in the order of their lattice, but once the water mixes, the neighbors of a particle end up
+// all over the arrays and nearly every neighbor fetch of the SPH sums misses the cache. Sorting the particles
+// along a Morton (Z-order) curve of their grid cells puts the particles of a cell, and mostly those of the cells
+// around it, next to each other again. Only the slots change, `m_output_order` keeps track of which is which.
+
+// Spreads the lowest 21 bits of `v` out to every third bit.
+static uint64_t spread_bits(uint64_t v) {
+  v &= 0x1fffff;
+  v = (v | v << 32) & 0x1f00000000ffffull;
+  v = (v | v << 16) & 0x1f0000ff0000ffull;
+  v = (v | v << 8)  & 0x100f00f00f00f00full;
+  v = (v | v << 4)  & 0x10c30c30c30c30c3ull;
+  v = (v | v << 2)  & 0x1249249249249249ull;
+  return v;
+}
+
+static uint64_t morton_code(int3 cell) {
+  return spread_bits(cell.x) | spread_bits(cell.y) << 1 | spread_bits(cell.z) << 2;
+}
+
+template<typename T>
+static void gather(std::vector<T>& values, std::vector<unsigned int> const& order) {
+  std::vector<T> sorted(order.size());
+  for (size_t n = 0; n < order.size(); n++) {
+    sorted[n] = values[order[n]];
+  }
+  values.swap(sorted);
+}
+
+// Sorts the particles by the Morton code of their cell (of side length `cell_size`), and drops the gaps between
+// them on the way. Particles in the same cell keep their relative order, so the result only depends on where the
+// particles are. The neighbor lists have to be rebuilt afterwards.
+void CpuWaterSimulation::reorder_particles(float cell_size) {
+  const size_t count = m_particle_pool.size();
+
+  auto cell_of = [&](unsigned int i) {
+    return make_int3(int(floorf(m_particles.x[i] / cell_size)),
+                     int(floorf(m_particles.y[i] / cell_size)),
+                     int(floorf(m_particles.z[i] / cell_size)));
+  };
+
+  // The codes are taken relative to the lowest cell, which leaves 21 bits per axis for the extent of the water.
+  int3 first = make_int3(INT_MAX);
+  m_reorder_keys.clear();
+  for (size_t i = 0; i < count; i++) {
+    if (m_particle_pool.alive(i)) {
+      int3 cell = cell_of(i);
+      first = make_int3(std::min(first.x, cell.x), std::min(first.y, cell.y), std::min(first.z, cell.z));
+      m_reorder_keys.push_back(std::make_pair(0ull, (unsigned int) i));
+    }
+  }
+
+  m_pool.parallel_for(m_reorder_keys.size(), [&](size_t begin, size_t end) {
+    for (size_t n = begin; n < end; n++) {
+      m_reorder_keys[n].first = morton_code(cell_of(m_reorder_keys[n].second) - first);
+    }
+  });
+
+  // Ties are broken by the slot, which keeps the relative order within a cell.
+  std::sort(m_reorder_keys.begin(), m_reorder_keys.end());
+
+  std::vector<unsigned int> order(m_reorder_keys.size());
+  std::vector<unsigned int> new_slots(count, 0);
+  for (size_t n = 0; n < order.size(); n++) {
+    order[n] = m_reorder_keys[n].second;
+    new_slots[order[n]] = n;
+  }
+
+  m_reorder_scratch.gather(m_particles, order);
+  std::swap(m_particles, m_reorder_scratch);
+  gather(m_asleep, order);
+  gather(m_moving, order);
+  gather(m_still_steps, order);
+  gather(m_rest_positions, order);
+
+  for (unsigned int& i : m_output_order) {
+    i = new_slots[i];
+  }
+  m_particle_pool.reset(order.size());
+
+  // Sleeping particles are predicted to stay where they are, which is now somewhere else in the arrays.
+  m_predicted_x.clear();
+  m_predicted_y.clear();
+  m_predicted_z.clear();
+
+  m_neighbors.clear();
+  update_awake_particles();
+}
@@ -0,0 +1,741 @@
+#include "simulation/cpu_water_simulation.hpp"
+#include "simulation/water_simulation_state.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+
+using namespace optix;
+
+// A particle that is driven into a corner bounces off each of its walls in turn.
+static const unsigned int MAX_COLLISION_BOUNCES = 4;
+
+// Steps of a sweep along the obstacle's distance field, which only converges slowly for grazing motion.
+static const unsigned int MAX_OBSTACLE_ITERATIONS = 16;
+
+CpuWaterSimulation::CpuWaterSimulation(unsigned int thread_count)
+  : m_pool(thread_count),
+    m_kernels(),
+    m_simd_level(detect_simd_level()),
+    m_rebuilds_since_reorder(0),
+    m_motion_valid(false),
+    m_max_speed(0.0f),
+    m_max_acceleration(0.0f),
+    m_max_particles(0),
+    m_pcisph_delta(0.0f),
+    m_pressure_iterations(0) {}
+
+void CpuWaterSimulation::set_parameters(WaterSimulationParameters const& parameters) {
+  // The cached lists are in another order than the deterministic mode expects.
+  if (parameters.deterministic != m_parameters.deterministic) {
+    m_neighbors.clear();
+  }
+
+  WaterSimulation::set_parameters(parameters);
+  m_kernels = make_sph_kernel_constants(parameters.support_radius);
+  m_analytic_kernels = make_analytic_sph_kernels(m_kernels);
+  m_tabulated_kernels = parameters.kernel_table_size > 0 ? make_tabulated_sph_kernels(m_kernels, parameters.kernel_table_size)
+                                                         : TabulatedSphKernels();
+  m_pcisph_delta = pcisph_delta();
+}
+
+void CpuWaterSimulation::set_particles(std::vector<Particle> const& particles) {
+  m_particles.from_particles(particles);
+  m_particle_pool.reset(particles.size());
+  m_output_order.resize(particles.size());
+  for (size_t i = 0; i < particles.size(); i++) {
+    m_output_order[i] = i;
+  }
+  m_particle_ids.clear();
+  m_rebuilds_since_reorder = 0;
+  m_neighbors.clear();
+  m_motion_valid = false;
+  wake_all_particles();
+
+  // The emitters start over with the new particles.
+  std::fill(m_emitter_progress.begin(), m_emitter_progress.end(), 0.0f);
+  std::fill(m_emitter_layers.begin(), m_emitter_layers.end(), 0);
+
+  // PCISPH predicts every particle again (see `update_pressure_pcisph`).
+  m_predicted_x.clear();
+  m_predicted_y.clear();
+  m_predicted_z.clear();
+}
+
+void CpuWaterSimulation::get_particles(std::vector<Particle>& particles) {
+  m_particles.to_particles(particles, m_output_order);
+}
+
+void CpuWaterSimulation::save_state(WaterSimulationState& state) {
+  WaterSimulation::save_state(state);
+
+  StateSectionWriter pool_writer(state.sections["particle_pool"]);
+  save_particle_pool(pool_writer);
+
+  StateSectionWriter writer(state.sections["cpu"]);
+  writer.write(m_simd_level);
+  writer.write(m_motion_valid);
+  writer.write(m_max_speed);
+  writer.write(m_max_acceleration);
+  m_neighbors.save(writer);
+  writer.write_vector(m_asleep);
+  writer.write_vector(m_moving);
+  writer.write_vector(m_still_steps);
+  writer.write_vector(m_rest_positions);
+  writer.write(m_rebuilds_since_reorder);
+}
+
+bool CpuWaterSimulation::restore_state(WaterSimulationState const& state) {
+  if (!WaterSimulation::restore_state(state)) {
+    return false;
+  }
+
+  // The saved particles are in the order of `get_particles` and leave out the gaps between them, so they have to
+  // be put back into their slots first for the per-particle arrays below to line up. Without the section every
+  // particle is in its own slot (e.g. in checkpoints of another backend).
+  auto pool_section = state.sections.find("particle_pool");
+  if (pool_section != state.sections.end()) {
+    StateSectionReader pool_reader(pool_section->second);
+    if (!restore_particle_pool(pool_reader)) {
+      return false;
+    }
+  }
+
+  // Without its section (e.g. a checkpoint of another backend) the lists are simply rebuilt.
+  auto section = state.sections.find("cpu");
+  if (section == state.sections.end()) {
+    return true;
+  }
+
+  // Other instruction sets round differently, so the saved one is used if this CPU supports it.
+  StateSectionReader reader(section->second);
+  SimdLevel level;
+  if (!reader.read(level) ||
+      !reader.read(m_motion_valid) ||
+      !reader.read(m_max_speed) ||
+      !reader.read(m_max_acceleration) ||
+      !m_neighbors.restore(reader) ||
+      !reader.read_vector(m_asleep) ||
+      !reader.read_vector(m_moving) ||
+      !reader.read_vector(m_still_steps) ||
+      !reader.read_vector(m_rest_positions) ||
+      !reader.read(m_rebuilds_since_reorder) ||
+      m_asleep.size() != m_particles.size() ||
+      m_moving.size() != m_particles.size() ||
+      m_still_steps.size() != m_particles.size() ||
+      m_rest_positions.size() != m_particles.size()) {
+    m_motion_valid = false;
+    wake_all_particles();
+    return false;
+  }
+  set_simd_level(level);
+  update_awake_particles();
+
+  return true;
+}
+
+SimdLevel CpuWaterSimulation::simd_level() const {
+  return m_simd_level;
+}
+
+void CpuWaterSimulation::set_simd_level(SimdLevel level) {
+  m_simd_level = std::min(level, detect_simd_level());
+}
+
+SimdLevel CpuWaterSimulation::pass_simd_level() const {
+  return m_parameters.deterministic || m_parameters.kernel_table_size > 0 ? SimdLevel::SCALAR : m_simd_level;
+}
+
+void CpuWaterSimulation::measure_motion(float& max_speed, float& max_acceleration) {
+  if (!m_motion_valid) {
+    WaterSimulation::measure_motion(m_max_speed, m_max_acceleration);
+    m_motion_valid = true;
+  }
+  max_speed = m_max_speed;
+  max_acceleration = m_max_acceleration;
+
+  // Particles that are emitted during the next step leave their emitter at its speed.
+  for (WaterEmitter const& emitter : m_emitters) {
+    max_speed = std::max(max_speed, length(emitter.velocity));
+  }
+}
+
+void CpuWaterSimulation::step(float dt) {
+  if (m_particle_pool.needs_compaction()) {
+    compact_particles();
+  }
+  emit_particles(dt);
+
+  // Only the neighbor search visits the sleeping particles too.
+  const size_t awake = m_awake_particles.size();
+  const size_t live = m_particle_pool.live_count();
+  {
+    ScopedPassTimer timer(m_profile, SolverPass::NEIGHBOR_SEARCH, live);
+    update_nearest_neighbors();
+  }
+  {
+    ScopedPassTimer timer(m_profile, SolverPass::DENSITY, awake);
+    update_particles_data();
+  }
+
+  // PCISPH solves for the pressure separately, so the force pass should then only sum the other forces.
+  bool pcisph = m_parameters.pressure_solver == PressureSolver::PCISPH;
+  {
+    ScopedPassTimer timer(m_profile, SolverPass::FORCE, awake);
+    if (pcisph) {
+      // Including the sleeping particles, whose pressure would otherwise also push their neighbors here.
+      std::fill(m_particles.pressure.begin(), m_particles.pressure.end(), 0.0f);
+    }
+    update_force();
+  }
+  {
+    ScopedPassTimer timer(m_profile, SolverPass::PRESSURE_SOLVE, pcisph ? awake : 0);
+    if (pcisph) {
+      update_pressure_pcisph(dt);
+    } else {
+      m_pressure_iterations = 0;
+    }
+  }
+  {
+    ScopedPassTimer timer(m_profile, SolverPass::INTEGRATION, awake);
+    update_particles(dt);
+    update_sleeping();
+    drain_particles();
+  }
+
+  m_profile.steps++;
+  m_profile.particle_steps += live;
+  m_profile.neighbor_entries += m_neighbors.pair_count();
+  m_profile.max_neighbors = std::max(m_profile.max_neighbors, m_neighbors.max_neighbor_count());
+  m_profile.memory_usage = memory_usage();
+  m_profile.hash_table = m_grid_statistics;
+}
+
+void CpuWaterSimulation::set_obstacle(std::shared_ptr<SignedDistanceField const> obstacle) {
+  m_obstacle = obstacle;
+}
+
+size_t CpuWaterSimulation::awake_particle_count() const {
+  return m_awake_particles.size();
+}
+
+size_t CpuWaterSimulation::particle_count() const {
+  return m_particle_pool.live_count();
+}
+
+size_t CpuWaterSimulation::particle_capacity() const {
+  return std::max(m_particle_pool.capacity(), m_particle_pool.size());
+}
+
+size_t CpuWaterSimulation::memory_usage() const {
+  size_t pcisph_floats = m_predicted_x.capacity() + m_predicted_y.capacity() + m_predicted_z.capacity() +
+                         m_predicted_density.capacity() + m_density_error.capacity() +
+                         m_pressure_ax.capacity() + m_pressure_ay.capacity() + m_pressure_az.capacity();
+
+  size_t sleeping_bytes = m_awake_particles.capacity() * sizeof(unsigned int) +
+                          m_rest_positions.capacity() * sizeof(float3) +
+                          m_asleep.capacity() + m_moving.capacity() + m_still_steps.capacity();
+
+  size_t order_bytes = (m_output_order.capacity() + m_output_ranks.capacity() + m_particle_ids.capacity()) * sizeof(unsigned int) +
+                       m_reorder_keys.capacity() * sizeof(m_reorder_keys[0]);
+
+  size_t table_bytes = m_tabulated_kernels.poly6.memory_usage() + m_tabulated_kernels.spiky.memory_usage() +
+                       m_tabulated_kernels.viscosity.memory_usage();
+
+  return m_particles.memory_usage() + m_particle_pool.memory_usage() + m_grid.memory_usage() + m_neighbors.memory_usage() +
+         pcisph_floats * sizeof(float) + sleeping_bytes + m_reorder_scratch.memory_usage() + order_bytes + table_bytes;
+}
+
+unsigned int CpuWaterSimulation::last_pressure_iterations() const {
+  return m_pressure_iterations;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+
+// Updates the grid and rebuilds the neighbor lists, but only once the cached lists may be missing pairs.
+void CpuWaterSimulation::update_nearest_neighbors() {
+  uint8_t const* alive = alive_flags();
+  if (!m_neighbors.needs_rebuild(m_particles, m_pool, alive)) {
+    return;
+  }
+
+  // The 3x3x3 cell search only covers the extended radius if the cells are at least that large.
+  float radius = m_parameters.support_radius + m_parameters.neighbor_skin;
+  float cell_size = std::max(m_parameters.cell_size, radius);
+
+  // Sorting moves nearly every particle to another slot, so the grid is built from scratch afterwards.
+  m_rebuilds_since_reorder++;
+  if (m_parameters.reorder_interval > 0 && m_rebuilds_since_reorder >= m_parameters.reorder_interval) {
+    reorder_particles(cell_size);
+    alive = alive_flags();
+    m_grid.build(m_particles, cell_size, m_pool, alive);
+    m_profile.particle_reorders++;
+  } else {
+    m_grid.update(m_particles, cell_size, m_pool, alive);
+  }
+
+  // Deterministic sums run in the order of `get_particles`, which unlike the slots does not change when the
+  // particles are sorted, and is the same for a slab of `DistributedWaterSimulation` as for all of the water.
+  unsigned int const* order = nullptr;
+  if (m_parameters.deterministic) {
+    m_output_ranks.assign(m_particles.size(), 0);
+    for (size_t n = 0; n < m_output_order.size(); n++) {
+      m_output_ranks[m_output_order[n]] = n;
+    }
+    order = m_output_ranks.data();
+  }
+  m_neighbors.build(m_particles, m_grid, radius, m_parameters.neighbor_skin, m_pool, alive, order);
+  m_profile.neighbor_rebuilds++;
+  m_profile.grid_migrations += m_grid.migration_count();
+  m_grid_statistics = m_grid.statistics();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+
+// Density (eq 4.6) and pressure (eq 4.12) of each particle.
+// Only positions are read, so only the position arrays are streamed through the cache.
+void CpuWaterSimulation::update_particles_data() {
+  const SimdLevel level = pass_simd_level();
+  if (level != SimdLevel::SCALAR) {
+    SphPassArguments args(m_particles, m_neighbors, m_kernels, m_parameters);
+    args.particle_indices = m_awake_particles.data();
+    m_pool.parallel_for(m_awake_particles.size(), [&](size_t begin, size_t end) {
+      sph_density_pass(level, args, begin, end);
+    });
+  } else if (m_parameters.kernel_table_size > 0) {
+    density_pass(m_tabulated_kernels);
+  } else {
+    density_pass(m_analytic_kernels);
+  }
+}
+
+template<typename Kernels>
+void CpuWaterSimulation::density_pass(Kernels const& kernels) {
+  float const* x = m_particles.x.data();
+  float const* y = m_particles.y.data();
+  float const* z = m_particles.z.data();
+
+  m_pool.parallel_for(m_awake_particles.size(), [&](size_t begin, size_t end) {
+    for (size_t n = begin; n < end; n++) {
+      unsigned int i = m_awake_particles[n];
+      float density = m_parameters.particle_mass * kernels.poly6.value(0.0f);
+      for (unsigned int j : m_neighbors.neighbors(i)) {
+        float3 dist_vec = make_float3(x[i] - x[j], y[i] - y[j], z[i] - z[j]);
+        density += m_parameters.particle_mass * kernels.poly6.value(dot(dist_vec, dist_vec));
+      }
+
+      m_particles.density[i] = density;
+      m_particles.pressure[i] = m_parameters.gass_stiffness * (density - m_parameters.rest_density);
+    }
+  });
+}
+
+// See eq 4.10 and fig 4.3
+template<typename Kernels>
+float3 CpuWaterSimulation::pressure_force(Kernels const& kernels, unsigned int i, NeighborRange nn) const {
+  ParticleArrays const& ps = m_particles;
+
+  float3 force = make_float3(0.0f);
+  for (unsigned int j : nn) {
+    float3 dist_vec = make_float3(ps.x[i] - ps.x[j], ps.y[i] - ps.y[j], ps.z[i] - ps.z[j]);
+    force += m_parameters.particle_mass * (ps.pressure[i] / (ps.density[i] * ps.density[i]) + ps.pressure[j] / (ps.density[j] * ps.density[j])) * kernels.spiky.gradient(dist_vec);
+  }
+  force *= -1.0f * ps.density[i];
+  return force;
+}
+
+// See eq 4.17
+template<typename Kernels>
+float3 CpuWaterSimulation::viscosity_force(Kernels const& kernels, unsigned int i, NeighborRange nn) const {
+  ParticleArrays const& ps = m_particles;
+
+  float3 force = make_float3(0.0f);
+  for (unsigned int j : nn) {
+    float3 dist_vec = make_float3(ps.x[j] - ps.x[i], ps.y[j] - ps.y[i], ps.z[j] - ps.z[i]);
+    float3 velocity_difference = make_float3(ps.vx[j] - ps.vx[i], ps.vy[j] - ps.vy[i], ps.vz[j] - ps.vz[i]);
+    force += velocity_difference * (m_parameters.particle_mass / ps.density[j]) * kernels.viscosity.laplacian(dot(dist_vec, dist_vec));
+  }
+  force *= m_parameters.viscosity;
+  return force;
+}
+
+// See eq 4.24
+float3 CpuWaterSimulation::gravity_force(float particle_density) const {
+  return particle_density * make_float3(0.0f, m_parameters.g, 0.0f);
+}
+
+// See eq 4.26, 4.27 and 4.28
+template<typename Kernels>
+float3 CpuWaterSimulation::surface_tension_force(Kernels const& kernels, unsigned int i, NeighborRange nn) const {
+  ParticleArrays const& ps = m_particles;
+
+  float3 inward_surface_normal = make_float3(0.0f);
+  for (unsigned int j : nn) {
+    float3 dist_vec = make_float3(ps.x[i] - ps.x[j], ps.y[i] - ps.y[j], ps.z[i] - ps.z[j]);
+    inward_surface_normal += (m_parameters.particle_mass / ps.density[j]) * kernels.poly6.gradient(dist_vec);
+  }
+
+  float normal_dist = length(inward_surface_normal);
+  if (normal_dist < m_parameters.l_threshold) {
+    return make_float3(0.0f);
+  }
+
+  float laplacian = (m_parameters.particle_mass / ps.density[i]) * kernels.poly6.laplacian(0.0f);
+  for (unsigned int j : nn) {
+    float3 dist_vec = make_float3(ps.x[i] - ps.x[j], ps.y[i] - ps.y[j], ps.z[i] - ps.z[j]);
+    laplacian += (m_parameters.particle_mass / ps.density[j]) * kernels.poly6.laplacian(dot(dist_vec, dist_vec));
+  }
+
+  return -m_parameters.surface_tension * laplacian * (inward_surface_normal / normal_dist);
+}
+
+// See p54
+void CpuWaterSimulation::update_force() {
+  const SimdLevel level = pass_simd_level();
+  if (level != SimdLevel::SCALAR) {
+    SphPassArguments args(m_particles, m_neighbors, m_kernels, m_parameters);
+    args.particle_indices = m_awake_particles.data();
+    m_pool.parallel_for(m_awake_particles.size(), [&](size_t begin, size_t end) {
+      sph_force_pass(level, args, begin, end);
+    });
+  } else if (m_parameters.kernel_table_size > 0) {
+    force_pass(m_tabulated_kernels);
+  } else {
+    force_pass(m_analytic_kernels);
+  }
+}
+
+template<typename Kernels>
+void CpuWaterSimulation::force_pass(Kernels const& kernels) {
+  m_pool.parallel_for(m_awake_particles.size(), [&](size_t begin, size_t end) {
+    for (size_t n = begin; n < end; n++) {
+      unsigned int i = m_awake_particles[n];
+      NeighborRange nn = m_neighbors.neighbors(i);
+
+      float3 tot_force = make_float3(0.0f);
+
+      // Internal forces
+      tot_force += pressure_force(kernels, i, nn);
+      tot_force += viscosity_force(kernels, i, nn);
+
+      // External forces
+      tot_force += gravity_force(m_particles.density[i]);
+      tot_force += surface_tension_force(kernels, i, nn);
+
+      m_particles.set_force(i, tot_force);
+    }
+  });
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+
+// Moves a particle from `previous` along `velocity` for `dt` seconds, and bounces it off the first wall or obstacle
+// surface in its way. What is left of the substep continues from the contact, up to `MAX_COLLISION_BOUNCES` times.
+// Anything that still ends up outside (e.g. a particle that started there) is projected back as a last resort.
+void CpuWaterSimulation::swept_collision(float3 previous, float3& position, float3& velocity, float dt) const {
+  float3 start = previous;
+  float remaining = dt; // [s]
+
+  for (unsigned int bounce = 0; bounce < MAX_COLLISION_BOUNCES && remaining > 0.0f; bounce++) {
+    float3 end = start + remaining * velocity;
+
+    float toi = 1.0f;
+    float3 surface_normal;
+    bool wall = box_time_of_impact(start, end, velocity, toi, surface_normal);
+    bool obstacle = m_obstacle && obstacle_time_of_impact(start, end, velocity, toi, surface_normal);
+    if (!wall && !obstacle) {
+      start = end;
+      remaining = 0.0f;
+      break;
+    }
+
+    start = start + toi * (end - start);
+    remaining *= 1.0f - toi;
+    velocity = collision_response(velocity, surface_normal);
+  }
+
+  // Out of bounces, the particle stays at its last contact.
+  position = start;
+  collision_detection(position, velocity, dt);
+}
+
+// The earliest fraction of the segment from `start` to `end` at which the particle moves out through a wall.
+// Only lowers `toi`, and returns whether it did.
+bool CpuWaterSimulation::box_time_of_impact(float3 start, float3 end, float3 velocity, float& toi, float3& surface_normal) const {
+  const WaterSimulationParameters& b = m_parameters;
+
+  // Signed distances into the box at both ends, and the inward normal of each wall.
+  const float d0[5] = { start.x - b.x_min, b.x_max - start.x, start.y - b.y_min, start.z - b.z_min, b.z_max - start.z };
+  const float d1[5] = { end.x - b.x_min, b.x_max - end.x, end.y - b.y_min, end.z - b.z_min, b.z_max - end.z };
+  const float3 normals[5] = {
+    make_float3(1.0f, 0.0f, 0.0f), make_float3(-1.0f, 0.0f, 0.0f),
+    make_float3(0.0f, 1.0f, 0.0f),
+    make_float3(0.0f, 0.0f, 1.0f), make_float3(0.0f, 0.0f, -1.0f),
+  };
+
+  bool hit = false;
+  for (unsigned int w = 0; w < 5; w++) {
+    if (d1[w] >= 0.0f || dot(velocity, normals[w]) >= 0.0f) {
+      continue;
+    }
+
+    // A particle that already is outside collides right away.
+    float t = d0[w] > 0.0f ? d0[w] / (d0[w] - d1[w]) : 0.0f;
+    if (t < toi) {
+      toi = t;
+      surface_normal = normals[w];
+      hit = true;
+    }
+  }
+  return hit;
+}
+
+// Same as `box_time_of_impact` for the obstacle, which the particles keep a radius away from. The distance field
+// never overestimates the distance to the surface by much, so the particle is advanced by it until it touches.
+bool CpuWaterSimulation::obstacle_time_of_impact(float3 start, float3 end, float3 velocity, float& toi, float3& surface_normal) const {
+  const float3 segment = end - start;
+  const float segment_length = length(segment);
+  const float tolerance = 0.01f * m_parameters.particle_radius; // [m]
+
+  float t = 0.0f;
+  for (unsigned int iteration = 0; iteration < MAX_OBSTACLE_ITERATIONS && t < toi; iteration++) {
+    float3 gradient;
+    float distance = m_obstacle->distance(start + t * segment, gradient) - m_parameters.particle_radius;
+    if (distance <= tolerance) {
+      // Particles that touch the surface but move away from it are free to go.
+      if (dot(gradient, gradient) == 0.0f || dot(velocity, gradient) >= 0.0f) {
+        return false;
+      }
+      toi = t;
+      surface_normal = normalize(gradient);
+      return true;
+    }
+
+    if (segment_length == 0.0f) {
+      return false;
+    }
+    t += distance / segment_length;
+  }
+  return false;
+}
+
+// Reverses `restitution` of the velocity into the surface, and takes up to `friction` times that impulse off the
+// velocity along it (Coulomb friction), which stops particles that slide slowly.
+float3 CpuWaterSimulation::collision_response(float3 velocity, float3 surface_normal) const {
+  float approach = dot(velocity, surface_normal);
+  if (approach >= 0.0f) {
+    return velocity;
+  }
+
+  float3 normal_velocity = approach * surface_normal;
+  float3 tangential_velocity = velocity - normal_velocity;
+  float tangential_speed = length(tangential_velocity);
+
+  float normal_impulse = -(1.0f + m_parameters.restitution) * approach;
+  float friction_scale = tangential_speed > 0.0f ? std::max(0.0f, 1.0f - m_parameters.friction * normal_impulse / tangential_speed) : 0.0f;
+  return friction_scale * tangential_velocity - m_parameters.restitution * normal_velocity;
+}
+
+// Projects escaped particles back onto the box and reflects their velocity (eq 4.58).
+void CpuWaterSimulation::collision_detection(float3& position, float3& velocity, float dt) const {
+  const WaterSimulationParameters& b = m_parameters;
+
+  if (m_obstacle) {
+    obstacle_collision(position, velocity, dt);
+  }
+
+  // Early Exit (no collision possible)
+  if (b.x_min <= position.x && position.x <= b.x_max &&
+      b.y_min <= position.y &&
+      b.z_min <= position.z && position.z <= b.z_max) {
+    return;
+  }
+
+  float3 contact_point = position;
+  contact_point.x = std::min(b.x_max, std::max(b.x_min, position.x));
+  contact_point.y = std::max(b.y_min, position.y);
+  contact_point.z = std::min(b.z_max, std::max(b.z_min, position.z));
+
+  float3 surface_normal = normalize(contact_point - position);
+
+  float penetration_depth = length(position - contact_point);
+  velocity = velocity - (1.0f + b.restitution * penetration_depth / (dt * length(velocity))) * dot(velocity, surface_normal) * surface_normal;
+
+  position = contact_point + 0.000001f * velocity;
+}
+
+// Same response as for the box, but with the contact point and normal taken from the obstacle's distance field.
+// The particles are kept a radius away from the surface, like the box's margin does for the walls.
+void CpuWaterSimulation::obstacle_collision(float3& position, float3& velocity, float dt) const {
+  float3 gradient;
+  float distance = m_obstacle->distance(position, gradient);
+
+  // Early Exit (no collision possible)
+  float penetration_depth = m_parameters.particle_radius - distance;
+  if (penetration_depth <= 0.0f || dot(gradient, gradient) == 0.0f) {
+    return;
+  }
+
+  float3 surface_normal = normalize(gradient);
+  float3 contact_point = position + penetration_depth * surface_normal;
+
+  float speed = length(velocity);
+  float approach = dot(velocity, surface_normal);
+  if (approach < 0.0f && speed > 0.0f) {
+    velocity = velocity - (1.0f + m_parameters.restitution * penetration_depth / (dt * speed)) * approach * surface_normal;
+  }
+
+  position = contact_point;
+}
+
+// Time integrates each awake particle (Euler-Cromer, eq 4.2) and handles boundary collisions.
+// Also measures the largest speed and acceleration for the next adaptive time step, and which particles are at rest.
+void CpuWaterSimulation::update_particles(float dt) {
+  std::mutex mutex;
+  float max_speed2 = 0.0f;
+  float max_acceleration2 = 0.0f;
+
+  const float sleep_distance2 = m_parameters.sleep_distance * m_parameters.sleep_distance;
+  const float wake_speed2 = m_parameters.wake_speed * m_parameters.wake_speed;
+
+  m_pool.parallel_for(m_awake_particles.size(), [&](size_t begin, size_t end) {
+    float local_max_speed2 = 0.0f;
+    float local_max_acceleration2 = 0.0f;
+
+    for (size_t n = begin; n < end; n++) {
+      unsigned int i = m_awake_particles[n];
+      float3 position = m_particles.position(i);
+      float3 velocity = m_particles.velocity(i);
+
+      float3 acceleration = m_particles.force(i) / m_particles.density[i];
+      velocity += dt * acceleration;
+
+      if (m_parameters.continuous_collisions) {
+        swept_collision(position, position, velocity, dt);
+      } else {
+        position += dt * velocity;
+        collision_detection(position, velocity, dt);
+      }
+
+      m_particles.set_position(i, position);
+      m_particles.set_velocity(i, velocity);
+
+      float speed2 = dot(velocity, velocity);
+      float acceleration2 = dot(acceleration, acceleration);
+      local_max_speed2 = std::max(local_max_speed2, speed2);
+      local_max_acceleration2 = std::max(local_max_acceleration2, acceleration2);
+
+      // Particles resting on a boundary keep bouncing off of it, so rest is judged by how far a particle
+      // strays rather than by its speed.
+      float3 drift = position - m_rest_positions[i];
+      if (dot(drift, drift) < sleep_distance2) {
+        m_still_steps[i] = std::min(255, m_still_steps[i] + 1);
+      } else {
+        m_rest_positions[i] = position;
+        m_still_steps[i] = 0;
+      }
+      m_moving[i] = speed2 > wake_speed2;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    max_speed2 = std::max(max_speed2, local_max_speed2);
+    max_acceleration2 = std::max(max_acceleration2, local_max_acceleration2);
+  });
+
+  m_max_speed = sqrtf(max_speed2);
+  m_max_acceleration = sqrtf(max_acceleration2);
+  m_motion_valid = true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+
+// The gaps between the particles (see `ParticlePool`) are kept asleep and still, so that no pass visits them.
+void CpuWaterSimulation::wake_all_particles() {
+  const size_t count = m_particles.size();
+  m_asleep.assign(count, 0);
+  m_moving.assign(count, 1);
+  m_still_steps.assign(count, 0);
+
+  m_rest_positions.resize(count);
+  for (size_t i = 0; i < count; i++) {
+    m_rest_positions[i] = m_particles.position(i);
+    if (!m_particle_pool.alive(i)) {
+      m_asleep[i] = 1;
+      m_moving[i] = 0;
+    }
+  }
+
+  update_awake_particles();
+}
+
+void CpuWaterSimulation::update_awake_particles() {
+  m_awake_particles.clear();
+  for (size_t i = 0; i < m_particles.size(); i++) {
+    if (!m_asleep[i]) {
+      m_awake_particles.push_back(i);
+    }
+  }
+}
+
+// Puts particles that have been at rest for long enough to sleep, and wakes the sleeping particles next to a
+// moving one. Activity spreads through the cached neighbor lists, so a disturbance wakes the water around
+// it one support radius per step. Sleeping particles do not move, so they never cause a neighbor list rebuild.
+void CpuWaterSimulation::update_sleeping() {
+  if (!m_parameters.sleeping) {
+    if (m_awake_particles.size() != m_particle_pool.live_count()) {
+      wake_all_particles();
+    }
+    return;
+  }
+
+  // Each particle only writes its own state, and only reads whether its neighbors moved.
+  const unsigned int sleep_steps = std::max(1u, std::min(255u, m_parameters.sleep_steps));
+  m_pool.parallel_for(m_particles.size(), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      if (!m_asleep[i] && m_still_steps[i] < sleep_steps) {
+        continue;
+      }
+
+      bool moving_neighbor = false;
+      for (unsigned int j : m_neighbors.neighbors(i)) {
+        if (m_moving[j]) {
+          moving_neighbor = true;
+          break;
+        }
+      }
+
+      if (m_asleep[i] && moving_neighbor) {
+        m_asleep[i] = 0;
+        m_still_steps[i] = 0;
+      } else if (!m_asleep[i] && !moving_neighbor) {
+        m_asleep[i] = 1;
+        m_particles.set_velocity(i, make_float3(0.0f));
+        if (i < m_predicted_x.size()) {
+          m_predicted_x[i] = m_particles.x[i];
+          m_predicted_y[i] = m_particles.y[i];
+          m_predicted_z[i] = m_particles.z[i];
+        }
+      }
+    }
+  });
+
+  // A particle that bounced on a wall can fall asleep while it still counts as moving, and would then keep its
+  // neighbors awake forever. It is cleared afterwards, as the loop above reads the flags of the neighbors.
+  m_pool.parallel_for(m_particles.size(), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      if (m_asleep[i]) {
+        m_moving[i] = 0;
+      }
+    }
+  });
+
+  update_awake_particles();
+}
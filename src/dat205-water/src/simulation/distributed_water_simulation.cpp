@@ -0,0 +1,643 @@
+#include "simulation/distributed_water_simulation.hpp"
+#include "simulation/cpu_water_simulation.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <new>
+#include <thread>
+#include <utility>
+
+#if defined(__linux__)
+#include <errno.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+using namespace optix;
+
+// Slab decomposition over worker processes (see distributed_water_simulation.hpp).
+//
+// The shared memory is mapped before the workers are forked, so it is at the same address in every process.
+// It holds a `DistributedSharedState`, a `WorkerSlot` per worker, two particle arrays and a list per worker:
+// the workers read the current particles from one array and write the stepped ones to the other, so no worker
+// ever sees a particle of the next step. Each command is a post of every worker's `start` semaphore, and one
+// post of `done` per worker.
+//
+// Between exchanges, a worker owns and holds the same particles, and only reads its ghosts from the shared
+// arrays. Before an exchange, each worker publishes its owned particles in its list, sorted by x. The other
+// workers then find the particles of their slab and halo in every list by binary search, so none of them reads
+// more than it simulates. The halo is widened by the neighbor skin, which covers the particles that come
+// within reach before the next exchange: an exchange is due once a particle may have moved half the skin,
+// like a neighbor list rebuild.
+
+enum class WorkerCommand {
+  STEP,
+  PUBLISH, // Write the owned particles into the worker's list.
+  EXIT,
+};
+
+// A particle in a worker's list.
+struct SlabEntry {
+  float x; // [m] NaN is listed as FLT_MAX (and owned by the last slab), which keeps the list sortable.
+  unsigned int particle;
+};
+
+static bool operator<(SlabEntry const& a, SlabEntry const& b) {
+  return a.x < b.x;
+}
+
+static bool operator<(SlabEntry const& entry, float x) {
+  return entry.x < x;
+}
+
+struct WorkerSlot {
+#if defined(__linux__)
+  sem_t start;
+#endif
+
+  // Owns the particles with slab_min <= x < slab_max (the last worker also owns everything past it).
+  float slab_min; // [m]
+  float slab_max; // [m]
+
+  unsigned int published; // Entries in the worker's list.
+
+  // Results of the last step.
+  unsigned int owned;
+  unsigned int ghosts;
+  float max_speed;        // [m / s] Of the owned particles.
+  float max_acceleration; // [m / s^2]
+  float max_displacement; // [m] Of the owned particles since the last exchange.
+  SolverProfile profile;
+};
+
+struct DistributedSharedState {
+#if defined(__linux__)
+  sem_t done;
+#endif
+
+  unsigned int process_count;
+  size_t capacity;
+
+  WorkerCommand command;
+  bool exchange; // Whether the workers exchange particles before the step.
+  float dt;
+  size_t particle_count;
+  unsigned int current; // The particle array that holds the particles, the other one receives the next step.
+
+  // Workers pick up the parameters whenever the version changes.
+  unsigned int parameters_version;
+  WaterSimulationParameters parameters;
+};
+
+static WorkerSlot* worker_slots(DistributedSharedState* shared) {
+  return reinterpret_cast<WorkerSlot*>(shared + 1);
+}
+
+static Particle* particle_array(DistributedSharedState* shared, unsigned int array) {
+  Particle* arrays = reinterpret_cast<Particle*>(worker_slots(shared) + shared->process_count);
+  return arrays + array * shared->capacity;
+}
+
+static SlabEntry* slab_list(DistributedSharedState* shared, unsigned int w) {
+  SlabEntry* lists = reinterpret_cast<SlabEntry*>(particle_array(shared, 2));
+  return lists + w * shared->capacity;
+}
+
+// Lists are as long as the particle arrays, as a worker may own every particle.
+static size_t shared_size(unsigned int process_count, size_t capacity) {
+  return sizeof(DistributedSharedState) + process_count * sizeof(WorkerSlot) + 2 * capacity * sizeof(Particle) +
+         process_count * capacity * sizeof(SlabEntry);
+}
+
+static float listed_x(float x) {
+  return std::isnan(x) ? FLT_MAX : x;
+}
+
+DistributedWaterSimulation::DistributedWaterSimulation(unsigned int process_count, unsigned int thread_count)
+  : m_process_count(std::max(1u, process_count)),
+    m_thread_count(thread_count),
+    m_shared(nullptr),
+    m_shared_size(0),
+    m_capacity(0),
+    m_failed(false),
+    m_balanced(false),
+    m_exchange(true),
+    m_published(false),
+    m_motion_valid(false),
+    m_max_speed(0.0f),
+    m_max_acceleration(0.0f) {}
+
+DistributedWaterSimulation::~DistributedWaterSimulation() {
+  stop_workers();
+}
+
+void DistributedWaterSimulation::set_parameters(WaterSimulationParameters const& parameters) {
+  WaterSimulation::set_parameters(parameters);
+
+  // The halo depends on the support radius and the skin.
+  if (m_shared) {
+    m_shared->parameters = parameters;
+    m_shared->parameters_version++;
+    m_exchange = true;
+  }
+}
+
+void DistributedWaterSimulation::set_particles(std::vector<Particle> const& particles) {
+  m_motion_valid = false;
+  m_balanced = false;
+
+  if (!m_shared || m_failed || particles.size() > m_capacity) {
+    stop_workers();
+    m_failed = !start_workers(std::max<size_t>(1, particles.size()));
+    if (m_failed) {
+      return;
+    }
+  }
+
+  std::copy(particles.begin(), particles.end(), particle_array(m_shared, m_shared->current));
+  m_shared->particle_count = particles.size();
+  publish_particles();
+}
+
+void DistributedWaterSimulation::get_particles(std::vector<Particle>& particles) {
+  if (!m_shared) {
+    particles.clear();
+    return;
+  }
+
+  Particle const* current = particle_array(m_shared, m_shared->current);
+  particles.assign(current, current + m_shared->particle_count);
+}
+
+void DistributedWaterSimulation::set_obstacle(std::shared_ptr<SignedDistanceField const> obstacle) {
+  m_obstacle = obstacle;
+
+  if (m_shared) {
+    std::vector<Particle> particles;
+    get_particles(particles);
+    stop_workers();
+    set_particles(particles);
+  }
+}
+
+size_t DistributedWaterSimulation::particle_count() const {
+  return m_shared ? m_shared->particle_count : 0;
+}
+
+unsigned int DistributedWaterSimulation::process_count() const {
+  return m_process_count;
+}
+
+bool DistributedWaterSimulation::has_failed() const {
+  return m_failed;
+}
+
+void DistributedWaterSimulation::get_slab_counts(std::vector<unsigned int>& owned, std::vector<unsigned int>& ghosts) const {
+  owned.assign(m_process_count, 0);
+  ghosts.assign(m_process_count, 0);
+  for (unsigned int w = 0; m_shared && w < m_process_count; w++) {
+    owned[w] = worker_slots(m_shared)[w].owned;
+    ghosts[w] = worker_slots(m_shared)[w].ghosts;
+  }
+}
+
+void DistributedWaterSimulation::measure_motion(float& max_speed, float& max_acceleration) {
+  if (!m_motion_valid) {
+    WaterSimulation::measure_motion(m_max_speed, m_max_acceleration);
+    m_motion_valid = true;
+  }
+  max_speed = m_max_speed;
+  max_acceleration = m_max_acceleration;
+}
+
+// Hands every particle to the first worker, as if it had published them. The next exchange spreads them out.
+void DistributedWaterSimulation::publish_particles() {
+  const size_t count = m_shared->particle_count;
+  Particle const* current = particle_array(m_shared, m_shared->current);
+  WorkerSlot* slots = worker_slots(m_shared);
+
+  SlabEntry* list = slab_list(m_shared, 0);
+  for (size_t i = 0; i < count; i++) {
+    list[i].x = listed_x(current[i].position.x);
+    list[i].particle = i;
+  }
+  std::sort(list, list + count);
+
+  for (unsigned int w = 0; w < m_process_count; w++) {
+    slots[w].published = w == 0 ? count : 0;
+    slots[w].max_displacement = 0.0f;
+  }
+  m_exchange = true;
+  m_published = true;
+}
+
+// Places the slab boundaries at the quantiles of the particles' x coordinates.
+void DistributedWaterSimulation::balance_slabs() {
+  const size_t count = m_shared->particle_count;
+  Particle const* current = particle_array(m_shared, m_shared->current);
+
+  std::vector<float> xs(count);
+  for (size_t i = 0; i < count; i++) {
+    xs[i] = listed_x(current[i].position.x);
+  }
+
+  WorkerSlot* slots = worker_slots(m_shared);
+  float boundary = -FLT_MAX;
+  size_t first = 0;
+  for (unsigned int w = 0; w < m_process_count; w++) {
+    slots[w].slab_min = boundary;
+
+    size_t last = count * (w + 1) / m_process_count;
+    if (w + 1 < m_process_count && last < count) {
+      std::nth_element(xs.begin() + first, xs.begin() + last, xs.end());
+      boundary = xs[last];
+      first = last;
+    } else {
+      boundary = FLT_MAX;
+    }
+    slots[w].slab_max = boundary;
+  }
+  m_balanced = true;
+}
+
+void DistributedWaterSimulation::step(float dt) {
+  if (!m_shared || m_failed) {
+    return;
+  }
+
+  // Rebalance once a slab holds 10% more particles than its share, and exchange the particles once one may have
+  // moved half the skin. Both move particles to other workers.
+  WorkerSlot* slots = worker_slots(m_shared);
+  unsigned int max_owned = 0;
+  float max_displacement = 0.0f;
+  for (unsigned int w = 0; w < m_process_count; w++) {
+    max_owned = std::max(max_owned, slots[w].owned);
+    max_displacement = std::max(max_displacement, slots[w].max_displacement);
+  }
+  if (!m_balanced || max_owned > 1.1 * m_shared->particle_count / m_process_count) {
+    balance_slabs();
+    m_exchange = true;
+  }
+  if (2.0f * max_displacement >= m_parameters.neighbor_skin) {
+    m_exchange = true;
+  }
+
+  if (m_exchange && !m_published && !run_workers(WorkerCommand::PUBLISH)) {
+    m_failed = true;
+    return;
+  }
+  m_shared->exchange = m_exchange;
+  m_shared->dt = dt;
+  if (!run_workers(WorkerCommand::STEP)) {
+    m_failed = true;
+    return;
+  }
+  m_shared->current = 1 - m_shared->current;
+  m_exchange = false;
+  m_published = false;
+
+  // The workers run side by side, so each pass takes as long as its slowest worker. Particle and neighbor
+  // counts include the ghosts, which are simulated like every other particle.
+  m_motion_valid = true;
+  m_max_speed = 0.0f;
+  m_max_acceleration = 0.0f;
+  size_t memory_usage = m_shared_size;
+  HashTableStatistics hash_table;
+  bool neighbor_rebuild = false;
+  for (unsigned int w = 0; w < m_process_count; w++) {
+    SolverProfile const& profile = slots[w].profile;
+    neighbor_rebuild = neighbor_rebuild || profile.neighbor_rebuilds > 0;
+    for (unsigned int pass = 0; pass < SOLVER_PASS_COUNT; pass++) {
+      m_profile.pass_particles[pass] += profile.pass_particles[pass];
+    }
+    m_profile.neighbor_entries += profile.neighbor_entries;
+    m_profile.max_neighbors = std::max(m_profile.max_neighbors, profile.max_neighbors);
+    m_profile.grid_migrations += profile.grid_migrations;
+    m_profile.particle_reorders += profile.particle_reorders;
+    memory_usage += profile.memory_usage;
+    hash_table.buckets += profile.hash_table.buckets;
+    hash_table.occupied_buckets += profile.hash_table.occupied_buckets;
+    hash_table.occupied_cells += profile.hash_table.occupied_cells;
+
+    m_max_speed = std::max(m_max_speed, slots[w].max_speed);
+    m_max_acceleration = std::max(m_max_acceleration, slots[w].max_acceleration);
+  }
+  for (unsigned int pass = 0; pass < SOLVER_PASS_COUNT; pass++) {
+    double seconds = 0.0;
+    for (unsigned int w = 0; w < m_process_count; w++) {
+      seconds = std::max(seconds, slots[w].profile.pass_seconds[pass]);
+    }
+    m_profile.pass_seconds[pass] += seconds;
+  }
+
+  m_profile.steps++;
+  m_profile.particle_steps += m_shared->particle_count;
+  m_profile.neighbor_rebuilds += neighbor_rebuild;
+  m_profile.memory_usage = memory_usage;
+  m_profile.hash_table = hash_table;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+
+#if defined(__linux__)
+
+// The particles of a worker between exchanges.
+struct WorkerParticles {
+  std::vector<unsigned int> indices; // Index of each local particle in the shared arrays, in increasing order.
+  std::vector<uint8_t> owned;        // Whether each local particle is owned or a ghost.
+  std::vector<float3> exchanged;     // Where each local particle was at the last exchange.
+  std::vector<Particle> stepped;     // The local particles after the last step.
+  size_t owned_count;
+};
+
+// Lists the owned particles, sorted by x. They were written to the shared arrays as they are in `stepped`.
+static void publish_owned_particles(DistributedSharedState* shared, unsigned int w, WorkerParticles const& local) {
+  SlabEntry* list = slab_list(shared, w);
+  unsigned int count = 0;
+  for (size_t k = 0; k < local.indices.size(); k++) {
+    if (local.owned[k]) {
+      list[count].x = listed_x(local.stepped[k].position.x);
+      list[count].particle = local.indices[k];
+      count++;
+    }
+  }
+  std::sort(list, list + count);
+  worker_slots(shared)[w].published = count;
+}
+
+// Finds the particles within `reach` of the worker's slab in every list, takes the ones in the slab, and hands
+// them all to `simulation`. NaN positions are listed as FLT_MAX, so every particle has exactly one owner.
+// The owned particles and the ghosts stay in the order of the shared arrays, which deterministic sums run in.
+static void exchange_particles(DistributedSharedState* shared,
+                               unsigned int w,
+                               float reach,
+                               CpuWaterSimulation& simulation,
+                               WorkerParticles& local) {
+  WorkerSlot const* slots = worker_slots(shared);
+  WorkerSlot const& slot = slots[w];
+  const bool first_slab = w == 0;
+  const bool last_slab = w + 1 == shared->process_count;
+
+  std::vector<std::pair<unsigned int, uint8_t>> found;
+  for (unsigned int v = 0; v < shared->process_count; v++) {
+    SlabEntry const* list = slab_list(shared, v);
+    SlabEntry const* first = first_slab ? list : std::lower_bound(list, list + slots[v].published, slot.slab_min - reach);
+    SlabEntry const* last = last_slab ? list + slots[v].published
+                                      : std::lower_bound(first, list + slots[v].published, slot.slab_max + reach);
+    for (SlabEntry const* entry = first; entry != last; entry++) {
+      bool owner = (first_slab || !(entry->x < slot.slab_min)) && (last_slab || entry->x < slot.slab_max);
+      found.push_back(std::make_pair(entry->particle, (uint8_t) owner));
+    }
+  }
+  std::sort(found.begin(), found.end());
+
+  local.indices.resize(found.size());
+  local.owned.resize(found.size());
+  local.exchanged.resize(found.size());
+  local.owned_count = 0;
+  Particle const* current = particle_array(shared, shared->current);
+  for (size_t k = 0; k < found.size(); k++) {
+    local.indices[k] = found[k].first;
+    local.owned[k] = found[k].second;
+    local.exchanged[k] = current[found[k].first].position;
+    local.owned_count += found[k].second;
+  }
+
+  simulation.exchange_particles(local.indices, current);
+}
+
+// The loop of a worker process, until it is told to exit.
+static void run_worker(DistributedSharedState* shared,
+                       unsigned int w,
+                       unsigned int thread_count,
+                       std::shared_ptr<SignedDistanceField const> obstacle) {
+  WorkerSlot& slot = worker_slots(shared)[w];
+
+  CpuWaterSimulation simulation(thread_count);
+  simulation.set_obstacle(obstacle);
+  unsigned int parameters_version = 0;
+
+  WorkerParticles local;
+  local.owned_count = 0;
+
+  while (true) {
+    while (sem_wait(&slot.start) != 0 && errno == EINTR) {}
+    if (shared->command == WorkerCommand::EXIT) {
+      return;
+    }
+    if (shared->command == WorkerCommand::PUBLISH) {
+      publish_owned_particles(shared, w, local);
+      sem_post(&shared->done);
+      continue;
+    }
+
+    if (parameters_version != shared->parameters_version) {
+      WaterSimulationParameters parameters = shared->parameters;
+      parameters.sleeping = false;
+      simulation.set_parameters(parameters);
+      parameters_version = shared->parameters_version;
+    }
+
+    // Ghosts within two support radii of the slab have all their neighbors. Until the next exchange, no particle
+    // moves more than half the skin, so any particle that gets that close was within another skin of it.
+    Particle const* current = particle_array(shared, shared->current);
+    Particle* next = particle_array(shared, 1 - shared->current);
+    if (shared->exchange) {
+      const float reach = 2.0f * shared->parameters.support_radius + shared->parameters.neighbor_skin;
+      exchange_particles(shared, w, reach, simulation, local);
+    } else {
+      for (size_t k = 0; k < local.indices.size(); k++) {
+        if (!local.owned[k]) {
+          simulation.set_particle(k, current[local.indices[k]]);
+        }
+      }
+    }
+
+    simulation.reset_profile();
+    simulation.step(shared->dt);
+    simulation.get_particles(local.stepped);
+
+    float max_speed2 = 0.0f;
+    float max_acceleration2 = 0.0f;
+    float max_displacement2 = 0.0f;
+    for (size_t k = 0; k < local.indices.size(); k++) {
+      if (!local.owned[k]) {
+        continue;
+      }
+
+      Particle const& p = local.stepped[k];
+      next[local.indices[k]] = p;
+
+      max_speed2 = std::max(max_speed2, dot(p.velocity, p.velocity));
+      if (p.density > 0.0f) {
+        float3 acceleration = p.force / p.density;
+        max_acceleration2 = std::max(max_acceleration2, dot(acceleration, acceleration));
+      }
+      float3 displacement = p.position - local.exchanged[k];
+      max_displacement2 = std::max(max_displacement2, dot(displacement, displacement));
+    }
+
+    slot.owned = local.owned_count;
+    slot.ghosts = local.indices.size() - local.owned_count;
+    slot.max_speed = sqrtf(max_speed2);
+    slot.max_acceleration = sqrtf(max_acceleration2);
+    slot.max_displacement = sqrtf(max_displacement2);
+    slot.profile = simulation.profile();
+    sem_post(&shared->done);
+  }
+}
+
+bool DistributedWaterSimulation::start_workers(size_t capacity) {
+  m_shared_size = shared_size(m_process_count, capacity);
+  void* memory = mmap(nullptr, m_shared_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    m_shared_size = 0;
+    return false;
+  }
+
+  m_shared = new (memory) DistributedSharedState();
+  m_shared->process_count = m_process_count;
+  m_shared->capacity = capacity;
+  m_shared->command = WorkerCommand::STEP;
+  m_shared->exchange = true;
+  m_shared->dt = 0.0f;
+  m_shared->particle_count = 0;
+  m_shared->current = 0;
+  m_shared->parameters_version = 1;
+  m_shared->parameters = m_parameters;
+  sem_init(&m_shared->done, 1, 0);
+
+  WorkerSlot* slots = worker_slots(m_shared);
+  for (unsigned int w = 0; w < m_process_count; w++) {
+    new (&slots[w]) WorkerSlot();
+    sem_init(&slots[w].start, 1, 0);
+    slots[w].slab_min = -FLT_MAX;
+    slots[w].slab_max = FLT_MAX;
+    slots[w].published = 0;
+    slots[w].owned = 0;
+    slots[w].ghosts = 0;
+    slots[w].max_speed = 0.0f;
+    slots[w].max_acceleration = 0.0f;
+    slots[w].max_displacement = 0.0f;
+  }
+  m_capacity = capacity;
+
+  unsigned int threads = m_thread_count;
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency() / m_process_count);
+  }
+
+  const pid_t parent = getpid();
+  for (unsigned int w = 0; w < m_process_count; w++) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      // Workers must not outlive the simulation, even if it is killed.
+      prctl(PR_SET_PDEATHSIG, SIGKILL);
+      if (getppid() == parent) {
+        run_worker(m_shared, w, threads, m_obstacle);
+      }
+      _exit(EXIT_SUCCESS);
+    }
+
+    if (pid < 0) {
+      m_failed = true;
+      stop_workers();
+      return false;
+    }
+    m_workers.push_back(pid);
+  }
+  return true;
+}
+
+void DistributedWaterSimulation::stop_workers() {
+  if (!m_shared) {
+    return;
+  }
+
+  // Workers that stopped responding may be stuck in a step, and would never see the command.
+  if (m_failed) {
+    for (pid_t pid : m_workers) {
+      kill(pid, SIGKILL);
+    }
+  } else {
+    m_shared->command = WorkerCommand::EXIT;
+    for (unsigned int w = 0; w < m_workers.size(); w++) {
+      sem_post(&worker_slots(m_shared)[w].start);
+    }
+  }
+
+  for (pid_t pid : m_workers) {
+    while (waitpid(pid, nullptr, 0) < 0 && errno == EINTR) {}
+  }
+  m_workers.clear();
+
+  WorkerSlot* slots = worker_slots(m_shared);
+  for (unsigned int w = 0; w < m_process_count; w++) {
+    sem_destroy(&slots[w].start);
+    slots[w].~WorkerSlot();
+  }
+  sem_destroy(&m_shared->done);
+  m_shared->~DistributedSharedState();
+
+  munmap(m_shared, m_shared_size);
+  m_shared = nullptr;
+  m_shared_size = 0;
+  m_capacity = 0;
+}
+
+bool DistributedWaterSimulation::run_workers(WorkerCommand command) {
+  m_shared->command = command;
+  for (unsigned int w = 0; w < m_process_count; w++) {
+    sem_post(&worker_slots(m_shared)[w].start);
+  }
+  return wait_for_workers();
+}
+
+// Waits for every worker to finish its command, but gives up as soon as one has exited.
+bool DistributedWaterSimulation::wait_for_workers() {
+  unsigned int finished = 0;
+  while (finished < m_workers.size()) {
+    timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += 1;
+
+    if (sem_timedwait(&m_shared->done, &deadline) == 0) {
+      finished++;
+    } else if (errno == ETIMEDOUT) {
+      for (pid_t pid : m_workers) {
+        if (waitpid(pid, nullptr, WNOHANG) != 0) {
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+#else
+
+bool DistributedWaterSimulation::start_workers(size_t capacity) {
+  (void) capacity;
+  return false;
+}
+
+void DistributedWaterSimulation::stop_workers() {}
+
+bool DistributedWaterSimulation::run_workers(WorkerCommand command) {
+  (void) command;
+  return false;
+}
+
+bool DistributedWaterSimulation::wait_for_workers() {
+  return false;
+}
+
+#endif
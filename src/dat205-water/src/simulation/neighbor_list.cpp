@@ -0,0 +1,150 @@
+#include "simulation/neighbor_list.hpp"
+
+#include <algorithm>
+#include <mutex>
+
+using namespace optix;
+
+NeighborList::NeighborList()
+  : m_skin(0.0f),
+    m_max_neighbor_count(0),
+    m_offsets(1, 0) {}
+
+void NeighborList::build(ParticleArrays const& particles, UniformGrid const& grid, float radius, float skin, ThreadPool& pool,
+                         uint8_t const* alive, unsigned int const* order) {
+  const float radius2 = radius * radius;
+  m_skin = skin;
+
+  m_reference_positions.resize(particles.size());
+  m_offsets.resize(particles.size() + 1);
+
+  // Count the neighbors of each particle.
+  pool.parallel_for(particles.size(), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      float3 position = particles.position(i);
+      unsigned int count = 0;
+
+      m_reference_positions[i] = position;
+      if (alive && !alive[i]) {
+        m_offsets[i + 1] = 0;
+        continue;
+      }
+
+      grid.for_each_candidate(position, [&](unsigned int j) {
+        float3 d = position - particles.position(j);
+        if (j != i && dot(d, d) < radius2) {
+          count++;
+        }
+      });
+
+      m_offsets[i + 1] = count;
+    }
+  });
+
+  // Prefix sum into row offsets.
+  m_offsets[0] = 0;
+  m_max_neighbor_count = 0;
+  for (size_t i = 0; i < particles.size(); i++) {
+    m_max_neighbor_count = std::max(m_max_neighbor_count, m_offsets[i + 1]);
+    m_offsets[i + 1] += m_offsets[i];
+  }
+  m_indices.resize(m_offsets.back());
+
+  // Fill in the neighbors (in the same order as they were counted).
+  pool.parallel_for(particles.size(), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      if (alive && !alive[i]) {
+        continue;
+      }
+
+      float3 position = particles.position(i);
+      unsigned int* out = m_indices.data() + m_offsets[i];
+
+      grid.for_each_candidate(position, [&](unsigned int j) {
+        float3 d = position - particles.position(j);
+        if (j != i && dot(d, d) < radius2) {
+          *out++ = j;
+        }
+      });
+
+      if (order) {
+        std::sort(m_indices.begin() + m_offsets[i], m_indices.begin() + m_offsets[i + 1],
+                  [&](unsigned int a, unsigned int b) { return order[a] < order[b]; });
+      }
+    }
+  });
+}
+
+void NeighborList::clear() {
+  m_offsets.assign(1, 0);
+  m_indices.clear();
+  m_max_neighbor_count = 0;
+  m_reference_positions.clear();
+}
+
+bool NeighborList::needs_rebuild(ParticleArrays const& particles, ThreadPool& pool, uint8_t const* alive) const {
+  if (particles.size() != m_reference_positions.size()) {
+    return true;
+  }
+
+  // Two particles approaching each other can together close at most twice the largest displacement.
+  std::mutex mutex;
+  float max_displacement2 = 0.0f;
+
+  pool.parallel_for(particles.size(), [&](size_t begin, size_t end) {
+    float local_max = 0.0f;
+    for (size_t i = begin; i < end; i++) {
+      if (alive && !alive[i]) {
+        continue;
+      }
+
+      float3 d = particles.position(i) - m_reference_positions[i];
+      local_max = std::max(local_max, dot(d, d));
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    max_displacement2 = std::max(max_displacement2, local_max);
+  });
+
+  return 2.0f * sqrtf(max_displacement2) >= m_skin;
+}
+
+void NeighborList::save(StateSectionWriter& writer) const {
+  writer.write(m_skin);
+  writer.write_vector(m_offsets);
+  writer.write_vector(m_indices);
+  writer.write_vector(m_reference_positions);
+}
+
+bool NeighborList::restore(StateSectionReader& reader) {
+  bool ok = reader.read(m_skin) &&
+            reader.read_vector(m_offsets) &&
+            reader.read_vector(m_indices) &&
+            reader.read_vector(m_reference_positions);
+
+  // A list that does not match its own offsets must never be used.
+  if (!ok || m_offsets.size() != m_reference_positions.size() + 1 || m_offsets.back() != m_indices.size()) {
+    clear();
+    return false;
+  }
+
+  m_max_neighbor_count = 0;
+  for (size_t i = 0; i + 1 < m_offsets.size(); i++) {
+    m_max_neighbor_count = std::max(m_max_neighbor_count, m_offsets[i + 1] - m_offsets[i]);
+  }
+  return true;
+}
+
+size_t NeighborList::pair_count() const {
+  return m_indices.size();
+}
+
+unsigned int NeighborList::max_neighbor_count() const {
+  return m_max_neighbor_count;
+}
+
+size_t NeighborList::memory_usage() const {
+  return m_offsets.capacity() * sizeof(unsigned int)
+       + m_indices.capacity() * sizeof(unsigned int)
+       + m_reference_positions.capacity() * sizeof(float3);
+}
@@ -0,0 +1,202 @@
+#include "simulation/optix_water_simulation.hpp"
+#include "simulation/sph_kernels.hpp"
+#include "simulation/uniform_grid.hpp"
+#include "util/optix.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace optix;
+
+OptixWaterSimulation::OptixWaterSimulation(Context& ctx, Buffer particles_buffer)
+  : m_ctx(ctx),
+    m_particles_buffer(particles_buffer),
+    m_particles_count(0) {
+
+  // Setup CUDA functions (we'll use OptiX for convenience).
+  m_ctx->setRayGenerationProgram(1, m_ctx->createProgramFromPTXFile(ptxPath("water_simulation.cu"), "reset_nearest_neighbors"));
+  m_ctx->setRayGenerationProgram(2, m_ctx->createProgramFromPTXFile(ptxPath("water_simulation.cu"), "update_nearest_neighbors"));
+  m_ctx->setRayGenerationProgram(3, m_ctx->createProgramFromPTXFile(ptxPath("water_simulation.cu"), "update_particles_data"));
+  m_ctx->setRayGenerationProgram(4, m_ctx->createProgramFromPTXFile(ptxPath("water_simulation.cu"), "update_force"));
+  m_ctx->setRayGenerationProgram(5, m_ctx->createProgramFromPTXFile(ptxPath("water_simulation.cu"), "update_particles"));
+  m_ctx->setRayGenerationProgram(6, m_ctx->createProgramFromPTXFile(ptxPath("water_simulation.cu"), "sort_nearest_neighbors"));
+
+  // Create hash table buffer. It is sized once the particles and the box are known (see `update_hash_table`).
+  m_hash_buffer = m_ctx->createBuffer(RT_BUFFER_INPUT);
+  m_hash_buffer->setFormat(RT_FORMAT_USER);
+  m_hash_buffer->setElementSize(sizeof(HashCell));
+  m_hash_buffer->setSize(1);
+  memset(m_hash_buffer->map(), 0, sizeof(HashCell));
+  m_hash_buffer->unmap();
+
+  m_ctx["hash_grid_origin"]->setInt(0, 0, 0);
+  m_ctx["hash_grid_dimensions"]->setUint(0, 0, 0);
+
+  m_counters_buffer = m_ctx->createBuffer(RT_BUFFER_INPUT_OUTPUT, RT_FORMAT_UNSIGNED_INT, 4);
+
+  m_ctx["particles_buffer"]->setBuffer(m_particles_buffer);
+  m_ctx["hash_table"]->setBuffer(m_hash_buffer);
+  m_ctx["solver_counters"]->setBuffer(m_counters_buffer);
+}
+
+void OptixWaterSimulation::set_parameters(WaterSimulationParameters const& parameters) {
+  WaterSimulation::set_parameters(parameters);
+
+  m_ctx["g"]->setFloat(parameters.g);
+
+  m_ctx["cell_size"]->setFloat(parameters.cell_size);
+  m_ctx["support_radius"]->setFloat(parameters.support_radius);
+  m_ctx["particle_radius"]->setFloat(parameters.particle_radius);
+
+  SphKernelConstants kernels = make_sph_kernel_constants(parameters.support_radius);
+  m_ctx["poly6_constant"]->setFloat(kernels.poly6);
+  m_ctx["poly6_gradient_constant"]->setFloat(kernels.poly6_gradient);
+  m_ctx["spiky_gradient_constant"]->setFloat(kernels.spiky_gradient);
+  m_ctx["viscosity_laplacian_constant"]->setFloat(kernels.viscosity_laplacian);
+
+  m_ctx["particle_mass"]->setFloat(parameters.particle_mass);
+  m_ctx["rest_density"]->setFloat(parameters.rest_density);
+  m_ctx["viscosity"]->setFloat(parameters.viscosity);
+  m_ctx["surface_tension"]->setFloat(parameters.surface_tension);
+  m_ctx["l_threshold"]->setFloat(parameters.l_threshold);
+  m_ctx["gass_stiffness"]->setFloat(parameters.gass_stiffness);
+  m_ctx["restitution"]->setFloat(parameters.restitution);
+  m_ctx["friction"]->setFloat(parameters.friction);
+  m_ctx["continuous_collisions"]->setInt(parameters.continuous_collisions ? 1 : 0);
+
+  m_ctx["y_min"]->setFloat(parameters.y_min);
+  m_ctx["x_min"]->setFloat(parameters.x_min);
+  m_ctx["x_max"]->setFloat(parameters.x_max);
+  m_ctx["z_min"]->setFloat(parameters.z_min);
+  m_ctx["z_max"]->setFloat(parameters.z_max);
+
+  update_hash_table(false);
+}
+
+void OptixWaterSimulation::set_particles(std::vector<Particle> const& particles) {
+  m_particles_count = particles.size();
+
+  m_particles_buffer->setSize(particles.size());
+  memcpy(m_particles_buffer->map(), particles.data(), sizeof(Particle) * particles.size());
+  m_particles_buffer->unmap();
+
+  // The particles may remember cells of another table.
+  update_hash_table(true);
+}
+
+void OptixWaterSimulation::get_particles(std::vector<Particle>& particles) {
+  particles.resize(m_particles_count);
+  memcpy(particles.data(), m_particles_buffer->map(), sizeof(Particle) * particles.size());
+  m_particles_buffer->unmap();
+}
+
+void OptixWaterSimulation::step(float dt) {
+  m_ctx["dt"]->setFloat(dt);
+  memset(m_counters_buffer->map(), 0, 4 * sizeof(unsigned int));
+  m_counters_buffer->unmap();
+
+  // Launches block until they are done, so they can be timed from the host.
+  {
+    ScopedPassTimer timer(m_profile, SolverPass::NEIGHBOR_SEARCH, m_particles_count);
+
+    // Reset the hash table to not contain any particles.
+    m_ctx->launch(1, m_particles_count);
+
+    // (Re)build the hash table.
+    m_ctx->launch(2, m_particles_count);
+
+    // Put the particles of every cell in a reproducible order.
+    if (m_parameters.deterministic) {
+      RTsize hash_cells;
+      m_hash_buffer->getSize(hash_cells);
+      m_ctx->launch(6, hash_cells);
+    }
+  }
+  {
+    ScopedPassTimer timer(m_profile, SolverPass::DENSITY, m_particles_count);
+
+    // Update particle data.
+    m_ctx->launch(3, m_particles_count);
+  }
+  {
+    ScopedPassTimer timer(m_profile, SolverPass::FORCE, m_particles_count);
+
+    // Update particle forces.
+    m_ctx->launch(4, m_particles_count);
+  }
+  {
+    ScopedPassTimer timer(m_profile, SolverPass::INTEGRATION, m_particles_count);
+
+    // Update simulation by one timestep.
+    m_ctx->launch(5, m_particles_count);
+  }
+
+  // The neighbors are the candidates of the 3x3x3 cell search, as the kernels skip the ones out of reach themselves.
+  unsigned int const* counters = static_cast<unsigned int const*>(m_counters_buffer->map(0, RT_BUFFER_MAP_READ));
+  m_profile.overflowed_cells += counters[0];
+  m_profile.neighbor_entries += counters[1];
+  m_profile.max_neighbors = std::max(m_profile.max_neighbors, counters[2]);
+  unsigned int occupied_buckets = counters[3];
+  m_counters_buffer->unmap();
+
+  m_profile.steps++;
+  m_profile.particle_steps += m_particles_count;
+  m_profile.neighbor_rebuilds++;
+
+  RTsize hash_cells;
+  m_hash_buffer->getSize(hash_cells);
+  m_profile.memory_usage = m_particles_count * sizeof(Particle) + hash_cells * sizeof(HashCell);
+
+  // Particles of different cells cannot be told apart in a hash cell, so there is no collision count.
+  m_profile.hash_table.buckets = hash_cells;
+  m_profile.hash_table.occupied_buckets = occupied_buckets;
+  m_profile.hash_table.occupied_cells = 0;
+}
+
+// The table gets about two hash cells per particle (eq 5.4). If the floor of the box is small enough for three
+// layers of its cells to fit in that, the cells of the box are laid out densely instead, so that only cells
+// at least three layers apart share a hash cell (see `hash` in water_simulation.cu).
+void OptixWaterSimulation::update_hash_table(bool clear) {
+  const unsigned int target = 2 * std::max(1u, m_particles_count);
+  const float cell_size = m_parameters.cell_size;
+
+  unsigned int size = next_prime(target);
+  int3 origin = make_int3(0);
+  uint3 dimensions = make_uint3(0u);
+
+  if (cell_size > 0.0f) {
+    // Positions are discretized the same way as in water_simulation.cu. The border of one cell around the
+    // walls holds the particles that are on their way back into the box.
+    int3 first = make_int3(int(m_parameters.x_min / cell_size) - 1, int(m_parameters.y_min / cell_size) - 1, int(m_parameters.z_min / cell_size) - 1);
+    int3 last = make_int3(int(m_parameters.x_max / cell_size) + 1, 0, int(m_parameters.z_max / cell_size) + 1);
+    unsigned int floor_cells = (last.x - first.x + 1) * (last.z - first.z + 1);
+
+    if (3 * floor_cells <= target) {
+      origin = first;
+      dimensions = make_uint3(last.x - first.x + 1, target / floor_cells, last.z - first.z + 1);
+      size = dimensions.x * dimensions.y * dimensions.z;
+    }
+  }
+
+  m_ctx["hash_grid_origin"]->setInt(origin.x, origin.y, origin.z);
+  m_ctx["hash_grid_dimensions"]->setUint(dimensions.x, dimensions.y, dimensions.z);
+
+  RTsize current_size;
+  m_hash_buffer->getSize(current_size);
+  if (current_size == size && !clear) {
+    return;
+  }
+
+  // The next step only empties the cells that the particles were put in, so every other cell has to start empty.
+  m_hash_buffer->setSize(size);
+  memset(m_hash_buffer->map(), 0, sizeof(HashCell) * size);
+  m_hash_buffer->unmap();
+
+  if (m_particles_count > 0) {
+    Particle* particles = static_cast<Particle*>(m_particles_buffer->map());
+    for (unsigned int i = 0; i < m_particles_count; i++) {
+      particles[i].prev_hash_cell_index = 0;
+    }
+    m_particles_buffer->unmap();
+  }
+}
@@ -0,0 +1,108 @@
+#include "simulation/particle_arrays.hpp"
+
+void ParticleArrays::resize(size_t count) {
+  x.resize(count);
+  y.resize(count);
+  z.resize(count);
+
+  vx.resize(count);
+  vy.resize(count);
+  vz.resize(count);
+
+  fx.resize(count);
+  fy.resize(count);
+  fz.resize(count);
+
+  density.resize(count);
+  pressure.resize(count);
+}
+
+void ParticleArrays::reserve(size_t count) {
+  x.reserve(count);
+  y.reserve(count);
+  z.reserve(count);
+
+  vx.reserve(count);
+  vy.reserve(count);
+  vz.reserve(count);
+
+  fx.reserve(count);
+  fy.reserve(count);
+  fz.reserve(count);
+
+  density.reserve(count);
+  pressure.reserve(count);
+}
+
+void ParticleArrays::move(size_t from, size_t to) {
+  set_position(to, position(from));
+  set_velocity(to, velocity(from));
+  set_force(to, force(from));
+  density[to] = density[from];
+  pressure[to] = pressure[from];
+}
+
+// Field by field, so that only two arrays are streamed through the cache at a time.
+void ParticleArrays::gather(ParticleArrays const& source, std::vector<unsigned int> const& order) {
+  std::vector<float> ParticleArrays::* fields[] = {
+    &ParticleArrays::x, &ParticleArrays::y, &ParticleArrays::z,
+    &ParticleArrays::vx, &ParticleArrays::vy, &ParticleArrays::vz,
+    &ParticleArrays::fx, &ParticleArrays::fy, &ParticleArrays::fz,
+    &ParticleArrays::density, &ParticleArrays::pressure,
+  };
+
+  for (auto field : fields) {
+    std::vector<float>& to = this->*field;
+    std::vector<float> const& from = source.*field;
+    to.resize(order.size());
+    for (size_t n = 0; n < order.size(); n++) {
+      to[n] = from[order[n]];
+    }
+  }
+}
+
+size_t ParticleArrays::memory_usage() const {
+  return 11 * x.capacity() * sizeof(float);
+}
+
+void ParticleArrays::from_particles(std::vector<Particle> const& particles) {
+  resize(particles.size());
+
+  for (size_t i = 0; i < particles.size(); i++) {
+    Particle const& p = particles[i];
+    set_position(i, p.position);
+    set_velocity(i, p.velocity);
+    set_force(i, p.force);
+    density[i] = p.density;
+    pressure[i] = p.pressure;
+  }
+}
+
+void ParticleArrays::to_particles(std::vector<Particle>& particles) const {
+  particles.resize(size());
+
+  for (size_t i = 0; i < particles.size(); i++) {
+    Particle& p = particles[i];
+    p.position = position(i);
+    p.velocity = velocity(i);
+    p.force = force(i);
+    p.density = density[i];
+    p.pressure = pressure[i];
+    p.prev_hash_cell_index = 0; // The CPU backend has no hash table.
+  }
+}
+
+void ParticleArrays::to_particles(std::vector<Particle>& particles, std::vector<unsigned int> const& order) const {
+  particles.resize(order.size());
+
+  for (size_t n = 0; n < order.size(); n++) {
+    unsigned int i = order[n];
+    Particle& p = particles[n];
+    p.position = position(i);
+    p.velocity = velocity(i);
+    p.force = force(i);
+    p.density = density[i];
+    p.pressure = pressure[i];
+    p.prev_hash_cell_index = 0;
+  }
+}
@@ -0,0 +1,406 @@
+#include "simulation/particle_bvh.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+using namespace optix;
+
+static float component(float3 v, unsigned int axis) {
+  return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+// Unlike `fminf` and `fmaxf`, these inline to a single instruction per component.
+static float3 min3(float3 a, float3 b) {
+  return make_float3(std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z));
+}
+
+static float3 max3(float3 a, float3 b) {
+  return make_float3(std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z));
+}
+
+// Half the surface area of a box, which is all that the ratios of the SAH need.
+static float half_area(float3 lower, float3 upper) {
+  float3 e = upper - lower;
+  return e.x * e.y + e.y * e.z + e.z * e.x;
+}
+
+// The part of [t_min, t_max] that the ray spends in the box, if any.
+static bool intersect_box(float3 lower, float3 upper, float3 origin, float3 inverse_direction, float t_min, float t_max, float& t_entry) {
+  float3 t0 = (lower - origin) * inverse_direction;
+  float3 t1 = (upper - origin) * inverse_direction;
+
+  // fmin and fmax drop the NaN of a ray that runs within one of the box's planes.
+  t_entry = std::fmax(t_min, std::fmax(std::fmin(t0.x, t1.x), std::fmax(std::fmin(t0.y, t1.y), std::fmin(t0.z, t1.z))));
+  float t_exit = std::fmin(t_max, std::fmin(std::fmax(t0.x, t1.x), std::fmin(std::fmax(t0.y, t1.y), std::fmax(t0.z, t1.z))));
+  return t_entry <= t_exit;
+}
+
+ParticleBvh::ParticleBvh(unsigned int thread_count)
+  : m_pool(thread_count),
+    m_rebuild_threshold(1.5f),
+    m_particle_radius(0.0f),
+    m_sah_cost(0.0f),
+    m_area_cost(0.0),
+    m_build_area_cost(0.0),
+    m_builds(0),
+    m_refits(0) {}
+
+void ParticleBvh::set_rebuild_threshold(float threshold) {
+  m_rebuild_threshold = threshold;
+}
+
+float ParticleBvh::rebuild_threshold() const {
+  return m_rebuild_threshold;
+}
+
+bool ParticleBvh::update(std::vector<Particle> const& particles, float particle_radius) {
+  if (m_builds == 0 || particles.size() != m_order.size() || particle_radius != m_particle_radius) {
+    build(particles, particle_radius);
+    return true;
+  }
+
+  refit(particles, particle_radius);
+  if (m_area_cost > m_rebuild_threshold * m_build_area_cost) {
+    build(particles, particle_radius);
+    return true;
+  }
+  return false;
+}
+
+void ParticleBvh::build(std::vector<Particle> const& particles, float particle_radius) {
+  const size_t count = particles.size();
+  m_particle_radius = particle_radius;
+  m_builds++;
+
+  m_items.resize(count);
+  m_pool.parallel_for(count, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      m_items[i].center = particles[i].position;
+      m_items[i].particle = i;
+    }
+  });
+
+  m_nodes.clear();
+  m_level_starts.clear();
+  if (count > 0) {
+    Node root;
+    root.first = 0;
+    root.count = count;
+    m_nodes.push_back(root);
+  }
+
+  // The nodes of a level own disjoint ranges of the items, so they are split in parallel. Their children are
+  // appended in order afterwards, which keeps the nodes breadth first.
+  for (size_t level_start = 0; level_start < m_nodes.size();) {
+    const unsigned int level = m_level_starts.size();
+    const size_t level_end = m_nodes.size();
+    m_level_starts.push_back(level_start);
+
+    m_splits.assign(level_end - level_start, 0);
+    m_pool.parallel_for(level_end - level_start, [&](size_t begin, size_t end) {
+      for (size_t n = begin; n < end; n++) {
+        m_splits[n] = split(m_nodes[level_start + n], level);
+      }
+    });
+
+    for (size_t n = 0; n < m_splits.size(); n++) {
+      if (m_splits[n] == 0) {
+        continue;
+      }
+
+      Node left = m_nodes[level_start + n];
+      Node right = left;
+      left.count = m_splits[n];
+      right.first += m_splits[n];
+      right.count -= m_splits[n];
+
+      m_nodes[level_start + n].first = m_nodes.size();
+      m_nodes[level_start + n].count = 0;
+      m_nodes.push_back(left);
+      m_nodes.push_back(right);
+    }
+    level_start = level_end;
+  }
+  m_level_starts.push_back(m_nodes.size());
+
+  m_order.resize(count);
+  m_centers.resize(count);
+  m_pool.parallel_for(count, [&](size_t begin, size_t end) {
+    for (size_t k = begin; k < end; k++) {
+      m_order[k] = m_items[k].particle;
+      m_centers[k] = m_items[k].center;
+    }
+  });
+
+  compute_sah_cost();
+  m_build_area_cost = m_area_cost;
+}
+
+// Fits the node around its particles, and splits them into two (returns the amount that go left) unless they fit
+// in a leaf. The split is the cheapest one by the SAH of `SAH_BINS` bins along each axis.
+unsigned int ParticleBvh::split(Node& node, unsigned int level) {
+  BuildItem* items = &m_items[node.first];
+  const unsigned int count = node.count;
+  const float3 r = make_float3(m_particle_radius);
+
+  float3 lower = make_float3(FLT_MAX);
+  float3 upper = make_float3(-FLT_MAX);
+  for (unsigned int k = 0; k < count; k++) {
+    lower = min3(lower, items[k].center);
+    upper = max3(upper, items[k].center);
+  }
+  node.lower = lower - r;
+  node.upper = upper + r;
+
+  if (count <= MAX_LEAF_SIZE) {
+    return 0;
+  }
+
+  const float3 extent = upper - lower;
+  unsigned int widest = 0;
+  for (unsigned int axis = 1; axis < 3; axis++) {
+    widest = component(extent, axis) > component(extent, widest) ? axis : widest;
+  }
+
+  // Particles on top of each other can go either way.
+  if (component(extent, widest) <= 0.0f) {
+    return count / 2;
+  }
+
+  if (level < MAX_SAH_DEPTH) {
+    float best_cost = FLT_MAX;
+    unsigned int best_axis = 0;
+    unsigned int best_bin = 0;
+
+    for (unsigned int axis = 0; axis < 3; axis++) {
+      const float axis_lower = component(lower, axis);
+      const float axis_extent = component(extent, axis);
+      if (axis_extent <= 0.0f) {
+        continue;
+      }
+      const float scale = SAH_BINS / axis_extent;
+
+      unsigned int bin_counts[SAH_BINS] = {};
+      float3 bin_lower[SAH_BINS];
+      float3 bin_upper[SAH_BINS];
+      std::fill(bin_lower, bin_lower + SAH_BINS, make_float3(FLT_MAX));
+      std::fill(bin_upper, bin_upper + SAH_BINS, make_float3(-FLT_MAX));
+      for (unsigned int k = 0; k < count; k++) {
+        unsigned int bin = std::min(SAH_BINS - 1, (unsigned int) ((component(items[k].center, axis) - axis_lower) * scale));
+        bin_counts[bin]++;
+        bin_lower[bin] = min3(bin_lower[bin], items[k].center);
+        bin_upper[bin] = max3(bin_upper[bin], items[k].center);
+      }
+
+      // Cost of the particles right of each split (between bin b - 1 and b).
+      float right_costs[SAH_BINS];
+      float3 right_lower = make_float3(FLT_MAX);
+      float3 right_upper = make_float3(-FLT_MAX);
+      unsigned int right_count = 0;
+      for (unsigned int b = SAH_BINS - 1; b > 0; b--) {
+        right_lower = min3(right_lower, bin_lower[b]);
+        right_upper = max3(right_upper, bin_upper[b]);
+        right_count += bin_counts[b];
+        right_costs[b] = right_count > 0 ? right_count * half_area(right_lower - r, right_upper + r) : 0.0f;
+      }
+
+      float3 left_lower = make_float3(FLT_MAX);
+      float3 left_upper = make_float3(-FLT_MAX);
+      unsigned int left_count = 0;
+      for (unsigned int b = 1; b < SAH_BINS; b++) {
+        left_lower = min3(left_lower, bin_lower[b - 1]);
+        left_upper = max3(left_upper, bin_upper[b - 1]);
+        left_count += bin_counts[b - 1];
+        if (left_count == 0 || left_count == count) {
+          continue;
+        }
+
+        float cost = left_count * half_area(left_lower - r, left_upper + r) + right_costs[b];
+        if (cost < best_cost) {
+          best_cost = cost;
+          best_axis = axis;
+          best_bin = b;
+        }
+      }
+    }
+
+    if (best_cost < FLT_MAX) {
+      const float axis_lower = component(lower, best_axis);
+      const float scale = SAH_BINS / component(extent, best_axis);
+      BuildItem* middle = std::partition(items, items + count, [&](BuildItem const& item) {
+        return std::min(SAH_BINS - 1, (unsigned int) ((component(item.center, best_axis) - axis_lower) * scale)) < best_bin;
+      });
+      return middle - items;
+    }
+  }
+
+  // The median of the widest axis.
+  std::nth_element(items, items + count / 2, items + count, [&](BuildItem const& a, BuildItem const& b) {
+    return component(a.center, widest) < component(b.center, widest);
+  });
+  return count / 2;
+}
+
+void ParticleBvh::refit(std::vector<Particle> const& particles, float particle_radius) {
+  m_particle_radius = particle_radius;
+  m_refits++;
+
+  m_pool.parallel_for(m_order.size(), [&](size_t begin, size_t end) {
+    for (size_t k = begin; k < end; k++) {
+      m_centers[k] = particles[m_order[k]].position;
+    }
+  });
+
+  // Every level only reads the one below it.
+  for (unsigned int level = depth(); level-- > 0;) {
+    const size_t level_start = m_level_starts[level];
+    m_pool.parallel_for(m_level_starts[level + 1] - level_start, [&](size_t begin, size_t end) {
+      for (size_t n = level_start + begin; n < level_start + end; n++) {
+        Node& node = m_nodes[n];
+        if (node.count > 0) {
+          fit_leaf(node);
+        } else {
+          node.lower = min3(m_nodes[node.first].lower, m_nodes[node.first + 1].lower);
+          node.upper = max3(m_nodes[node.first].upper, m_nodes[node.first + 1].upper);
+        }
+      }
+    });
+  }
+
+  compute_sah_cost();
+}
+
+void ParticleBvh::fit_leaf(Node& node) const {
+  float3 lower = make_float3(FLT_MAX);
+  float3 upper = make_float3(-FLT_MAX);
+  for (unsigned int k = node.first; k < node.first + node.count; k++) {
+    lower = min3(lower, m_centers[k]);
+    upper = max3(upper, m_centers[k]);
+  }
+  node.lower = lower - make_float3(m_particle_radius);
+  node.upper = upper + make_float3(m_particle_radius);
+}
+
+// Each node is entered with the probability that a ray through the root passes its box (their area ratio), and
+// then costs one box test per child, or one sphere test per particle.
+void ParticleBvh::compute_sah_cost() {
+  m_area_cost = 0.0;
+  for (Node const& node : m_nodes) {
+    m_area_cost += half_area(node.lower, node.upper) * (node.count > 0 ? node.count : 2);
+  }
+
+  const float root_area = m_nodes.empty() ? 0.0f : half_area(m_nodes[0].lower, m_nodes[0].upper);
+  m_sah_cost = root_area > 0.0f ? (float) (m_area_cost / root_area) : 0.0f;
+}
+
+bool ParticleBvh::intersect(ParticleRay const& ray, ParticleHit& hit) const {
+  if (m_nodes.empty()) {
+    return false;
+  }
+
+  const float3 o = ray.origin;
+  const float3 d = ray.direction;
+  const float3 inverse_direction = make_float3(1.0f / d.x, 1.0f / d.y, 1.0f / d.z);
+  const float r = m_particle_radius;
+  float t_max = ray.t_max;
+  bool found = false;
+
+  // Nodes still to visit, and where the ray enters them.
+  unsigned int stack[MAX_DEPTH];
+  float stack_t[MAX_DEPTH];
+  unsigned int size = 0;
+
+  float t_entry;
+  if (intersect_box(m_nodes[0].lower, m_nodes[0].upper, o, inverse_direction, ray.t_min, t_max, t_entry)) {
+    stack[size] = 0;
+    stack_t[size++] = t_entry;
+  }
+
+  while (size > 0) {
+    size--;
+    Node const& node = m_nodes[stack[size]];
+    if (stack_t[size] > t_max) {
+      continue;
+    }
+
+    if (node.count > 0) {
+      // See `ray_intersection` in water_rendering.cu.
+      for (unsigned int k = node.first; k < node.first + node.count; k++) {
+        const float3 c = m_centers[k];
+        const float oc_dot_d = dot(o - c, d);
+        const float inside_root_term = oc_dot_d * oc_dot_d - dot(o - c, o - c) + r * r;
+        if (0.0f <= inside_root_term) {
+          const float t1 = -oc_dot_d - sqrtf(inside_root_term);
+          if (ray.t_min < t1 && t1 < t_max) {
+            t_max = t1;
+            hit.particle = m_order[k];
+            hit.t = t1;
+            found = true;
+          }
+        }
+      }
+      continue;
+    }
+
+    // The nearer child goes on top of the stack.
+    float t_left, t_right;
+    Node const& left = m_nodes[node.first];
+    Node const& right = m_nodes[node.first + 1];
+    bool hits_left = intersect_box(left.lower, left.upper, o, inverse_direction, ray.t_min, t_max, t_left);
+    bool hits_right = intersect_box(right.lower, right.upper, o, inverse_direction, ray.t_min, t_max, t_right);
+    if (hits_left && hits_right && t_left < t_right) {
+      stack[size] = node.first + 1;
+      stack_t[size++] = t_right;
+      stack[size] = node.first;
+      stack_t[size++] = t_left;
+    } else {
+      if (hits_left) {
+        stack[size] = node.first;
+        stack_t[size++] = t_left;
+      }
+      if (hits_right) {
+        stack[size] = node.first + 1;
+        stack_t[size++] = t_right;
+      }
+    }
+  }
+  return found;
+}
+
+float ParticleBvh::sah_cost() const {
+  return m_sah_cost;
+}
+
+float ParticleBvh::sah_cost_growth() const {
+  return m_build_area_cost > 0.0 ? (float) (m_area_cost / m_build_area_cost) : 1.0f;
+}
+
+size_t ParticleBvh::particle_count() const {
+  return m_order.size();
+}
+
+size_t ParticleBvh::node_count() const {
+  return m_nodes.size();
+}
+
+unsigned int ParticleBvh::depth() const {
+  return m_level_starts.empty() ? 0 : m_level_starts.size() - 1;
+}
+
+unsigned long long ParticleBvh::builds() const {
+  return m_builds;
+}
+
+unsigned long long ParticleBvh::refits() const {
+  return m_refits;
+}
+
+size_t ParticleBvh::memory_usage() const {
+  return m_nodes.capacity() * sizeof(Node) +
+         m_level_starts.capacity() * sizeof(unsigned int) +
+         m_order.capacity() * sizeof(unsigned int) +
+         m_centers.capacity() * sizeof(float3) +
+         m_items.capacity() * sizeof(BuildItem) +
+         m_splits.capacity() * sizeof(unsigned int);
+}
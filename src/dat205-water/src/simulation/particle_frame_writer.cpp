@@ -0,0 +1,133 @@
+#include "simulation/particle_frame_writer.hpp"
+
+#include <algorithm>
+
+ParticleFrameWriter::ParticleFrameWriter(std::string const& path,
+                                         ParticleCacheEncoding encoding,
+                                         float particle_radius,
+                                         size_t max_pending_frames)
+  : m_cache(path, encoding, particle_radius),
+    m_max_pending_frames(std::max<size_t>(1, max_pending_frames)),
+    m_closing(false),
+    m_failed(false),
+    m_frames_written(0),
+    m_bytes_written(0) {
+
+  if (m_cache.isOpen()) {
+    m_thread = std::thread([this]() { writer_loop(); });
+  }
+}
+
+ParticleFrameWriter::~ParticleFrameWriter() {
+  close();
+}
+
+bool ParticleFrameWriter::is_open() const {
+  return m_thread.joinable();
+}
+
+void ParticleFrameWriter::write(float time, std::vector<Particle>& particles) {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  if (!m_thread.joinable() || m_closing) {
+    m_failed = true;
+    return;
+  }
+
+  m_frame_written.wait(lock, [&]() { return m_pending.size() < m_max_pending_frames; });
+
+  Frame frame;
+  frame.time = time;
+  frame.particles.swap(particles);
+  m_pending.push_back(std::move(frame));
+
+  if (!m_free_buffers.empty()) {
+    particles.swap(m_free_buffers.back());
+    m_free_buffers.pop_back();
+  }
+
+  lock.unlock();
+  m_frame_available.notify_one();
+}
+
+void ParticleFrameWriter::close() {
+  if (m_thread.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_closing = true;
+    }
+    m_frame_available.notify_one();
+    m_thread.join();
+  }
+}
+
+bool ParticleFrameWriter::failed() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_failed;
+}
+
+unsigned int ParticleFrameWriter::frames_written() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_frames_written;
+}
+
+uint64_t ParticleFrameWriter::bytes_written() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_bytes_written;
+}
+
+void ParticleFrameWriter::writer_loop() {
+  std::vector<float> positions;
+  std::vector<float> velocities;
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (true) {
+    m_frame_available.wait(lock, [&]() { return !m_pending.empty() || m_closing; });
+    if (m_pending.empty()) {
+      break; // Closing, and everything has been written.
+    }
+
+    Frame frame = std::move(m_pending.front());
+    m_pending.pop_front();
+
+    // The simulation may queue the next frame while this one is written.
+    lock.unlock();
+    bool ok = write_frame(frame, positions, velocities);
+    uint64_t bytes_written = m_cache.bytesWritten();
+    lock.lock();
+
+    if (ok) {
+      m_frames_written++;
+    } else {
+      m_failed = true;
+    }
+    m_bytes_written = bytes_written;
+    m_free_buffers.push_back(std::move(frame.particles));
+
+    m_frame_written.notify_one();
+  }
+
+  // Adds the frame table that makes every frame accessible in O(1).
+  if (!m_cache.finish()) {
+    m_failed = true;
+  }
+  m_bytes_written = m_cache.bytesWritten();
+}
+
+bool ParticleFrameWriter::write_frame(Frame const& frame, std::vector<float>& positions, std::vector<float>& velocities) {
+  size_t count = frame.particles.size();
+
+  // Only the positions and velocities are needed to render a frame.
+  positions.resize(3 * count);
+  velocities.resize(3 * count);
+  for (size_t i = 0; i < count; i++) {
+    const Particle& p = frame.particles[i];
+    positions[3 * i + 0] = p.position.x;
+    positions[3 * i + 1] = p.position.y;
+    positions[3 * i + 2] = p.position.z;
+    velocities[3 * i + 0] = p.velocity.x;
+    velocities[3 * i + 1] = p.velocity.y;
+    velocities[3 * i + 2] = p.velocity.z;
+  }
+
+  return m_cache.writeFrame(frame.time, count, positions.data(), velocities.data());
+}
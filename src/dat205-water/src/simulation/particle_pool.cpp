@@ -0,0 +1,89 @@
+#include "simulation/particle_pool.hpp"
+
+#include <algorithm>
+
+ParticlePool::ParticlePool()
+  : m_capacity(0) {}
+
+void ParticlePool::reset(size_t count) {
+  m_alive.assign(count, 1);
+  m_free.clear();
+  m_capacity = count;
+}
+
+size_t ParticlePool::size() const {
+  return m_alive.size();
+}
+
+size_t ParticlePool::capacity() const {
+  return m_capacity;
+}
+
+size_t ParticlePool::live_count() const {
+  return m_alive.size() - m_free.size();
+}
+
+bool ParticlePool::has_holes() const {
+  return !m_free.empty();
+}
+
+uint8_t const* ParticlePool::alive_flags() const {
+  return m_alive.data();
+}
+
+unsigned int ParticlePool::allocate() {
+  if (!m_free.empty()) {
+    unsigned int slot = m_free.back();
+    m_free.pop_back();
+    m_alive[slot] = 1;
+    return slot;
+  }
+
+  if (m_alive.size() == m_capacity) {
+    m_capacity = std::max<size_t>(256, 2 * m_capacity);
+    m_alive.reserve(m_capacity);
+  }
+  m_alive.push_back(1);
+  return m_alive.size() - 1;
+}
+
+void ParticlePool::release(unsigned int slot) {
+  m_alive[slot] = 0;
+  m_free.push_back(slot);
+}
+
+bool ParticlePool::needs_compaction() const {
+  return 4 * m_free.size() > m_alive.size();
+}
+
+void ParticlePool::save(StateSectionWriter& writer) const {
+  writer.write<uint64_t>(m_capacity);
+  writer.write_vector(m_alive);
+  writer.write_vector(m_free);
+}
+
+bool ParticlePool::restore(StateSectionReader& reader) {
+  uint64_t capacity;
+  if (!reader.read(capacity) || !reader.read_vector(m_alive) || !reader.read_vector(m_free)) {
+    reset(0);
+    return false;
+  }
+
+  // Every hole must be on the free list exactly once.
+  size_t holes = std::count(m_alive.begin(), m_alive.end(), 0);
+  bool valid = holes == m_free.size() && capacity >= m_alive.size();
+  for (unsigned int slot : m_free) {
+    valid = valid && slot < m_alive.size() && m_alive[slot] == 0;
+  }
+  if (!valid) {
+    reset(0);
+    return false;
+  }
+
+  m_capacity = capacity;
+  return true;
+}
+
+size_t ParticlePool::memory_usage() const {
+  return m_alive.capacity() + m_free.capacity() * sizeof(unsigned int);
+}
@@ -0,0 +1,449 @@
+#include "simulation/signed_distance_field.hpp"
+
+#include <Mesh.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <unordered_map>
+
+using namespace optix;
+
+bool load_triangle_mesh(std::string const& path, float scale, float3 offset, TriangleMesh& mesh) {
+  mesh.positions.clear();
+  mesh.indices.clear();
+
+  try {
+    HostMesh loaded(path);
+
+    mesh.positions.resize(loaded.num_vertices);
+    for (int i = 0; i < loaded.num_vertices; i++) {
+      float const* p = loaded.positions + 3 * i;
+      mesh.positions[i] = scale * make_float3(p[0], p[1], p[2]) + offset;
+    }
+    mesh.indices.assign(loaded.tri_indices, loaded.tri_indices + 3 * loaded.num_triangles);
+  } catch (std::runtime_error const&) {
+    return false;
+  }
+
+  return !mesh.indices.empty();
+}
+
+// Which part of a triangle is closest to a point.
+enum class TriangleFeature { FACE, EDGE_AB, EDGE_BC, EDGE_CA, VERTEX_A, VERTEX_B, VERTEX_C };
+
+// See Ericson, Real-Time Collision Detection, section 5.1.5.
+static float3 closest_point_on_triangle(float3 p, float3 a, float3 b, float3 c, TriangleFeature& feature) {
+  float3 ab = b - a;
+  float3 ac = c - a;
+
+  float3 ap = p - a;
+  float d1 = dot(ab, ap);
+  float d2 = dot(ac, ap);
+  if (d1 <= 0.0f && d2 <= 0.0f) {
+    feature = TriangleFeature::VERTEX_A;
+    return a;
+  }
+
+  float3 bp = p - b;
+  float d3 = dot(ab, bp);
+  float d4 = dot(ac, bp);
+  if (d3 >= 0.0f && d4 <= d3) {
+    feature = TriangleFeature::VERTEX_B;
+    return b;
+  }
+
+  float vc = d1 * d4 - d3 * d2;
+  if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+    feature = TriangleFeature::EDGE_AB;
+    return a + (d1 / (d1 - d3)) * ab;
+  }
+
+  float3 cp = p - c;
+  float d5 = dot(ab, cp);
+  float d6 = dot(ac, cp);
+  if (d6 >= 0.0f && d5 <= d6) {
+    feature = TriangleFeature::VERTEX_C;
+    return c;
+  }
+
+  float vb = d5 * d2 - d1 * d6;
+  if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+    feature = TriangleFeature::EDGE_CA;
+    return a + (d2 / (d2 - d6)) * ac;
+  }
+
+  float va = d3 * d6 - d5 * d4;
+  if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f) {
+    feature = TriangleFeature::EDGE_BC;
+    return b + ((d4 - d3) / ((d4 - d3) + (d5 - d6))) * (c - b);
+  }
+
+  float denominator = 1.0f / (va + vb + vc);
+  feature = TriangleFeature::FACE;
+  return a + ab * (vb * denominator) + ac * (vc * denominator);
+}
+
+static int floor_div(int a, int b) {
+  return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+SignedDistanceField::SignedDistanceField()
+  : m_cell_size(1.0f),
+    m_band(0.0f),
+    m_first_block(make_int3(0)),
+    m_block_dims(make_int3(0)) {}
+
+void SignedDistanceField::build(TriangleMesh const& mesh, float cell_size, float band, ThreadPool& pool) {
+  m_cell_size = cell_size;
+  m_band = band;
+  m_block_table.clear();
+  m_values.clear();
+  m_first_block = make_int3(0);
+  m_block_dims = make_int3(0);
+
+  // Weld vertices at identical positions (loaders duplicate them along texture seams), since the
+  // pseudonormals need to know which triangles share an edge or a vertex.
+  struct PositionHash {
+    size_t operator()(float3 const& p) const {
+      uint32_t bits[3];
+      memcpy(bits, &p, sizeof(bits));
+      return bits[0] * 73856093u ^ bits[1] * 19349663u ^ bits[2] * 83492791u;
+    }
+  };
+  struct PositionEqual {
+    bool operator()(float3 const& a, float3 const& b) const {
+      return a.x == b.x && a.y == b.y && a.z == b.z;
+    }
+  };
+  std::unordered_map<float3, unsigned int, PositionHash, PositionEqual> welded_indices;
+  std::vector<float3> positions;
+  std::vector<unsigned int> remap(mesh.positions.size());
+  for (size_t i = 0; i < mesh.positions.size(); i++) {
+    auto welded = welded_indices.emplace(mesh.positions[i], (unsigned int) positions.size());
+    if (welded.second) {
+      positions.push_back(mesh.positions[i]);
+    }
+    remap[i] = welded.first->second;
+  }
+
+  // Triangles without area have no normal and can not be the only closest triangle anyway.
+  std::vector<uint3> triangles;
+  std::vector<float3> face_normals;
+  for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+    if (mesh.indices[i] >= remap.size() || mesh.indices[i + 1] >= remap.size() || mesh.indices[i + 2] >= remap.size()) {
+      continue;
+    }
+
+    uint3 t = make_uint3(remap[mesh.indices[i]], remap[mesh.indices[i + 1]], remap[mesh.indices[i + 2]]);
+    float3 n = cross(positions[t.y] - positions[t.x], positions[t.z] - positions[t.x]);
+    if (dot(n, n) > 0.0f) {
+      triangles.push_back(t);
+      face_normals.push_back(normalize(n));
+    }
+  }
+
+  if (triangles.empty()) {
+    return;
+  }
+
+  // Angle-weighted vertex normals, and edge normals as the sum of the normals of the triangles along the edge.
+  std::vector<float3> vertex_normals(positions.size(), make_float3(0.0f));
+  std::unordered_map<uint64_t, float3> edge_normal_sums;
+  auto edge_key = [](unsigned int a, unsigned int b) {
+    return (uint64_t) std::min(a, b) << 32 | std::max(a, b);
+  };
+
+  for (size_t t = 0; t < triangles.size(); t++) {
+    unsigned int v[3] = { triangles[t].x, triangles[t].y, triangles[t].z };
+    for (int k = 0; k < 3; k++) {
+      float3 e1 = normalize(positions[v[(k + 1) % 3]] - positions[v[k]]);
+      float3 e2 = normalize(positions[v[(k + 2) % 3]] - positions[v[k]]);
+      float angle = acosf(std::max(-1.0f, std::min(1.0f, dot(e1, e2))));
+      vertex_normals[v[k]] += angle * face_normals[t];
+
+      float3& edge_normal = edge_normal_sums.emplace(edge_key(v[k], v[(k + 1) % 3]), make_float3(0.0f)).first->second;
+      edge_normal += face_normals[t];
+    }
+  }
+
+  std::vector<float3> edge_normals(3 * triangles.size());
+  for (size_t t = 0; t < triangles.size(); t++) {
+    edge_normals[3 * t + 0] = edge_normal_sums[edge_key(triangles[t].x, triangles[t].y)];
+    edge_normals[3 * t + 1] = edge_normal_sums[edge_key(triangles[t].y, triangles[t].z)];
+    edge_normals[3 * t + 2] = edge_normal_sums[edge_key(triangles[t].z, triangles[t].x)];
+  }
+
+  // Bounds of each triangle, and of the blocks that are within the band of any of them.
+  std::vector<float3> triangle_min(triangles.size());
+  std::vector<float3> triangle_max(triangles.size());
+  float3 lo = make_float3(FLT_MAX);
+  float3 hi = make_float3(-FLT_MAX);
+  for (size_t t = 0; t < triangles.size(); t++) {
+    float3 a = positions[triangles[t].x];
+    float3 b = positions[triangles[t].y];
+    float3 c = positions[triangles[t].z];
+    triangle_min[t] = fminf(a, fminf(b, c));
+    triangle_max[t] = fmaxf(a, fmaxf(b, c));
+    lo = fminf(lo, triangle_min[t]);
+    hi = fmaxf(hi, triangle_max[t]);
+  }
+
+  // Rounded the same way as in `locate`.
+  auto block_of = [&](float3 p) {
+    return make_int3(floor_div(int(floorf(p.x / cell_size)), BLOCK_CELLS),
+                     floor_div(int(floorf(p.y / cell_size)), BLOCK_CELLS),
+                     floor_div(int(floorf(p.z / cell_size)), BLOCK_CELLS));
+  };
+
+  int3 first = block_of(lo - make_float3(band));
+  int3 last = block_of(hi + make_float3(band));
+  m_first_block = first;
+  m_block_dims = make_int3(last.x - first.x + 1, last.y - first.y + 1, last.z - first.z + 1);
+
+  // Count the triangles near each block, then store a list of them for each block that has any.
+  std::vector<unsigned int> block_counts((size_t) m_block_dims.x * m_block_dims.y * m_block_dims.z, 0);
+  auto for_each_block = [&](size_t t, std::function<void(size_t)> const& f) {
+    int3 b0 = block_of(triangle_min[t] - make_float3(band));
+    int3 b1 = block_of(triangle_max[t] + make_float3(band));
+    for (int z = b0.z; z <= b1.z; z++) {
+      for (int y = b0.y; y <= b1.y; y++) {
+        for (int x = b0.x; x <= b1.x; x++) {
+          f(((size_t) (z - first.z) * m_block_dims.y + (y - first.y)) * m_block_dims.x + (x - first.x));
+        }
+      }
+    }
+  };
+
+  for (size_t t = 0; t < triangles.size(); t++) {
+    for_each_block(t, [&](size_t b) { block_counts[b]++; });
+  }
+
+  m_block_table.assign(block_counts.size(), int(EMPTY_OUTSIDE));
+  std::vector<size_t> stored_blocks;
+  std::vector<unsigned int> list_start(1, 0);
+  for (size_t b = 0; b < block_counts.size(); b++) {
+    if (block_counts[b] > 0) {
+      m_block_table[b] = stored_blocks.size();
+      stored_blocks.push_back(b);
+      list_start.push_back(list_start.back() + block_counts[b]);
+    }
+  }
+
+  std::vector<unsigned int> lists(list_start.back());
+  std::vector<unsigned int> fill(list_start.begin(), list_start.end() - 1);
+  for (size_t t = 0; t < triangles.size(); t++) {
+    for_each_block(t, [&](size_t b) { lists[fill[m_block_table[b]]++] = t; });
+  }
+
+  // Sample the distance at the nodes of each stored block.
+  const int nodes_per_block = BLOCK_NODES * BLOCK_NODES * BLOCK_NODES;
+  m_values.resize(stored_blocks.size() * nodes_per_block);
+
+  pool.parallel_for(stored_blocks.size(), [&](size_t begin, size_t end) {
+    for (size_t s = begin; s < end; s++) {
+      size_t b = stored_blocks[s];
+      int3 block = make_int3(first.x + int(b % m_block_dims.x),
+                             first.y + int(b / m_block_dims.x % m_block_dims.y),
+                             first.z + int(b / m_block_dims.x / m_block_dims.y));
+
+      for (int z = 0; z < BLOCK_NODES; z++) {
+        for (int y = 0; y < BLOCK_NODES; y++) {
+          for (int x = 0; x < BLOCK_NODES; x++) {
+            float3 p = cell_size * make_float3(float(block.x * BLOCK_CELLS + x),
+                                               float(block.y * BLOCK_CELLS + y),
+                                               float(block.z * BLOCK_CELLS + z));
+
+            float best2 = FLT_MAX;
+            float3 best_point = p;
+            float3 best_normal = make_float3(0.0f, 1.0f, 0.0f);
+
+            for (unsigned int i = list_start[s]; i < list_start[s + 1]; i++) {
+              unsigned int t = lists[i];
+
+              // Triangles whose bounds are farther away than the closest triangle so far can be skipped.
+              float3 outside = fmaxf(make_float3(0.0f), fmaxf(triangle_min[t] - p, p - triangle_max[t]));
+              if (dot(outside, outside) >= best2) {
+                continue;
+              }
+
+              TriangleFeature feature;
+              float3 q = closest_point_on_triangle(p, positions[triangles[t].x], positions[triangles[t].y], positions[triangles[t].z], feature);
+              float3 d = p - q;
+              float d2 = dot(d, d);
+              if (d2 >= best2) {
+                continue;
+              }
+
+              best2 = d2;
+              best_point = q;
+              switch (feature) {
+                case TriangleFeature::FACE:     best_normal = face_normals[t];                 break;
+                case TriangleFeature::EDGE_AB:  best_normal = edge_normals[3 * t + 0];         break;
+                case TriangleFeature::EDGE_BC:  best_normal = edge_normals[3 * t + 1];         break;
+                case TriangleFeature::EDGE_CA:  best_normal = edge_normals[3 * t + 2];         break;
+                case TriangleFeature::VERTEX_A: best_normal = vertex_normals[triangles[t].x];  break;
+                case TriangleFeature::VERTEX_B: best_normal = vertex_normals[triangles[t].y];  break;
+                case TriangleFeature::VERTEX_C: best_normal = vertex_normals[triangles[t].z];  break;
+              }
+            }
+
+            float distance = std::min(sqrtf(best2), band);
+            float sign = dot(p - best_point, best_normal) < 0.0f ? -1.0f : 1.0f;
+            m_values[s * nodes_per_block + (z * BLOCK_NODES + y) * BLOCK_NODES + x] = sign * distance;
+          }
+        }
+      }
+    }
+  });
+
+  // The stored blocks enclose the surface, so the blocks without triangles form regions that are entirely
+  // inside or entirely outside. Each region touches a stored block, whose nodes on the shared face are at
+  // least `band` away from the surface and have the region's sign, which is then flood filled through it.
+  auto table_index = [&](int x, int y, int z) {
+    return ((size_t) z * m_block_dims.y + y) * m_block_dims.x + x;
+  };
+  const int3 steps[6] = {
+    make_int3(-1, 0, 0), make_int3(1, 0, 0),
+    make_int3(0, -1, 0), make_int3(0, 1, 0),
+    make_int3(0, 0, -1), make_int3(0, 0, 1),
+  };
+
+  std::vector<size_t> inside;
+  for (int z = 0; z < m_block_dims.z; z++) {
+    for (int y = 0; y < m_block_dims.y; y++) {
+      for (int x = 0; x < m_block_dims.x; x++) {
+        if (m_block_table[table_index(x, y, z)] != EMPTY_OUTSIDE) {
+          continue;
+        }
+
+        for (int3 step : steps) {
+          int3 n = make_int3(x + step.x, y + step.y, z + step.z);
+          if (n.x < 0 || n.y < 0 || n.z < 0 || n.x >= m_block_dims.x || n.y >= m_block_dims.y || n.z >= m_block_dims.z) {
+            continue;
+          }
+
+          int stored = m_block_table[table_index(n.x, n.y, n.z)];
+          if (stored < 0) {
+            continue;
+          }
+
+          // Center node of the face that the stored block shares with this one.
+          int3 node = make_int3(step.x == 0 ? BLOCK_CELLS / 2 : step.x < 0 ? BLOCK_CELLS : 0,
+                                step.y == 0 ? BLOCK_CELLS / 2 : step.y < 0 ? BLOCK_CELLS : 0,
+                                step.z == 0 ? BLOCK_CELLS / 2 : step.z < 0 ? BLOCK_CELLS : 0);
+          if (m_values[stored * nodes_per_block + (node.z * BLOCK_NODES + node.y) * BLOCK_NODES + node.x] < 0.0f) {
+            m_block_table[table_index(x, y, z)] = EMPTY_INSIDE;
+            inside.push_back(table_index(x, y, z));
+          }
+          break;
+        }
+      }
+    }
+  }
+
+  while (!inside.empty()) {
+    size_t b = inside.back();
+    inside.pop_back();
+    int x = int(b % m_block_dims.x);
+    int y = int(b / m_block_dims.x % m_block_dims.y);
+    int z = int(b / m_block_dims.x / m_block_dims.y);
+
+    for (int3 step : steps) {
+      int3 n = make_int3(x + step.x, y + step.y, z + step.z);
+      if (n.x < 0 || n.y < 0 || n.z < 0 || n.x >= m_block_dims.x || n.y >= m_block_dims.y || n.z >= m_block_dims.z) {
+        continue;
+      }
+      if (m_block_table[table_index(n.x, n.y, n.z)] == EMPTY_OUTSIDE) {
+        m_block_table[table_index(n.x, n.y, n.z)] = EMPTY_INSIDE;
+        inside.push_back(table_index(n.x, n.y, n.z));
+      }
+    }
+  }
+}
+
+bool SignedDistanceField::empty() const {
+  return m_values.empty();
+}
+
+float SignedDistanceField::band() const {
+  return m_band;
+}
+
+int SignedDistanceField::locate(float3 position, float const*& values, int3& cell, float3& t) const {
+  float3 g = position / m_cell_size;
+  int3 c = make_int3(int(floorf(g.x)), int(floorf(g.y)), int(floorf(g.z)));
+  int3 block = make_int3(floor_div(c.x, BLOCK_CELLS) - m_first_block.x,
+                         floor_div(c.y, BLOCK_CELLS) - m_first_block.y,
+                         floor_div(c.z, BLOCK_CELLS) - m_first_block.z);
+
+  if (block.x < 0 || block.y < 0 || block.z < 0 ||
+      block.x >= m_block_dims.x || block.y >= m_block_dims.y || block.z >= m_block_dims.z) {
+    return EMPTY_OUTSIDE;
+  }
+
+  int index = m_block_table[((size_t) block.z * m_block_dims.y + block.y) * m_block_dims.x + block.x];
+  if (index < 0) {
+    return index;
+  }
+
+  values = m_values.data() + (size_t) index * BLOCK_NODES * BLOCK_NODES * BLOCK_NODES;
+  cell = make_int3(c.x - (block.x + m_first_block.x) * BLOCK_CELLS,
+                   c.y - (block.y + m_first_block.y) * BLOCK_CELLS,
+                   c.z - (block.z + m_first_block.z) * BLOCK_CELLS);
+  t = g - make_float3(float(c.x), float(c.y), float(c.z));
+  return index;
+}
+
+float SignedDistanceField::distance(float3 position) const {
+  float3 gradient;
+  return distance(position, gradient);
+}
+
+float SignedDistanceField::distance(float3 position, float3& gradient) const {
+  float const* values;
+  int3 cell;
+  float3 t;
+  int index = locate(position, values, cell, t);
+  if (index < 0) {
+    gradient = make_float3(0.0f);
+    return index == EMPTY_INSIDE ? -m_band : m_band;
+  }
+
+  const int sy = BLOCK_NODES;
+  const int sz = BLOCK_NODES * BLOCK_NODES;
+  float const* v = values + cell.z * sz + cell.y * sy + cell.x;
+
+  float v000 = v[0],       v100 = v[1];
+  float v010 = v[sy],      v110 = v[sy + 1];
+  float v001 = v[sz],      v101 = v[sz + 1];
+  float v011 = v[sz + sy], v111 = v[sz + sy + 1];
+
+  // Along x, then y, then z.
+  float v00 = v000 + t.x * (v100 - v000);
+  float v10 = v010 + t.x * (v110 - v010);
+  float v01 = v001 + t.x * (v101 - v001);
+  float v11 = v011 + t.x * (v111 - v011);
+  float v0 = v00 + t.y * (v10 - v00);
+  float v1 = v01 + t.y * (v11 - v01);
+
+  float dx0 = (v100 - v000) + t.y * ((v110 - v010) - (v100 - v000));
+  float dx1 = (v101 - v001) + t.y * ((v111 - v011) - (v101 - v001));
+  gradient = make_float3(dx0 + t.z * (dx1 - dx0),
+                         (v10 - v00) + t.z * ((v11 - v01) - (v10 - v00)),
+                         v1 - v0) / m_cell_size;
+
+  return v0 + t.z * (v1 - v0);
+}
+
+size_t SignedDistanceField::block_count() const {
+  return m_values.size() / (BLOCK_NODES * BLOCK_NODES * BLOCK_NODES);
+}
+
+size_t SignedDistanceField::memory_usage() const {
+  return m_block_table.capacity() * sizeof(int) + m_values.capacity() * sizeof(float);
+}
@@ -0,0 +1,69 @@
+#include "simulation/simulation_pipeline.hpp"
+
+SimulationPipeline::SimulationPipeline(WaterSimulation& simulation)
+  : m_simulation(simulation),
+    m_frame_dt(0.0f),
+    m_started(false),
+    m_simulating(false),
+    m_stopping(false) {
+
+  m_thread = std::thread([this]() { worker_loop(); });
+}
+
+SimulationPipeline::~SimulationPipeline() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopping = true;
+  }
+  m_frame_started.notify_one();
+  m_thread.join();
+}
+
+void SimulationPipeline::start(float frame_dt) {
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_frame_done.wait(lock, [&]() { return !m_simulating; });
+
+    m_frame_dt = frame_dt;
+    m_started = true;
+    m_simulating = true;
+  }
+  m_frame_started.notify_one();
+}
+
+bool SimulationPipeline::finish(std::vector<Particle>& particles) {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_frame_done.wait(lock, [&]() { return !m_simulating; });
+  if (!m_started) {
+    return false;
+  }
+
+  // The previous front buffer becomes the next back buffer, which keeps both allocated.
+  particles.swap(m_back_buffer);
+  m_started = false;
+  return true;
+}
+
+void SimulationPipeline::wait() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_frame_done.wait(lock, [&]() { return !m_simulating; });
+}
+
+void SimulationPipeline::worker_loop() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (true) {
+    m_frame_started.wait(lock, [&]() { return m_simulating || m_stopping; });
+    if (!m_simulating) {
+      break; // Stopping, and no frame is in flight.
+    }
+
+    // Nobody else touches the simulation or the back buffer until the frame is done.
+    lock.unlock();
+    m_simulation.advance(m_frame_dt);
+    m_simulation.get_particles(m_back_buffer);
+    lock.lock();
+
+    m_simulating = false;
+    m_frame_done.notify_all();
+  }
+}
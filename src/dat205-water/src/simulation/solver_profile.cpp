@@ -0,0 +1,87 @@
+#include "simulation/solver_profile.hpp"
+
+#include <algorithm>
+
+const char* solver_pass_name(SolverPass pass) {
+  switch (pass) {
+    case SolverPass::NEIGHBOR_SEARCH: return "neighbor-search";
+    case SolverPass::DENSITY:         return "density";
+    case SolverPass::FORCE:           return "force";
+    case SolverPass::PRESSURE_SOLVE:  return "pressure-solve";
+    case SolverPass::INTEGRATION:     return "integration";
+    default:                          return "unknown";
+  }
+}
+
+HashTableStatistics::HashTableStatistics()
+  : buckets(0),
+    occupied_buckets(0),
+    occupied_cells(0) {}
+
+double HashTableStatistics::load_factor() const {
+  return buckets == 0 ? 0.0 : (double) occupied_buckets / buckets;
+}
+
+double HashTableStatistics::collision_rate() const {
+  return occupied_cells == 0 ? 0.0 : (double) (occupied_cells - occupied_buckets) / occupied_cells;
+}
+
+SolverProfile::SolverProfile() {
+  reset();
+}
+
+void SolverProfile::reset() {
+  std::fill(pass_seconds, pass_seconds + SOLVER_PASS_COUNT, 0.0);
+  std::fill(pass_particles, pass_particles + SOLVER_PASS_COUNT, 0ull);
+  steps = 0;
+  particle_steps = 0;
+  neighbor_rebuilds = 0;
+  grid_migrations = 0;
+  particle_reorders = 0;
+  neighbor_entries = 0;
+  max_neighbors = 0;
+  overflowed_cells = 0;
+  memory_usage = 0;
+  hash_table = HashTableStatistics();
+}
+
+double SolverProfile::total_seconds() const {
+  double seconds = 0.0;
+  for (unsigned int pass = 0; pass < SOLVER_PASS_COUNT; pass++) {
+    seconds += pass_seconds[pass];
+  }
+  return seconds;
+}
+
+double SolverProfile::average_neighbors() const {
+  return particle_steps == 0 ? 0.0 : (double) neighbor_entries / particle_steps;
+}
+
+double SolverProfile::average_particles() const {
+  return steps == 0 ? 0.0 : (double) particle_steps / steps;
+}
+
+double SolverProfile::average_particles(SolverPass pass) const {
+  return steps == 0 ? 0.0 : (double) pass_particles[(unsigned int) pass] / steps;
+}
+
+double SolverProfile::nanoseconds_per_particle_step(SolverPass pass) const {
+  return particle_steps == 0 ? 0.0 : 1e9 * pass_seconds[(unsigned int) pass] / particle_steps;
+}
+
+double SolverProfile::nanoseconds_per_particle_step() const {
+  return particle_steps == 0 ? 0.0 : 1e9 * total_seconds() / particle_steps;
+}
+
+ScopedPassTimer::ScopedPassTimer(SolverProfile& profile, SolverPass pass, size_t particles)
+  : m_profile(profile),
+    m_pass(pass),
+    m_start(std::chrono::steady_clock::now()) {
+
+  m_profile.pass_particles[(unsigned int) m_pass] += particles;
+}
+
+ScopedPassTimer::~ScopedPassTimer() {
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - m_start;
+  m_profile.pass_seconds[(unsigned int) m_pass] += elapsed.count();
+}
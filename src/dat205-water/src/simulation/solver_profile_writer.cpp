@@ -0,0 +1,84 @@
+#include "simulation/solver_profile_writer.hpp"
+
+#include <utility>
+#include <vector>
+
+SolverProfileWriter::SolverProfileWriter(std::string const& path)
+  : m_file(path.c_str(), std::ios::trunc),
+    m_json(path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0),
+    m_frames_written(0),
+    m_failed(false) {}
+
+SolverProfileWriter::~SolverProfileWriter() {
+  close();
+}
+
+bool SolverProfileWriter::is_open() const {
+  return m_file.is_open();
+}
+
+void SolverProfileWriter::write(unsigned int frame, double time, SolverProfile const& profile, double render_seconds) {
+  if (!m_file.is_open()) {
+    m_failed = true;
+    return;
+  }
+
+  // Times are per frame [ms], particle and neighbor counts per step.
+  std::vector<std::pair<std::string, double>> columns;
+  columns.emplace_back("frame", frame);
+  columns.emplace_back("time", time);
+  columns.emplace_back("steps", (double) profile.steps);
+  columns.emplace_back("particles", profile.average_particles());
+  for (unsigned int pass = 0; pass < SOLVER_PASS_COUNT; pass++) {
+    std::string name = solver_pass_name((SolverPass) pass);
+    columns.emplace_back("ms_" + name, 1e3 * profile.pass_seconds[pass]);
+    columns.emplace_back("particles_" + name, profile.average_particles((SolverPass) pass));
+  }
+  columns.emplace_back("ms_render", 1e3 * render_seconds);
+  columns.emplace_back("avg_neighbors", profile.average_neighbors());
+  columns.emplace_back("max_neighbors", profile.max_neighbors);
+  columns.emplace_back("overflowed_cells", (double) profile.overflowed_cells);
+  columns.emplace_back("hash_buckets", profile.hash_table.buckets);
+  columns.emplace_back("load_factor", profile.hash_table.load_factor());
+  columns.emplace_back("collision_rate", profile.hash_table.collision_rate());
+  columns.emplace_back("neighbor_rebuilds", (double) profile.neighbor_rebuilds);
+  columns.emplace_back("memory_mib", profile.memory_usage / (1024.0 * 1024.0));
+
+  if (m_json) {
+    m_file << (m_frames_written == 0 ? "[\n  {" : ",\n  {");
+    for (size_t i = 0; i < columns.size(); i++) {
+      m_file << (i == 0 ? "" : ", ") << '"' << columns[i].first << "\": " << columns[i].second;
+    }
+    m_file << '}';
+  } else {
+    if (m_frames_written == 0) {
+      for (size_t i = 0; i < columns.size(); i++) {
+        m_file << (i == 0 ? "" : ",") << columns[i].first;
+      }
+      m_file << '\n';
+    }
+    for (size_t i = 0; i < columns.size(); i++) {
+      m_file << (i == 0 ? "" : ",") << columns[i].second;
+    }
+    m_file << '\n';
+  }
+
+  m_frames_written++;
+  m_failed = m_failed || !m_file;
+}
+
+void SolverProfileWriter::close() {
+  if (!m_file.is_open()) {
+    return;
+  }
+
+  if (m_json) {
+    m_file << (m_frames_written == 0 ? "[]\n" : "\n]\n");
+  }
+  m_file.close();
+  m_failed = m_failed || !m_file;
+}
+
+bool SolverProfileWriter::failed() const {
+  return m_failed;
+}
@@ -0,0 +1,59 @@
+// Compiled with -mavx2 -mfma (see CMakeLists.txt).
+#ifdef SPH_AVX2_AVAILABLE
+
+#include <immintrin.h>
+
+#include "sph_simd_impl.hpp"
+
+namespace {
+
+struct Avx2 {
+  static const unsigned int width = 8;
+
+  typedef __m256 Float;
+  typedef __m256i Index;
+  typedef __m256 Mask; // All bits set in active lanes.
+
+  static Float zero() { return _mm256_setzero_ps(); }
+  static Float set1(float a) { return _mm256_set1_ps(a); }
+
+  static Index load_indices(unsigned int const* p) { return _mm256_loadu_si256(reinterpret_cast<__m256i const*>(p)); }
+  static Float gather(float const* base, Index j) { return _mm256_i32gather_ps(base, j, 4); }
+
+  static Float add(Float a, Float b) { return _mm256_add_ps(a, b); }
+  static Float sub(Float a, Float b) { return _mm256_sub_ps(a, b); }
+  static Float mul(Float a, Float b) { return _mm256_mul_ps(a, b); }
+  static Float div(Float a, Float b) { return _mm256_div_ps(a, b); }
+  static Float max(Float a, Float b) { return _mm256_max_ps(a, b); }
+  static Float sqrt(Float a) { return _mm256_sqrt_ps(a); }
+
+  static Mask less(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+  static Mask greater(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+  static Mask mask_and(Mask a, Mask b) { return _mm256_and_ps(a, b); }
+  static Mask all_lanes() { return _mm256_castsi256_ps(_mm256_set1_epi32(-1)); }
+  static Mask first_lanes(unsigned int n) {
+    return _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(n), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+  }
+
+  // Lanes in `m` take `a`, the others `b`.
+  static Float select(Mask m, Float a, Float b) { return _mm256_blendv_ps(b, a, m); }
+
+  static float reduce_add(Float a) {
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+  }
+};
+
+} // namespace
+
+void sph_density_pass_avx2(SphPassArguments const& args, size_t begin, size_t end) {
+  density_pass<Avx2>(args, begin, end);
+}
+
+void sph_force_pass_avx2(SphPassArguments const& args, size_t begin, size_t end) {
+  force_pass<Avx2>(args, begin, end);
+}
+
+#endif
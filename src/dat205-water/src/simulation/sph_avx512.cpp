@@ -0,0 +1,61 @@
+// Compiled with -mavx512f (see CMakeLists.txt).
+#ifdef SPH_AVX512_AVAILABLE
+
+#include <immintrin.h>
+
+#include "sph_simd_impl.hpp"
+
+namespace {
+
+struct Avx512 {
+  static const unsigned int width = 16;
+
+  typedef __m512 Float;
+  typedef __m512i Index;
+  typedef __mmask16 Mask;
+
+  static Float zero() { return _mm512_setzero_ps(); }
+  static Float set1(float a) { return _mm512_set1_ps(a); }
+
+  static Index load_indices(unsigned int const* p) { return _mm512_loadu_si512(p); }
+  static Float gather(float const* base, Index j) { return _mm512_mask_i32gather_ps(_mm512_setzero_ps(), 0xFFFF, j, base, 4); }
+
+  static Float add(Float a, Float b) { return _mm512_add_ps(a, b); }
+  static Float sub(Float a, Float b) { return _mm512_sub_ps(a, b); }
+  static Float mul(Float a, Float b) { return _mm512_mul_ps(a, b); }
+  static Float div(Float a, Float b) { return _mm512_div_ps(a, b); }
+  static Float max(Float a, Float b) { return _mm512_max_ps(a, b); }
+  static Float sqrt(Float a) { return _mm512_sqrt_ps(a); }
+
+  static Mask less(Float a, Float b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+  static Mask greater(Float a, Float b) { return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ); }
+  static Mask mask_and(Mask a, Mask b) { return a & b; }
+  static Mask all_lanes() { return 0xFFFF; }
+  static Mask first_lanes(unsigned int n) { return Mask((1u << n) - 1); }
+
+  // Lanes in `m` take `a`, the others `b`.
+  static Float select(Mask m, Float a, Float b) { return _mm512_mask_blend_ps(m, b, a); }
+
+  // Only uses AVX-512F (the 256-bit halves are split through the double view).
+  static float reduce_add(Float a) {
+    __m256 low = _mm512_castps512_ps256(a);
+    __m256 high = _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(a), 1));
+    __m256 half = _mm256_add_ps(low, high);
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(half), _mm256_extractf128_ps(half, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+  }
+};
+
+} // namespace
+
+void sph_density_pass_avx512(SphPassArguments const& args, size_t begin, size_t end) {
+  density_pass<Avx512>(args, begin, end);
+}
+
+void sph_force_pass_avx512(SphPassArguments const& args, size_t begin, size_t end) {
+  force_pass<Avx512>(args, begin, end);
+}
+
+#endif
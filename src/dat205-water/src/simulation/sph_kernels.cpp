@@ -0,0 +1,50 @@
+#include "simulation/sph_kernels.hpp"
+
+#include <cmath>
+
+SphKernelConstants make_sph_kernel_constants(float support_radius) {
+  const float h = support_radius;
+
+  SphKernelConstants k;
+  k.h = h;
+  k.h2 = h * h;
+  k.poly6 = 315.0f / (64.0f * M_PIf * powf(h, 9.0f));
+  k.poly6_gradient = -945.0f / (32.0f * M_PIf * powf(h, 9.0f));
+  k.spiky_gradient = -45.0f / (M_PIf * powf(h, 6.0f));
+  k.viscosity_laplacian = 45.0f / (M_PIf * powf(h, 6.0f));
+  return k;
+}
+
+AnalyticSphKernels make_analytic_sph_kernels(SphKernelConstants const& k) {
+  AnalyticSphKernels kernels;
+  kernels.poly6 = Poly6Kernel(k);
+  kernels.spiky = SpikyKernel(k);
+  kernels.viscosity = ViscosityKernel(k);
+  return kernels;
+}
+
+TabulatedPoly6Kernel::TabulatedPoly6Kernel(SphKernelConstants const& k, unsigned int samples) {
+  Poly6Kernel kernel(k);
+  m_value = KernelTable(k.h2, samples, [&](float r2) { return kernel.value(r2); });
+  m_gradient_scale = KernelTable(k.h2, samples, [&](float r2) { return kernel.gradient_scale(r2); });
+  m_laplacian = KernelTable(k.h2, samples, [&](float r2) { return kernel.laplacian(r2); });
+}
+
+TabulatedSpikyKernel::TabulatedSpikyKernel(SphKernelConstants const& k, unsigned int samples)
+  : m_h2(k.h2) {
+  SpikyKernel kernel(k);
+  m_gradient_length = KernelTable(k.h2, samples, [&](float r2) { return kernel.gradient_length(r2); });
+}
+
+TabulatedViscosityKernel::TabulatedViscosityKernel(SphKernelConstants const& k, unsigned int samples) {
+  ViscosityKernel kernel(k);
+  m_laplacian = KernelTable(k.h2, samples, [&](float r2) { return kernel.laplacian(r2); });
+}
+
+TabulatedSphKernels make_tabulated_sph_kernels(SphKernelConstants const& k, unsigned int samples) {
+  TabulatedSphKernels kernels;
+  kernels.poly6 = TabulatedPoly6Kernel(k, samples);
+  kernels.spiky = TabulatedSpikyKernel(k, samples);
+  kernels.viscosity = TabulatedViscosityKernel(k, samples);
+  return kernels;
+}
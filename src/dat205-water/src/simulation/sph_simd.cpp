@@ -0,0 +1,76 @@
+#include "simulation/sph_simd.hpp"
+
+#include <cassert>
+
+SimdLevel detect_simd_level() {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  __builtin_cpu_init();
+
+  #ifdef SPH_AVX512_AVAILABLE
+  if (__builtin_cpu_supports("avx512f")) {
+    return SimdLevel::AVX512;
+  }
+  #endif
+
+  #ifdef SPH_AVX2_AVAILABLE
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return SimdLevel::AVX2;
+  }
+  #endif
+#endif
+
+  return SimdLevel::SCALAR;
+}
+
+const char* simd_level_name(SimdLevel level) {
+  switch (level) {
+    case SimdLevel::AVX512: return "AVX-512";
+    case SimdLevel::AVX2:   return "AVX2";
+    default:                return "scalar";
+  }
+}
+
+void sph_density_pass(SimdLevel level, SphPassArguments const& args, size_t begin, size_t end) {
+  switch (level) {
+#ifdef SPH_AVX512_AVAILABLE
+    case SimdLevel::AVX512: sph_density_pass_avx512(args, begin, end); break;
+#endif
+#ifdef SPH_AVX2_AVAILABLE
+    case SimdLevel::AVX2: sph_density_pass_avx2(args, begin, end); break;
+#endif
+    default: assert(false);
+  }
+}
+
+void sph_force_pass(SimdLevel level, SphPassArguments const& args, size_t begin, size_t end) {
+  switch (level) {
+#ifdef SPH_AVX512_AVAILABLE
+    case SimdLevel::AVX512: sph_force_pass_avx512(args, begin, end); break;
+#endif
+#ifdef SPH_AVX2_AVAILABLE
+    case SimdLevel::AVX2: sph_force_pass_avx2(args, begin, end); break;
+#endif
+    default: assert(false);
+  }
+}
+
+SphPassArguments::SphPassArguments(ParticleArrays& particles,
+                                   NeighborList const& neighbors,
+                                   SphKernelConstants const& kernels,
+                                   WaterSimulationParameters const& parameters)
+  : x(particles.x.data()),
+    y(particles.y.data()),
+    z(particles.z.data()),
+    vx(particles.vx.data()),
+    vy(particles.vy.data()),
+    vz(particles.vz.data()),
+    density(particles.density.data()),
+    pressure(particles.pressure.data()),
+    fx(particles.fx.data()),
+    fy(particles.fy.data()),
+    fz(particles.fz.data()),
+    neighbor_offsets(neighbors.offsets()),
+    neighbor_indices(neighbors.indices()),
+    particle_indices(nullptr),
+    kernels(kernels),
+    parameters(parameters) {}
@@ -0,0 +1,195 @@
+#pragma once
+
+// Width-independent implementation of the vectorized SPH passes.
+//
+// Each instruction set provides a small wrapper `V` with the vector types and operations used below,
+// and includes this file from a translation unit that is compiled for that instruction set.
+// Everything is kept in an anonymous namespace and no inline functions from other headers are called,
+// so the linker can never pick one of these copies for code that runs on an older CPU.
+
+#include "simulation/sph_simd.hpp"
+
+#include <cmath>
+
+namespace {
+
+// Calls `f(indices, lanes)` for each batch of `V::width` neighbors of particle `self`.
+// The last batch is padded with `self` (so every gather stays in bounds) and masked by `lanes`.
+template<typename V, typename F>
+void for_each_neighbor_batch(SphPassArguments const& args, unsigned int self, F f) {
+  unsigned int const* j = args.neighbor_indices + args.neighbor_offsets[self];
+  unsigned int remaining = args.neighbor_offsets[self + 1] - args.neighbor_offsets[self];
+
+  for (; remaining >= V::width; j += V::width, remaining -= V::width) {
+    f(V::load_indices(j), V::all_lanes());
+  }
+
+  if (remaining > 0) {
+    unsigned int padded[V::width];
+    for (unsigned int k = 0; k < V::width; k++) {
+      padded[k] = k < remaining ? j[k] : self;
+    }
+    f(V::load_indices(padded), V::first_lanes(remaining));
+  }
+}
+
+// See `CpuWaterSimulation::update_particles_data`.
+template<typename V>
+void density_pass(SphPassArguments const& args, size_t begin, size_t end) {
+  typedef typename V::Float Float;
+  typedef typename V::Index Index;
+  typedef typename V::Mask Mask;
+
+  float const* x = args.x;
+  float const* y = args.y;
+  float const* z = args.z;
+
+  const SphKernelConstants& k = args.kernels;
+  const Float h2 = V::set1(k.h2);
+
+  for (size_t n = begin; n < end; n++) {
+    const size_t i = args.particle_indices ? args.particle_indices[n] : n;
+    const Float xi = V::set1(x[i]);
+    const Float yi = V::set1(y[i]);
+    const Float zi = V::set1(z[i]);
+
+    Float sum = V::zero();
+    for_each_neighbor_batch<V>(args, i, [&](Index j, Mask lanes) {
+      Float dx = V::sub(xi, V::gather(x, j));
+      Float dy = V::sub(yi, V::gather(y, j));
+      Float dz = V::sub(zi, V::gather(z, j));
+      Float r2 = V::add(V::add(V::mul(dx, dx), V::mul(dy, dy)), V::mul(dz, dz));
+
+      // (h^2 - r^2)^3 vanishes outside the support radius once clamped at zero.
+      Float q = V::max(V::sub(h2, r2), V::zero());
+      sum = V::add(sum, V::select(lanes, V::mul(V::mul(q, q), q), V::zero()));
+    });
+
+    // The particle itself contributes h^6 (eq 4.6).
+    float density = args.parameters.particle_mass * k.poly6 * (k.h2 * k.h2 * k.h2 + V::reduce_add(sum));
+    args.density[i] = density;
+    args.pressure[i] = args.parameters.gass_stiffness * (density - args.parameters.rest_density);
+  }
+}
+
+// See `CpuWaterSimulation::update_force`.
+// All four neighbor sums (pressure, viscosity, surface normal and color field laplacian) share one sweep.
+template<typename V>
+void force_pass(SphPassArguments const& args, size_t begin, size_t end) {
+  typedef typename V::Float Float;
+  typedef typename V::Index Index;
+  typedef typename V::Mask Mask;
+
+  float const* x = args.x;
+  float const* y = args.y;
+  float const* z = args.z;
+  float const* vx = args.vx;
+  float const* vy = args.vy;
+  float const* vz = args.vz;
+  float const* density = args.density;
+  float const* pressure = args.pressure;
+
+  const SphKernelConstants& k = args.kernels;
+  const WaterSimulationParameters& params = args.parameters;
+
+  const Float zero = V::zero();
+  const Float one = V::set1(1.0f);
+  const Float minus_one = V::set1(-1.0f);
+  const Float h = V::set1(k.h);
+  const Float h2 = V::set1(k.h2);
+  const Float three_h2 = V::set1(3.0f * k.h2);
+  const Float seven = V::set1(7.0f);
+  const Float min_distance = V::set1(1e-3f);
+  const Float mass = V::set1(params.particle_mass);
+  const Float spiky = V::set1(k.spiky_gradient);
+  const Float viscosity = V::set1(k.viscosity_laplacian);
+  const Float poly6_gradient = V::set1(k.poly6_gradient);
+
+  for (size_t n = begin; n < end; n++) {
+    const size_t i = args.particle_indices ? args.particle_indices[n] : n;
+    const Float xi = V::set1(x[i]);
+    const Float yi = V::set1(y[i]);
+    const Float zi = V::set1(z[i]);
+    const Float vxi = V::set1(vx[i]);
+    const Float vyi = V::set1(vy[i]);
+    const Float vzi = V::set1(vz[i]);
+    const Float pressure_term_i = V::set1(pressure[i] / (density[i] * density[i]));
+
+    Float pressure_x = zero, pressure_y = zero, pressure_z = zero;
+    Float viscosity_x = zero, viscosity_y = zero, viscosity_z = zero;
+    Float normal_x = zero, normal_y = zero, normal_z = zero;
+    Float laplacian = zero;
+
+    for_each_neighbor_batch<V>(args, i, [&](Index j, Mask lanes) {
+      Float dx = V::sub(xi, V::gather(x, j));
+      Float dy = V::sub(yi, V::gather(y, j));
+      Float dz = V::sub(zi, V::gather(z, j));
+      Float r2 = V::add(V::add(V::mul(dx, dx), V::mul(dy, dy)), V::mul(dz, dz));
+      Float r = V::sqrt(r2);
+
+      Mask inside = V::mask_and(lanes, V::less(r2, h2));
+
+      Float density_j = V::gather(density, j);
+      Float mass_over_density_j = V::div(mass, density_j);
+      Float h_minus_r = V::sub(h, r);
+      Float q = V::sub(h2, r2);
+
+      // Pressure (eq 4.10, 4.14). Nearly coinciding particles are pushed apart along the sign vector.
+      Mask coinciding = V::less(r, min_distance);
+      Float inv_r = V::div(one, r);
+      Float dir_x = V::select(coinciding, V::select(V::greater(dx, zero), one, minus_one), V::mul(dx, inv_r));
+      Float dir_y = V::select(coinciding, V::select(V::greater(dy, zero), one, minus_one), V::mul(dy, inv_r));
+      Float dir_z = V::select(coinciding, V::select(V::greater(dz, zero), one, minus_one), V::mul(dz, inv_r));
+
+      Float pressure_term_j = V::div(V::gather(pressure, j), V::mul(density_j, density_j));
+      Float pressure_coef = V::mul(V::mul(mass, V::add(pressure_term_i, pressure_term_j)), V::mul(spiky, V::mul(h_minus_r, h_minus_r)));
+      pressure_coef = V::select(inside, pressure_coef, zero);
+      pressure_x = V::add(pressure_x, V::mul(pressure_coef, dir_x));
+      pressure_y = V::add(pressure_y, V::mul(pressure_coef, dir_y));
+      pressure_z = V::add(pressure_z, V::mul(pressure_coef, dir_z));
+
+      // Viscosity (eq 4.17, 4.22)
+      Float viscosity_coef = V::select(inside, V::mul(mass_over_density_j, V::mul(viscosity, h_minus_r)), zero);
+      viscosity_x = V::add(viscosity_x, V::mul(V::sub(V::gather(vx, j), vxi), viscosity_coef));
+      viscosity_y = V::add(viscosity_y, V::mul(V::sub(V::gather(vy, j), vyi), viscosity_coef));
+      viscosity_z = V::add(viscosity_z, V::mul(V::sub(V::gather(vz, j), vzi), viscosity_coef));
+
+      // Inward surface normal (eq 4.28) and color field laplacian (eq 4.26)
+      Float gradient_coef = V::select(inside, V::mul(mass_over_density_j, V::mul(poly6_gradient, q)), zero);
+      Float normal_coef = V::mul(gradient_coef, q);
+      normal_x = V::add(normal_x, V::mul(normal_coef, dx));
+      normal_y = V::add(normal_y, V::mul(normal_coef, dy));
+      normal_z = V::add(normal_z, V::mul(normal_coef, dz));
+      laplacian = V::add(laplacian, V::mul(gradient_coef, V::sub(three_h2, V::mul(seven, r2))));
+    });
+
+    const float density_i = density[i];
+
+    // Pressure and viscosity
+    float fx = -density_i * V::reduce_add(pressure_x) + params.viscosity * V::reduce_add(viscosity_x);
+    float fy = -density_i * V::reduce_add(pressure_y) + params.viscosity * V::reduce_add(viscosity_y);
+    float fz = -density_i * V::reduce_add(pressure_z) + params.viscosity * V::reduce_add(viscosity_z);
+
+    // Gravity
+    fy += density_i * params.g;
+
+    // Surface tension
+    float nx = V::reduce_add(normal_x);
+    float ny = V::reduce_add(normal_y);
+    float nz = V::reduce_add(normal_z);
+    float normal_dist = sqrtf(nx * nx + ny * ny + nz * nz);
+    if (normal_dist >= params.l_threshold) {
+      float total_laplacian = (params.particle_mass / density_i) * k.poly6_gradient * k.h2 * 3.0f * k.h2 + V::reduce_add(laplacian);
+      float scale = -params.surface_tension * total_laplacian / normal_dist;
+      fx += scale * nx;
+      fy += scale * ny;
+      fz += scale * nz;
+    }
+
+    args.fx[i] = fx;
+    args.fy[i] = fy;
+    args.fz[i] = fz;
+  }
+}
+
+} // namespace
@@ -0,0 +1,505 @@
+#include "simulation/surface_reconstruction.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+using namespace optix;
+
+// Corner i of a cell is at offset (i & 1, (i >> 1) & 1, (i >> 2) & 1) from the cell's first node.
+// Edge e runs along axis e / 4, from corner EDGE_CORNERS[e][0] to corner EDGE_CORNERS[e][1].
+static const int EDGE_CORNERS[12][2] = {
+  {0, 1}, {2, 3}, {4, 5}, {6, 7}, // x
+  {0, 2}, {1, 3}, {4, 6}, {5, 7}, // y
+  {0, 4}, {1, 5}, {2, 6}, {3, 7}, // z
+};
+
+// The corners of each face of a cell, counter-clockwise seen from outside the cell.
+static const int FACE_CORNERS[6][4] = {
+  {0, 4, 6, 2}, // -x
+  {1, 3, 7, 5}, // +x
+  {0, 1, 5, 4}, // -y
+  {2, 6, 7, 3}, // +y
+  {0, 2, 3, 1}, // -z
+  {4, 5, 7, 6}, // +z
+};
+
+// As for the classic table, no case needs more than 5 triangles.
+static const int MAX_CELL_TRIANGLES = 5;
+
+static int edge_between(int a, int b) {
+  for (int e = 0; e < 12; e++) {
+    if ((EDGE_CORNERS[e][0] == a && EDGE_CORNERS[e][1] == b) || (EDGE_CORNERS[e][0] == b && EDGE_CORNERS[e][1] == a)) {
+      return e;
+    }
+  }
+  return -1;
+}
+
+// The triangles of each of the 256 marching cubes cases (bit i is set if corner i is inside the water).
+//
+// Rather than spelling out the classic table, it is derived from the cube's faces: on every face, each run
+// of inside corners is cut off by a segment between the two crossed edges that surround it. Two diagonal
+// inside corners are therefore always kept apart, which both cells sharing the face agree on, so there are
+// no holes between cells. The segments of all faces join into closed loops that are fanned into triangles.
+struct TriangleTable {
+  unsigned char counts[256];
+  unsigned char edges[256][3 * MAX_CELL_TRIANGLES];
+
+  TriangleTable() {
+    for (int c = 0; c < 256; c++) {
+      int next[12];
+      std::fill(next, next + 12, -1);
+
+      auto inside = [&](int corner) { return ((c >> corner) & 1) != 0; };
+
+      for (int f = 0; f < 6; f++) {
+        int const* corners = FACE_CORNERS[f];
+
+        for (int i = 0; i < 4; i++) {
+          int prev = corners[(i + 3) % 4];
+          if (!inside(corners[i]) || inside(prev)) {
+            continue;
+          }
+
+          // Walk to the end of the run of inside corners that starts at i.
+          int j = i;
+          while (inside(corners[(j + 1) % 4])) {
+            j = (j + 1) % 4;
+          }
+          next[edge_between(prev, corners[i])] = edge_between(corners[j], corners[(j + 1) % 4]);
+        }
+      }
+
+      // Every crossed edge ends one segment and starts another, so following them visits closed loops.
+      // Their orientation makes the triangles counter-clockwise seen from outside the water.
+      counts[c] = 0;
+      bool visited[12] = {};
+      for (int e = 0; e < 12; e++) {
+        if (next[e] == -1 || visited[e]) {
+          continue;
+        }
+
+        int loop[12];
+        int length = 0;
+        for (int l = e; !visited[l]; l = next[l]) {
+          visited[l] = true;
+          loop[length++] = l;
+        }
+
+        for (int k = 1; k + 1 < length; k++) {
+          unsigned char* triangle = edges[c] + 3 * counts[c]++;
+          triangle[0] = loop[0];
+          triangle[1] = loop[k];
+          triangle[2] = loop[k + 1];
+        }
+      }
+    }
+  }
+};
+
+static TriangleTable const& triangle_table() {
+  static const TriangleTable table;
+  return table;
+}
+
+// Rounds towards negative infinity, unlike integer division.
+static int floor_div(int a, int b) {
+  return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+SurfaceReconstructionParameters create_surface_reconstruction_parameters(float particle_radius) {
+  SurfaceReconstructionParameters params;
+  params.voxel_size = particle_radius;
+  params.smoothing_radius = 4.0f * particle_radius; // Reaches the nearest neighbors in every direction.
+  params.particle_volume = powf(2.0f * particle_radius, 3.0f);
+  params.iso_value = 0.5f; // Halfway between water and air.
+  return params;
+}
+
+SurfaceReconstructor::SurfaceReconstructor(unsigned int thread_count)
+  : m_pool(thread_count),
+    m_parameters(create_surface_reconstruction_parameters(0.0135f)),
+    m_active_blocks(0) {}
+
+SurfaceReconstructionParameters const& SurfaceReconstructor::parameters() const {
+  return m_parameters;
+}
+
+void SurfaceReconstructor::set_parameters(SurfaceReconstructionParameters const& parameters) {
+  m_parameters = parameters;
+}
+
+void SurfaceReconstructor::reconstruct(std::vector<Particle> const& particles, SurfaceMesh& mesh) {
+  mesh.vertices.clear();
+  mesh.indices.clear();
+  m_active_blocks = 0;
+
+  if (particles.empty()) {
+    return;
+  }
+
+  sort_particles(particles);
+  activate_blocks();
+
+  // Vertices first, since triangles may refer to vertices owned by the next blocks.
+  m_pool.parallel_for(m_blocks.size(), [&](size_t begin, size_t end) {
+    for (size_t b = begin; b < end; b++) {
+      evaluate_field(m_blocks[b]);
+      create_vertices(m_blocks[b]);
+    }
+  });
+
+  unsigned int vertex_count = 0;
+  for (Block& block : m_blocks) {
+    block.vertex_offset = vertex_count;
+    vertex_count += block.vertices.size();
+  }
+
+  m_pool.parallel_for(m_blocks.size(), [&](size_t begin, size_t end) {
+    for (size_t b = begin; b < end; b++) {
+      create_triangles(m_blocks[b]);
+    }
+  });
+
+  unsigned int index_count = 0;
+  for (Block& block : m_blocks) {
+    block.index_offset = index_count;
+    index_count += block.indices.size();
+  }
+
+  // Concatenate the blocks (in block order, so the mesh does not depend on the thread count).
+  mesh.vertices.resize(vertex_count);
+  mesh.indices.resize(index_count);
+  m_pool.parallel_for(m_blocks.size(), [&](size_t begin, size_t end) {
+    for (size_t b = begin; b < end; b++) {
+      Block const& block = m_blocks[b];
+      std::copy(block.vertices.begin(), block.vertices.end(), mesh.vertices.begin() + block.vertex_offset);
+      std::copy(block.indices.begin(), block.indices.end(), mesh.indices.begin() + block.index_offset);
+    }
+  });
+}
+
+size_t SurfaceReconstructor::active_block_count() const {
+  return m_active_blocks;
+}
+
+size_t SurfaceReconstructor::memory_usage() const {
+  size_t bytes = m_bin_start.capacity() * sizeof(unsigned int) +
+                 m_sorted_positions.capacity() * sizeof(float3) +
+                 m_blocks.capacity() * sizeof(Block);
+
+  for (Block const& block : m_blocks) {
+    bytes += block.values.capacity() * sizeof(float) +
+             block.gradients.capacity() * sizeof(float3) +
+             block.edge_vertices.capacity() * sizeof(int) +
+             block.vertices.capacity() * sizeof(VertexData) +
+             block.indices.capacity() * sizeof(unsigned int);
+  }
+  return bytes;
+}
+
+void SurfaceReconstructor::sort_particles(std::vector<Particle> const& particles) {
+  const float block_size = BLOCK_CELLS * m_parameters.voxel_size;
+
+  // Counting sort by block, keeping the particles of each block in their original order.
+  std::vector<unsigned int> particle_bins(particles.size());
+  m_particle_bins.clear();
+  m_bin_start.clear();
+
+  for (size_t i = 0; i < particles.size(); i++) {
+    float3 p = particles[i].position;
+    int3 coord = make_int3(int(floorf(p.x / block_size)), int(floorf(p.y / block_size)), int(floorf(p.z / block_size)));
+
+    auto bin = m_particle_bins.emplace(block_key(coord), (unsigned int) m_bin_start.size());
+    if (bin.second) {
+      m_bin_start.push_back(0);
+    }
+    particle_bins[i] = bin.first->second;
+    m_bin_start[bin.first->second]++;
+  }
+
+  unsigned int offset = 0;
+  for (unsigned int& start : m_bin_start) {
+    unsigned int count = start;
+    start = offset;
+    offset += count;
+  }
+  m_bin_start.push_back(offset);
+
+  std::vector<unsigned int> fill(m_bin_start.begin(), m_bin_start.end() - 1);
+  m_sorted_positions.resize(particles.size());
+  for (size_t i = 0; i < particles.size(); i++) {
+    m_sorted_positions[fill[particle_bins[i]]++] = particles[i].position;
+  }
+}
+
+void SurfaceReconstructor::activate_blocks() {
+  const float h = m_parameters.smoothing_radius;
+  const float voxel = m_parameters.voxel_size;
+
+  // A block is active if any of its nodes (including the ones it shares with the next blocks) is within
+  // the smoothing radius of a particle. That is the case for every node with a non-zero field, so a crossed
+  // edge is never owned by an inactive block.
+  std::vector<int3> coords;
+  for (size_t bin = 0; bin + 1 < m_bin_start.size(); bin++) {
+    float3 lo = m_sorted_positions[m_bin_start[bin]];
+    float3 hi = lo;
+    for (unsigned int i = m_bin_start[bin] + 1; i < m_bin_start[bin + 1]; i++) {
+      lo = fminf(lo, m_sorted_positions[i]);
+      hi = fmaxf(hi, m_sorted_positions[i]);
+    }
+
+    int3 first = make_int3(floor_div(int(ceilf((lo.x - h) / voxel)) - 1, BLOCK_CELLS),
+                           floor_div(int(ceilf((lo.y - h) / voxel)) - 1, BLOCK_CELLS),
+                           floor_div(int(ceilf((lo.z - h) / voxel)) - 1, BLOCK_CELLS));
+    int3 last = make_int3(floor_div(int(floorf((hi.x + h) / voxel)), BLOCK_CELLS),
+                          floor_div(int(floorf((hi.y + h) / voxel)), BLOCK_CELLS),
+                          floor_div(int(floorf((hi.z + h) / voxel)), BLOCK_CELLS));
+
+    for (int z = first.z; z <= last.z; z++) {
+      for (int y = first.y; y <= last.y; y++) {
+        for (int x = first.x; x <= last.x; x++) {
+          int3 coord = make_int3(x, y, z);
+          if (m_block_indices.emplace(block_key(coord), 0).second) {
+            coords.push_back(coord);
+          }
+        }
+      }
+    }
+  }
+
+  // Sorted so that the mesh only depends on the particles.
+  std::sort(coords.begin(), coords.end(), [](int3 const& a, int3 const& b) {
+    if (a.z != b.z) return a.z < b.z;
+    if (a.y != b.y) return a.y < b.y;
+    return a.x < b.x;
+  });
+
+  m_blocks.resize(coords.size());
+  for (size_t b = 0; b < coords.size(); b++) {
+    m_blocks[b].coord = coords[b];
+    m_block_indices[block_key(coords[b])] = b;
+  }
+  for (Block& block : m_blocks) {
+    for (int i = 0; i < 8; i++) {
+      block.forward[i] = find_block(make_int3(block.coord.x + (i & 1), block.coord.y + ((i >> 1) & 1), block.coord.z + ((i >> 2) & 1)));
+    }
+  }
+
+  m_block_indices.clear();
+  m_active_blocks = m_blocks.size();
+}
+
+void SurfaceReconstructor::evaluate_field(Block& block) const {
+  const float h = m_parameters.smoothing_radius;
+  const float h2 = h * h;
+  const float voxel = m_parameters.voxel_size;
+  const float iso = m_parameters.iso_value;
+  const int block_reach = int(h / (BLOCK_CELLS * voxel)) + 1;
+
+  // Poly6 kernel (as for the density), weighted by the particle volume.
+  const float scale = float(m_parameters.particle_volume * 315.0 / (64.0 * M_PI * pow(h, 9.0)));
+
+  block.values.assign(BLOCK_NODES * BLOCK_NODES * BLOCK_NODES, 0.0f);
+  block.gradients.assign(BLOCK_NODES * BLOCK_NODES * BLOCK_NODES, make_float3(0.0f));
+
+  int3 first = make_int3(block.coord.x * BLOCK_CELLS, block.coord.y * BLOCK_CELLS, block.coord.z * BLOCK_CELLS);
+
+  // Nodes on block boundaries are evaluated by every block that has them. Visiting the particles in the
+  // same global order (by block, then by index) makes all of them arrive at bitwise identical values.
+  for (int bz = -block_reach; bz <= block_reach; bz++) {
+    for (int by = -block_reach; by <= block_reach; by++) {
+      for (int bx = -block_reach; bx <= block_reach; bx++) {
+        auto bin = m_particle_bins.find(block_key(make_int3(block.coord.x + bx, block.coord.y + by, block.coord.z + bz)));
+        if (bin == m_particle_bins.end()) {
+          continue;
+        }
+
+        for (unsigned int i = m_bin_start[bin->second]; i < m_bin_start[bin->second + 1]; i++) {
+          float3 p = m_sorted_positions[i];
+
+          int x0 = std::max(first.x, int(ceilf((p.x - h) / voxel)));
+          int y0 = std::max(first.y, int(ceilf((p.y - h) / voxel)));
+          int z0 = std::max(first.z, int(ceilf((p.z - h) / voxel)));
+          int x1 = std::min(first.x + BLOCK_CELLS, int(floorf((p.x + h) / voxel)));
+          int y1 = std::min(first.y + BLOCK_CELLS, int(floorf((p.y + h) / voxel)));
+          int z1 = std::min(first.z + BLOCK_CELLS, int(floorf((p.z + h) / voxel)));
+
+          for (int z = z0; z <= z1; z++) {
+            float dz = z * voxel - p.z;
+
+            for (int y = y0; y <= y1; y++) {
+              float dy = y * voxel - p.y;
+              float dyz2 = dy * dy + dz * dz;
+              if (h2 <= dyz2) {
+                continue;
+              }
+
+              int row = ((z - first.z) * BLOCK_NODES + (y - first.y)) * BLOCK_NODES - first.x;
+              for (int x = x0; x <= x1; x++) {
+                float dx = x * voxel - p.x;
+                float r2 = dx * dx + dyz2;
+                if (h2 <= r2) {
+                  continue;
+                }
+
+                float q = h2 - r2;
+                float g = -6.0f * scale * q * q;
+                block.values[row + x] += scale * q * q * q;
+                block.gradients[row + x] += make_float3(g * dx, g * dy, g * dz);
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+
+  bool any_inside = false;
+  bool any_outside = false;
+  for (float value : block.values) {
+    any_inside |= iso < value;
+    any_outside |= value <= iso;
+  }
+  block.has_surface = any_inside && any_outside;
+}
+
+void SurfaceReconstructor::create_vertices(Block& block) const {
+  const float voxel = m_parameters.voxel_size;
+  const float iso = m_parameters.iso_value;
+  const int strides[3] = { 1, BLOCK_NODES, BLOCK_NODES * BLOCK_NODES };
+
+  block.edge_vertices.assign(BLOCK_CELLS * BLOCK_CELLS * BLOCK_CELLS * 3, -1);
+  block.vertices.clear();
+
+  if (!block.has_surface) {
+    return;
+  }
+
+  for (int z = 0; z < BLOCK_CELLS; z++) {
+    for (int y = 0; y < BLOCK_CELLS; y++) {
+      for (int x = 0; x < BLOCK_CELLS; x++) {
+        int n = (z * BLOCK_NODES + y) * BLOCK_NODES + x;
+
+        for (int axis = 0; axis < 3; axis++) {
+          int m = n + strides[axis];
+          float a = block.values[n];
+          float b = block.values[m];
+          if ((iso < a) == (iso < b)) {
+            continue;
+          }
+
+          float t = (iso - a) / (b - a);
+          float3 node = make_float3(float(block.coord.x * BLOCK_CELLS + x),
+                                    float(block.coord.y * BLOCK_CELLS + y),
+                                    float(block.coord.z * BLOCK_CELLS + z));
+          float3 offset = make_float3(axis == 0 ? t : 0.0f, axis == 1 ? t : 0.0f, axis == 2 ? t : 0.0f);
+
+          // The field decreases out of the water.
+          float3 gradient = block.gradients[n] + t * (block.gradients[m] - block.gradients[n]);
+          float3 normal = dot(gradient, gradient) > 0.0f ? normalize(-gradient) : make_float3(0.0f, 1.0f, 0.0f);
+          float3 up = fabsf(normal.y) < 0.99f ? make_float3(0.0f, 1.0f, 0.0f) : make_float3(1.0f, 0.0f, 0.0f);
+
+          VertexData v;
+          v.position = (node + offset) * voxel;
+          v.normal = normal;
+          v.tangent = normalize(cross(up, normal));
+          v.uv = make_float3(0.0f);
+
+          block.edge_vertices[3 * ((z * BLOCK_CELLS + y) * BLOCK_CELLS + x) + axis] = block.vertices.size();
+          block.vertices.push_back(v);
+        }
+      }
+    }
+  }
+}
+
+void SurfaceReconstructor::create_triangles(Block& block) const {
+  TriangleTable const& table = triangle_table();
+  const float iso = m_parameters.iso_value;
+
+  block.indices.clear();
+
+  if (!block.has_surface) {
+    return;
+  }
+
+  for (int z = 0; z < BLOCK_CELLS; z++) {
+    for (int y = 0; y < BLOCK_CELLS; y++) {
+      for (int x = 0; x < BLOCK_CELLS; x++) {
+        int c = 0;
+        for (int corner = 0; corner < 8; corner++) {
+          int n = ((z + ((corner >> 2) & 1)) * BLOCK_NODES + y + ((corner >> 1) & 1)) * BLOCK_NODES + x + (corner & 1);
+          c |= (iso < block.values[n]) << corner;
+        }
+
+        for (int t = 0; t < table.counts[c]; t++) {
+          unsigned int triangle[3];
+          bool valid = true;
+
+          for (int k = 0; k < 3; k++) {
+            int e = table.edges[c][3 * t + k];
+            int corner = EDGE_CORNERS[e][0];
+            int nx = x + (corner & 1);
+            int ny = y + ((corner >> 1) & 1);
+            int nz = z + ((corner >> 2) & 1);
+
+            // Edges that start on the far faces belong to the next blocks.
+            int owner = block.forward[(nx == BLOCK_CELLS) | (ny == BLOCK_CELLS) << 1 | (nz == BLOCK_CELLS) << 2];
+            if (owner < 0) {
+              valid = false;
+              break;
+            }
+
+            Block const& o = m_blocks[owner];
+            int v = o.edge_vertices[3 * (((nz % BLOCK_CELLS) * BLOCK_CELLS + ny % BLOCK_CELLS) * BLOCK_CELLS + nx % BLOCK_CELLS) + e / 4];
+            if (v < 0) {
+              valid = false;
+              break;
+            }
+            triangle[k] = o.vertex_offset + v;
+          }
+
+          if (valid) {
+            block.indices.insert(block.indices.end(), triangle, triangle + 3);
+          }
+        }
+      }
+    }
+  }
+}
+
+int SurfaceReconstructor::find_block(int3 coord) const {
+  auto block = m_block_indices.find(block_key(coord));
+  return block == m_block_indices.end() ? -1 : int(block->second);
+}
+
+uint64_t SurfaceReconstructor::block_key(int3 coord) {
+  // 21 bits per coordinate, which covers about a million blocks in each direction.
+  const uint64_t mask = (1ull << 21) - 1;
+  return ((uint64_t) coord.x & mask) | (((uint64_t) coord.y & mask) << 21) | (((uint64_t) coord.z & mask) << 42);
+}
+
+bool write_obj(std::string const& path, SurfaceMesh const& mesh) {
+  std::ofstream file(path.c_str(), std::ios::trunc);
+
+  file << "# " << mesh.vertices.size() << " vertices, " << mesh.indices.size() / 3 << " triangles\n";
+  for (VertexData const& v : mesh.vertices) {
+    file << "v " << v.position.x << ' ' << v.position.y << ' ' << v.position.z << '\n';
+  }
+  for (VertexData const& v : mesh.vertices) {
+    file << "vn " << v.normal.x << ' ' << v.normal.y << ' ' << v.normal.z << '\n';
+  }
+
+  // OBJ indices start at 1.
+  for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+    unsigned int a = mesh.indices[i] + 1;
+    unsigned int b = mesh.indices[i + 1] + 1;
+    unsigned int c = mesh.indices[i + 2] + 1;
+    file << "f " << a << "//" << a << ' ' << b << "//" << b << ' ' << c << "//" << c << '\n';
+  }
+
+  file.flush();
+  return bool(file);
+}
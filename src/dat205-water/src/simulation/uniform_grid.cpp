@@ -0,0 +1,261 @@
+#include "simulation/uniform_grid.hpp"
+
+#include <algorithm>
+#include <mutex>
+
+using namespace optix;
+
+// Spare entries of a bucket that holds `size` particles after a build. Even empty buckets get one, as the
+// buckets next to the water are where particles usually move to.
+static unsigned int spare_entries(unsigned int size) {
+  return 1 + size / 4;
+}
+
+UniformGrid::UniformGrid()
+  : m_cell_size(1.0f),
+    m_bucket_count(1),
+    m_migration_count(0) {}
+
+void UniformGrid::build(ParticleArrays const& particles, float cell_size, ThreadPool& pool, uint8_t const* alive) {
+  m_cell_size = cell_size;
+
+  // Use the next prime of at least twice as many buckets as particles (eq 5.4).
+  const unsigned int bucket_count = next_prime(2 * std::max<size_t>(1, particles.size()));
+  m_bucket_count = bucket_count;
+
+  // Discretize every particle position.
+  m_particle_buckets.resize(particles.size());
+  m_particle_cells.resize(particles.size());
+
+  pool.parallel_for(particles.size(), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      m_particle_cells[i] = cell_position(particles.position(i));
+      m_particle_buckets[i] = alive && !alive[i] ? NO_BUCKET : hash(m_particle_cells[i]);
+    }
+  });
+
+  // Counting sort: histogram, exclusive prefix sum (including the spare entries) and scatter.
+  // These are single memory sweeps, so they are left on one thread.
+  m_migration_count = 0;
+  m_bucket_size.assign(bucket_count, 0);
+  for (unsigned int bucket : m_particle_buckets) {
+    if (bucket != NO_BUCKET) {
+      m_bucket_size[bucket]++;
+      m_migration_count++;
+    }
+  }
+
+  m_bucket_start.resize(bucket_count + 1);
+  m_bucket_start[0] = 0;
+  for (unsigned int b = 0; b < bucket_count; b++) {
+    m_bucket_start[b + 1] = m_bucket_start[b] + m_bucket_size[b] + spare_entries(m_bucket_size[b]);
+  }
+  m_sorted_cells.resize(m_bucket_start.back());
+  m_sorted_indices.resize(m_bucket_start.back());
+
+  // Scatter in particle order so that each bucket stays sorted by particle index.
+  // The sizes count up again while doing so.
+  std::fill(m_bucket_size.begin(), m_bucket_size.end(), 0);
+  for (unsigned int i = 0; i < particles.size(); i++) {
+    unsigned int bucket = m_particle_buckets[i];
+    if (bucket == NO_BUCKET) {
+      continue;
+    }
+
+    unsigned int slot = m_bucket_start[bucket] + m_bucket_size[bucket]++;
+    m_sorted_indices[slot] = i;
+    m_sorted_cells[slot] = m_particle_cells[i];
+  }
+}
+
+void UniformGrid::update(ParticleArrays const& particles, float cell_size, ThreadPool& pool, uint8_t const* alive) {
+  // Added particles are inserted into the existing buckets until there are as many particles as buckets,
+  // and the table is then sized for the new count.
+  if (cell_size != m_cell_size || particles.size() < m_particle_cells.size() || particles.size() > bucket_count() ||
+      m_bucket_start.empty()) {
+    build(particles, cell_size, pool, alive);
+    return;
+  }
+
+  // Particles appended since are not in any bucket yet.
+  m_particle_buckets.resize(particles.size(), (unsigned int) NO_BUCKET);
+  m_particle_cells.resize(particles.size());
+
+  // Find the particles that changed cells, or that were added or removed. Which chunk finds which particle
+  // depends on the thread count, but the order does not matter since every bucket is kept sorted.
+  std::mutex mutex;
+  std::vector<unsigned int> migrants;
+
+  pool.parallel_for(particles.size(), [&](size_t begin, size_t end) {
+    std::vector<unsigned int> local;
+    for (size_t i = begin; i < end; i++) {
+      bool live = !alive || alive[i];
+      bool listed = m_particle_buckets[i] != NO_BUCKET;
+      if (live != listed) {
+        local.push_back(i);
+      } else if (live) {
+        int3 cell = cell_position(particles.position(i));
+        int3 const& previous = m_particle_cells[i];
+        if (cell.x != previous.x || cell.y != previous.y || cell.z != previous.z) {
+          local.push_back(i);
+        }
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    migrants.insert(migrants.end(), local.begin(), local.end());
+  });
+
+  // Moving a particle shifts the rest of its buckets, so with many migrations sorting everything is cheaper.
+  if (migrants.size() > particles.size() / 4) {
+    build(particles, cell_size, pool, alive);
+    return;
+  }
+
+  m_migration_count = migrants.size();
+
+  // All particles leave before any arrive, so that a bucket only runs out of spare entries if it has to.
+  // Removed particles only leave.
+  std::vector<unsigned int> arrivals;
+  arrivals.reserve(migrants.size());
+  for (unsigned int i : migrants) {
+    if (m_particle_buckets[i] != NO_BUCKET) {
+      remove(i);
+    }
+
+    if (!alive || alive[i]) {
+      arrivals.push_back(i);
+    } else {
+      m_particle_buckets[i] = NO_BUCKET;
+    }
+  }
+
+  bool fits = true;
+  for (unsigned int i : arrivals) {
+    m_particle_cells[i] = cell_position(particles.position(i));
+    m_particle_buckets[i] = hash(m_particle_cells[i]);
+
+    unsigned int bucket = m_particle_buckets[i];
+    m_bucket_size[bucket]++;
+    fits = fits && m_bucket_start[bucket] + m_bucket_size[bucket] <= m_bucket_start[bucket + 1];
+  }
+  for (unsigned int i : arrivals) {
+    m_bucket_size[m_particle_buckets[i]]--;
+  }
+
+  // Water tends to move in layers, which can fill a row of buckets at once.
+  if (!fits) {
+    make_room(arrivals);
+  }
+
+  for (unsigned int i : arrivals) {
+    insert(i);
+  }
+}
+
+// Lays the buckets out again with fresh spare entries, as if `arrivals` had already been inserted.
+// This is a single sweep over the sorted entries and needs no hashing.
+void UniformGrid::make_room(std::vector<unsigned int> const& arrivals) {
+  for (unsigned int i : arrivals) {
+    m_bucket_size[m_particle_buckets[i]]++;
+  }
+
+  std::vector<unsigned int> bucket_start(m_bucket_start.size());
+  bucket_start[0] = 0;
+  for (unsigned int b = 0; b < bucket_count(); b++) {
+    bucket_start[b + 1] = bucket_start[b] + m_bucket_size[b] + spare_entries(m_bucket_size[b]);
+  }
+
+  for (unsigned int i : arrivals) {
+    m_bucket_size[m_particle_buckets[i]]--;
+  }
+
+  std::vector<unsigned int> sorted_indices(bucket_start.back());
+  std::vector<int3> sorted_cells(bucket_start.back());
+  for (unsigned int b = 0; b < bucket_count(); b++) {
+    unsigned int first = m_bucket_start[b];
+    unsigned int last = first + m_bucket_size[b];
+    std::copy(m_sorted_indices.begin() + first, m_sorted_indices.begin() + last, sorted_indices.begin() + bucket_start[b]);
+    std::copy(m_sorted_cells.begin() + first, m_sorted_cells.begin() + last, sorted_cells.begin() + bucket_start[b]);
+  }
+
+  m_bucket_start.swap(bucket_start);
+  m_sorted_indices.swap(sorted_indices);
+  m_sorted_cells.swap(sorted_cells);
+}
+
+void UniformGrid::remove(unsigned int particle_index) {
+  unsigned int bucket = m_particle_buckets[particle_index];
+  unsigned int* first = m_sorted_indices.data() + m_bucket_start[bucket];
+  unsigned int* last = first + m_bucket_size[bucket];
+  unsigned int slot = std::lower_bound(first, last, particle_index) - m_sorted_indices.data();
+
+  unsigned int end = m_bucket_start[bucket] + m_bucket_size[bucket];
+  std::copy(m_sorted_indices.begin() + slot + 1, m_sorted_indices.begin() + end, m_sorted_indices.begin() + slot);
+  std::copy(m_sorted_cells.begin() + slot + 1, m_sorted_cells.begin() + end, m_sorted_cells.begin() + slot);
+  m_bucket_size[bucket]--;
+}
+
+void UniformGrid::insert(unsigned int particle_index) {
+  unsigned int bucket = m_particle_buckets[particle_index];
+  unsigned int end = m_bucket_start[bucket] + m_bucket_size[bucket];
+  unsigned int* first = m_sorted_indices.data() + m_bucket_start[bucket];
+  unsigned int* last = m_sorted_indices.data() + end;
+  unsigned int slot = std::upper_bound(first, last, particle_index) - m_sorted_indices.data();
+
+  std::copy_backward(m_sorted_indices.begin() + slot, m_sorted_indices.begin() + end, m_sorted_indices.begin() + end + 1);
+  std::copy_backward(m_sorted_cells.begin() + slot, m_sorted_cells.begin() + end, m_sorted_cells.begin() + end + 1);
+  m_sorted_indices[slot] = particle_index;
+  m_sorted_cells[slot] = m_particle_cells[particle_index];
+  m_bucket_size[bucket]++;
+}
+
+unsigned int UniformGrid::bucket_count() const {
+  return m_bucket_count;
+}
+
+unsigned int next_prime(unsigned int n) {
+  for (n = std::max(n, 2u); ; n++) {
+    bool prime = true;
+    for (unsigned int d = 2; d * d <= n && prime; d++) {
+      prime = n % d != 0;
+    }
+    if (prime) {
+      return n;
+    }
+  }
+}
+
+// Buckets hold few particles, so the distinct cells of each are counted by comparing every pair.
+HashTableStatistics UniformGrid::statistics() const {
+  HashTableStatistics statistics;
+  statistics.buckets = m_bucket_start.empty() ? 0 : bucket_count();
+
+  for (unsigned int b = 0; b < m_bucket_size.size(); b++) {
+    unsigned int first = m_bucket_start[b];
+    unsigned int last = first + m_bucket_size[b];
+    if (first == last) {
+      continue;
+    }
+
+    statistics.occupied_buckets++;
+    for (unsigned int i = first; i < last; i++) {
+      int3 const& cell = m_sorted_cells[i];
+      unsigned int j = first;
+      while (j < i && (m_sorted_cells[j].x != cell.x || m_sorted_cells[j].y != cell.y || m_sorted_cells[j].z != cell.z)) {
+        j++;
+      }
+      statistics.occupied_cells += j == i;
+    }
+  }
+  return statistics;
+}
+
+size_t UniformGrid::memory_usage() const {
+  return m_particle_buckets.capacity() * sizeof(unsigned int)
+       + m_particle_cells.capacity() * sizeof(int3)
+       + m_bucket_start.capacity() * sizeof(unsigned int)
+       + m_bucket_size.capacity() * sizeof(unsigned int)
+       + m_sorted_indices.capacity() * sizeof(unsigned int)
+       + m_sorted_cells.capacity() * sizeof(int3);
+}
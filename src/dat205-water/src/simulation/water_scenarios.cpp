@@ -0,0 +1,261 @@
+#include "simulation/water_scenarios.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace optix;
+
+const char* water_scenario_name(WaterScenario scenario) {
+  switch (scenario) {
+    case WaterScenario::CENTER:       return "center";
+    case WaterScenario::CORNER:       return "corner";
+    case WaterScenario::SIDE:         return "side";
+    case WaterScenario::SPLIT_VORTEX: return "split-vortex";
+    case WaterScenario::FOUNTAIN:     return "fountain";
+    case WaterScenario::POUR:         return "pour";
+    default:                          return "unknown";
+  }
+}
+
+bool parse_water_scenario(std::string const& name, WaterScenario& scenario) {
+  const WaterScenario scenarios[] = {
+    WaterScenario::CENTER,
+    WaterScenario::CORNER,
+    WaterScenario::SIDE,
+    WaterScenario::SPLIT_VORTEX,
+    WaterScenario::FOUNTAIN,
+    WaterScenario::POUR,
+  };
+
+  for (WaterScenario s : scenarios) {
+    if (name == water_scenario_name(s)) {
+      scenario = s;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool water_scenario_has_emitters(WaterScenario scenario) {
+  return scenario == WaterScenario::FOUNTAIN || scenario == WaterScenario::POUR;
+}
+
+// Layers of particles in the initial pool of the fountain.
+static unsigned int fountain_pool_height(unsigned int side_length) {
+  return std::max(1u, side_length / 4);
+}
+
+std::vector<Particle> create_water_particles(WaterScenario scenario,
+                                             unsigned int side_length,
+                                             float particle_radius,
+                                             WaterBox const& box) {
+  // Particles along the y axis.
+  unsigned int height = side_length;
+  if (scenario == WaterScenario::FOUNTAIN) {
+    height = fountain_pool_height(side_length);
+  } else if (scenario == WaterScenario::POUR) {
+    height = 0;
+  }
+
+  std::vector<Particle> particles(side_length * height * side_length);
+
+  float diameter = 2.0f * particle_radius;
+  float3 offset = make_float3(0.0f);
+  float3 spacing = make_float3(diameter);
+
+  switch (scenario) {
+    // Center setup with no velocity.
+    case WaterScenario::CENTER:
+      offset = make_float3(0.0f, 1.0f, 0.0f) - make_float3((side_length / 2) * diameter);
+      break;
+
+    // Corner setup with no velocity.
+    case WaterScenario::CORNER:
+      offset = make_float3(-box.width + diameter, diameter, -box.depth + diameter);
+      break;
+
+    // Side setup with no velocity.
+    case WaterScenario::SIDE:
+      offset = make_float3(-box.width + diameter, diameter, -box.depth + diameter);
+      spacing = particle_radius * make_float3(1.0f, 1.0f, 3.5f);
+      break;
+
+    // Split cube by velocity (creates a vague vortex).
+    case WaterScenario::SPLIT_VORTEX:
+      offset = make_float3(0.0f, 0.5f, 0.0f) - make_float3((side_length / 2) * diameter);
+      break;
+
+    // Shallow pool on the floor, filled up by the nozzle.
+    case WaterScenario::FOUNTAIN:
+      offset = make_float3(-float(side_length / 2) * diameter, diameter, -float(side_length / 2) * diameter);
+      break;
+
+    // Empty, everything comes from the nozzle.
+    case WaterScenario::POUR:
+      break;
+  }
+
+  for (unsigned int x = 0; x < side_length; x++) {
+    for (unsigned int y = 0; y < height; y++) {
+      for (unsigned int z = 0; z < side_length; z++) {
+        Particle& p = particles[x * height * side_length + y * side_length + z];
+        p.position = offset + spacing * make_float3(x, y, z);
+        p.velocity = make_float3(0.0f);
+
+        if (scenario == WaterScenario::SPLIT_VORTEX) {
+          p.velocity = make_float3(0.0f, 0.0f, 5.0f * (p.position.x < 0.0f ? 1.0f : -1.0f));
+        }
+      }
+    }
+  }
+
+  return particles;
+}
+
+std::vector<WaterEmitter> create_water_emitters(WaterScenario scenario,
+                                                unsigned int side_length,
+                                                float particle_radius,
+                                                WaterBox const& box) {
+  std::vector<WaterEmitter> emitters;
+  float diameter = 2.0f * particle_radius;
+
+  WaterEmitter emitter;
+  emitter.radius = 3.0f * particle_radius;
+
+  switch (scenario) {
+    // Straight up from a little above the middle of the pool.
+    case WaterScenario::FOUNTAIN:
+      emitter.position = make_float3(0.0f, (fountain_pool_height(side_length) + 3) * diameter, 0.0f);
+      emitter.velocity = make_float3(0.0f, 2.5f, 0.0f);
+      emitters.push_back(emitter);
+      break;
+
+    // Slightly downwards, from high up next to the left wall.
+    case WaterScenario::POUR:
+      emitter.position = make_float3(-box.width + 4.0f * diameter, 0.7f * box.height, 0.0f);
+      emitter.velocity = make_float3(1.2f, -0.3f, 0.0f);
+      emitters.push_back(emitter);
+      break;
+
+    default:
+      break;
+  }
+
+  return emitters;
+}
+
+std::vector<WaterSink> create_water_sinks(WaterScenario scenario, float particle_radius, WaterBox const& box) {
+  std::vector<WaterSink> sinks;
+
+  // A drain in the floor of a corner, a few particles wide.
+  WaterSink sink;
+  float size = 8.0f * particle_radius;
+
+  switch (scenario) {
+    case WaterScenario::FOUNTAIN:
+      sink.min = make_float3(-box.width, 0.0f, -box.depth);
+      sink.max = make_float3(-box.width + size, size, -box.depth + size);
+      sinks.push_back(sink);
+      break;
+
+    case WaterScenario::POUR:
+      sink.min = make_float3(box.width - size, 0.0f, box.depth - size);
+      sink.max = make_float3(box.width, size, box.depth);
+      sinks.push_back(sink);
+      break;
+
+    default:
+      break;
+  }
+
+  return sinks;
+}
+
+WaterSimulationParameters create_water_simulation_parameters(unsigned int particles_count,
+                                                             float particle_radius,
+                                                             WaterBox const& box) {
+  WaterSimulationParameters params;
+  params.particle_radius = particle_radius; // [m]
+
+  // Simulation Boundaries (i.e. the glass floor and walls)
+  float margin = particle_radius + 0.01f;
+  params.y_min = 0.0f + margin;
+  params.x_min = -box.width + margin;
+  params.x_max = box.width - margin;
+  params.z_min = -box.depth + margin;
+  params.z_max = box.depth - margin;
+
+  // Gravity Acceleration Constant
+  params.g = -9.82f; // [m / s^2]
+
+  // Mass-density of water.
+  float rest_density = 998.29f; // [kg / m^3]
+  params.rest_density = rest_density; // [kg / m^3]
+
+  // The volume of water that our particles are together representing.
+  // The current setup is a bit arbitrary, but roughly mimics the cube we start with in setup 1.
+  float fluid_volume = particles_count * pow(2.0f * particle_radius, 3.0f); // [m^3]
+
+  // The mass-per-particle amount that follows from this volume.
+  float particle_mass = (fluid_volume / particles_count) * rest_density; // [kg]
+  params.particle_mass = particle_mass; // [kg]
+
+  // Upper bound on pair-wise direct interaction range between particles.
+  // Will produce values very close to 0.0457f (See table on p51)
+  // See eq 5.14 and fig 5.3
+  float average_neighbor_count = 30; // The average amount of neighboring particles we use (at rest density).
+  float support_radius = pow(3.0f * fluid_volume * average_neighbor_count / (4.0f * M_PI * particles_count), 1.0f / 3.0f); // [m]
+
+  params.support_radius = support_radius; // [m]
+
+  // The side length of the voxel that each hash cell represents.
+  params.cell_size = support_radius; // [m], see eq 5.5
+
+  // Larger skins rebuild the CPU backend's neighbor lists less often, but make each list longer.
+  params.neighbor_skin = 0.2f * support_radius; // [m]
+
+  // Sorting the particles costs about as much as a full grid build, while mixing water scatters them slowly.
+  params.reorder_interval = 8;
+
+  // Adaptive substepping: each frame is split into the fewest substeps that keep the integration stable.
+  params.cfl_number = 0.4f; // []
+  params.max_substeps = 16;
+
+  // Reproducible runs (e.g. for regression tests) cost a sort of every neighbor list.
+  params.deterministic = false;
+  params.kernel_table_size = 0;
+
+  // Visocity is slightly exaggerated due to small particle count compared to reality.
+  params.viscosity = 3.5f; // [Pa * s]
+  // params.viscosity = 5.0f; // Looks pretty good.
+
+  // Assuming water (at ~20 celsius) against air. See https://www.wikiwand.com/en/Surface_tension
+  params.surface_tension = 0.0728f; // [N / m]
+
+  // Minimum magnitude of inward surface normals we will consider for surface tension.
+  params.l_threshold = 7.065f; // []
+
+  // Gass stiffness constant `k` is given by the ideal gas law (eq 5.15): k = PV = nRT
+  // However, its true value would be very large and force an unreasonably small step size.
+  // So, we instead use it as a design param that should be kept as large as possible, without causing instabilities.
+  params.gass_stiffness = 3.0f; // [J]
+
+  // Conservasion of kinetic energy after collision against boundaries.
+  params.restitution = 0.5f; // []
+  params.friction = 0.0f;    // []
+  params.continuous_collisions = true;
+
+  // The CPU backend can instead enforce incompressibility iteratively, which allows for much larger steps.
+  params.pressure_solver = PressureSolver::STATE_EQUATION;
+  params.pressure_tolerance = 0.01f; // []
+  params.pressure_min_iterations = 3;
+  params.pressure_max_iterations = 50;
+
+  // Settled water is still recomputed every step unless sleeping is enabled (CPU backend only).
+  params.sleeping = false;
+  params.sleep_steps = 20;
+  params.sleep_distance = 0.1f * particle_radius; // [m]
+  params.wake_speed = 0.25f; // [m / s]
+
+  return params;
+}
@@ -0,0 +1,134 @@
+#include "simulation/water_simulation.hpp"
+#include "simulation/water_simulation_state.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace optix;
+
+WaterSimulation::WaterSimulation()
+  : m_parameters(),
+    m_profile(),
+    m_last_substep_count(0),
+    m_time(0.0) {}
+
+void WaterSimulation::set_parameters(WaterSimulationParameters const& parameters) {
+  m_parameters = parameters;
+}
+
+WaterSimulationParameters const& WaterSimulation::parameters() const {
+  return m_parameters;
+}
+
+unsigned int WaterSimulation::advance(float frame_dt) {
+  const unsigned int max_substeps = std::max(1u, m_parameters.max_substeps);
+
+  float remaining = frame_dt;
+  unsigned int substeps = 0;
+
+  do {
+    float dt = remaining;
+
+    if (max_substeps > 1) {
+      dt = std::min(dt, stable_time_step());
+
+      // Never take more than the allowed amount of substeps, even if that means exceeding the stable step.
+      dt = std::max(dt, remaining / (max_substeps - substeps));
+
+      // Avoid a tiny (and therefore wasted) final substep by splitting the rest evenly instead.
+      if (dt < remaining && remaining < 1.5f * dt) {
+        dt = 0.5f * remaining;
+      }
+    }
+
+    step(dt);
+    m_time += dt;
+    remaining -= dt;
+    substeps++;
+  } while (remaining > 1e-6f * frame_dt && substeps < max_substeps);
+
+  m_last_substep_count = substeps;
+  return substeps;
+}
+
+float WaterSimulation::stable_time_step() {
+  const WaterSimulationParameters& p = m_parameters;
+  const float h = p.support_radius;
+
+  float max_speed, max_acceleration;
+  measure_motion(max_speed, max_acceleration);
+
+  // Pressure waves travel at the speed of sound of the state equation (eq 4.12): c^2 = dp / drho = k
+  // An incompressible solver propagates pressure within the step instead, so only the particles themselves count.
+  float speed_of_sound = 0.0f;
+  if (p.pressure_solver == PressureSolver::STATE_EQUATION) {
+    speed_of_sound = sqrtf(std::max(p.gass_stiffness, 0.0f));
+  }
+
+  // CFL condition: neither particles nor pressure waves may skip past a support radius.
+  float dt = p.cfl_number * h / std::max(speed_of_sound + max_speed, 1e-6f);
+
+  // Force condition: large accelerations must not move a particle too far within one substep.
+  if (max_acceleration > 0.0f) {
+    dt = std::min(dt, p.cfl_number * sqrtf(h / max_acceleration));
+  }
+
+  // Viscous diffusion condition (with the kinematic viscosity `viscosity / rest_density`).
+  if (p.viscosity > 0.0f) {
+    dt = std::min(dt, 0.125f * h * h * p.rest_density / p.viscosity);
+  }
+
+  return dt;
+}
+
+double WaterSimulation::time() const {
+  return m_time;
+}
+
+void WaterSimulation::save_state(WaterSimulationState& state) {
+  state.parameters = m_parameters;
+  state.time = m_time;
+  state.sections.clear();
+  get_particles(state.particles);
+}
+
+bool WaterSimulation::restore_state(WaterSimulationState const& state) {
+  set_parameters(state.parameters);
+  set_particles(state.particles);
+  m_time = state.time;
+  return true;
+}
+
+SolverProfile const& WaterSimulation::profile() const {
+  return m_profile;
+}
+
+void WaterSimulation::reset_profile() {
+  m_profile.reset();
+}
+
+unsigned int WaterSimulation::last_substep_count() const {
+  return m_last_substep_count;
+}
+
+unsigned int WaterSimulation::last_pressure_iterations() const {
+  return 0;
+}
+
+void WaterSimulation::measure_motion(float& max_speed, float& max_acceleration) {
+  get_particles(m_motion_particles);
+
+  float max_speed2 = 0.0f;
+  float max_acceleration2 = 0.0f;
+  for (Particle const& p : m_motion_particles) {
+    max_speed2 = std::max(max_speed2, dot(p.velocity, p.velocity));
+
+    if (p.density > 0.0f) {
+      float3 acceleration = p.force / p.density;
+      max_acceleration2 = std::max(max_acceleration2, dot(acceleration, acceleration));
+    }
+  }
+
+  max_speed = sqrtf(max_speed2);
+  max_acceleration = sqrtf(max_acceleration2);
+}
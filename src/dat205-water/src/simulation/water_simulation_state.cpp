@@ -0,0 +1,114 @@
+#include "simulation/water_simulation_state.hpp"
+
+#include <cstdio>
+#include <fstream>
+
+// File layout:
+//   magic, version, sizeof(WaterSimulationParameters), sizeof(Particle)
+//   parameters, time, particles
+//   section count, then for each section: name and data
+//   checksum of everything before it
+//
+// The struct sizes are stored so that a checkpoint of an incompatible build is rejected instead of misread.
+static const char CHECKPOINT_MAGIC[8] = { 'D', 'A', 'T', 'C', 'K', 'P', 'T', '\0' };
+static const uint32_t CHECKPOINT_VERSION = 1;
+
+// FNV-1a, to notice truncated or otherwise damaged checkpoints.
+static uint64_t checksum(std::vector<unsigned char> const& data, size_t size) {
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ data[i]) * 1099511628211ull;
+  }
+  return hash;
+}
+
+bool write_water_simulation_state(std::string const& path, WaterSimulationState const& state) {
+  std::vector<unsigned char> data;
+  StateSectionWriter writer(data);
+
+  for (char c : CHECKPOINT_MAGIC) {
+    writer.write(c);
+  }
+  writer.write<uint32_t>(CHECKPOINT_VERSION);
+  writer.write<uint32_t>(sizeof(WaterSimulationParameters));
+  writer.write<uint32_t>(sizeof(Particle));
+
+  writer.write(state.parameters);
+  writer.write(state.time);
+  writer.write_vector(state.particles);
+
+  writer.write<uint32_t>(state.sections.size());
+  for (auto const& section : state.sections) {
+    writer.write_vector(std::vector<char>(section.first.begin(), section.first.end()));
+    writer.write_vector(section.second);
+  }
+
+  writer.write(checksum(data, data.size()));
+
+  std::string temporary_path = path + ".tmp";
+  {
+    std::ofstream file(temporary_path.c_str(), std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(data.data()), data.size());
+    file.flush();
+    if (!file) {
+      return false;
+    }
+  }
+  return std::rename(temporary_path.c_str(), path.c_str()) == 0;
+}
+
+bool read_water_simulation_state(std::string const& path, WaterSimulationState& state) {
+  std::ifstream file(path.c_str(), std::ios::binary);
+  if (!file) {
+    return false;
+  }
+  std::vector<unsigned char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+  uint64_t stored_checksum;
+  if (data.size() < sizeof(stored_checksum)) {
+    return false;
+  }
+  size_t payload_size = data.size() - sizeof(stored_checksum);
+  memcpy(&stored_checksum, &data[payload_size], sizeof(stored_checksum));
+  if (stored_checksum != checksum(data, payload_size)) {
+    return false;
+  }
+
+  StateSectionReader reader(data);
+
+  char magic[sizeof(CHECKPOINT_MAGIC)];
+  for (char& c : magic) {
+    reader.read(c);
+  }
+  uint32_t version = 0, parameters_size = 0, particle_size = 0;
+  reader.read(version);
+  reader.read(parameters_size);
+  reader.read(particle_size);
+
+  if (memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0 ||
+      version != CHECKPOINT_VERSION ||
+      parameters_size != sizeof(WaterSimulationParameters) ||
+      particle_size != sizeof(Particle)) {
+    return false;
+  }
+
+  uint32_t section_count = 0;
+  if (!reader.read(state.parameters) ||
+      !reader.read(state.time) ||
+      !reader.read_vector(state.particles) ||
+      !reader.read(section_count)) {
+    return false;
+  }
+
+  state.sections.clear();
+  for (uint32_t i = 0; i < section_count; i++) {
+    std::vector<char> name;
+    std::vector<unsigned char> section;
+    if (!reader.read_vector(name) || !reader.read_vector(section)) {
+      return false;
+    }
+    state.sections[std::string(name.begin(), name.end())].swap(section);
+  }
+
+  return true;
+}
@@ -0,0 +1,105 @@
+#include "util/thread_pool.hpp"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned int thread_count)
+  : m_task(nullptr),
+    m_count(0),
+    m_chunk_size(1),
+    m_next_chunk(0),
+    m_busy_workers(0),
+    m_generation(0),
+    m_stopping(false) {
+
+  if (thread_count == 0) {
+    thread_count = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  // The calling thread is the last member of the pool.
+  for (unsigned int i = 1; i < thread_count; i++) {
+    m_workers.push_back(std::thread([this]() { worker_loop(); }));
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopping = true;
+  }
+  m_work_available.notify_all();
+
+  for (std::thread& worker : m_workers) {
+    worker.join();
+  }
+}
+
+unsigned int ThreadPool::size() const {
+  return m_workers.size() + 1;
+}
+
+void ThreadPool::parallel_for(size_t count, std::function<void(size_t, size_t)> const& f) {
+  if (count == 0) {
+    return;
+  }
+
+  // Not worth waking up the workers.
+  if (m_workers.empty() || count == 1) {
+    f(0, count);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_task = &f;
+    m_count = count;
+
+    // Several chunks per thread evens out the load when some particles have more neighbors than others.
+    m_chunk_size = std::max<size_t>(1, count / (8 * size()));
+    m_next_chunk = 0;
+
+    m_busy_workers = m_workers.size();
+    m_generation++;
+  }
+  m_work_available.notify_all();
+
+  run_chunks();
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_work_done.wait(lock, [this]() { return m_busy_workers == 0; });
+  m_task = nullptr;
+}
+
+void ThreadPool::worker_loop() {
+  unsigned long seen_generation = 0;
+
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_work_available.wait(lock, [&]() { return m_stopping || m_generation != seen_generation; });
+      if (m_stopping) {
+        return;
+      }
+      seen_generation = m_generation;
+    }
+
+    run_chunks();
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_busy_workers--;
+      if (m_busy_workers == 0) {
+        m_work_done.notify_one();
+      }
+    }
+  }
+}
+
+void ThreadPool::run_chunks() {
+  while (true) {
+    size_t begin = m_next_chunk.fetch_add(m_chunk_size);
+    if (begin >= m_count) {
+      return;
+    }
+    (*m_task)(begin, std::min(begin + m_chunk_size, m_count));
+  }
+}
@@ -51,6 +51,7 @@
 
 #include <sutil.h>
 #include <Camera.h>
+#include <ParticleCache.h>
 #include "commonStructs.h"
 #include <Arcball.h>
 
@@ -104,6 +105,7 @@ bool            particles_file_velocities = false;
 bool            camera_slow_rotate = true;
 size_t          max_particles = 0;
 float           fixed_radius = 100.f;
+bool            fixed_radius_from_args = false;
 float           particlesPerSlab = 16.f;
 float           wScale = 3.5f;
 float           opacity = .5f;
@@ -130,6 +132,10 @@ std::string     particles_file_base;
 int             current_particle_frame = 1;
 int             max_particle_frames = 25;
 
+// Particle cache (.pcache) state. Frames are memory mapped one at a time, so any frame can be shown in O(1).
+ParticleCacheReader* particle_cache = 0;
+int                  start_particle_frame = 0;
+
 // Accumulation frame
 unsigned int    accumulation_frame = 0;
 
@@ -186,6 +192,9 @@ void destroyContext()
         context->destroy();
         context = 0;
     }
+
+    delete particle_cache;
+    particle_cache = 0;
 }
 
 // State for animating buffers
@@ -404,8 +413,85 @@ void readFile( std::vector<float4>& positions,
                float3& bbox_min, 
                float3& bbox_max )
 {
+	//read particle cache frame.
+    if (particles_file_extension == "pcache")
+    {
+        if (!particle_cache)
+        {
+            std::cout << "Reading particle cache " << particles_file << std::endl;
+
+            particle_cache = new ParticleCacheReader( particles_file );
+            if (!particle_cache->isOpen() || particle_cache->frameCount() == 0)
+            {
+                std::cerr << "Particle cache " << particles_file << " has no readable frames" << std::endl;
+                exit(1);
+            }
+
+            max_particle_frames = particle_cache->frameCount();
+            std::cout << "# frames = " << max_particle_frames << " ("
+                      << particleCacheEncodingName( static_cast<ParticleCacheEncoding>( particle_cache->header().encoding ) ) << ")" << std::endl;
+
+            if (!fixed_radius_from_args && particle_cache->header().particle_radius > 0.f)
+              fixed_radius = particle_cache->header().particle_radius;
+        }
+
+        current_particle_frame = std::min( std::max( current_particle_frame, 0 ), max_particle_frames - 1 );
+
+        ParticleCacheFrame frame;
+        if (!particle_cache->mapFrame( current_particle_frame, frame ))
+        {
+            std::cerr << "Could not map frame " << current_particle_frame << " of " << particles_file << std::endl;
+            exit(1);
+        }
+
+        size_t numParticles = frame.particleCount();
+        std::vector<float> xyz( 3 * numParticles );
+        std::vector<float> vxyz( 3 * numParticles );
+        frame.decodePositions( xyz.data() );
+        frame.decodeVelocities( vxyz.data() );
+
+        if (max_particles > 0 && numParticles > max_particles)
+          numParticles = max_particles;
+
+        positions.resize(numParticles);
+        velocities.resize(numParticles);
+        colors.assign(numParticles, make_float3(.9f));
+        radii.assign(numParticles, fixed_radius);
+
+        // Like the txt files, the speed is the particle attribute.
+        float4 pmin, pmax;
+        pmin.x = pmin.y = pmin.z = pmin.w = 1e16f;
+        pmax.x = pmax.y = pmax.z = pmax.w = -1e16f;
+
+        for(size_t i=0; i<numParticles; i++)
+        {
+            velocities[i] = make_float3( vxyz[3*i+0], vxyz[3*i+1], vxyz[3*i+2] );
+            positions[i] = make_float4( xyz[3*i+0], xyz[3*i+1], xyz[3*i+2], length(velocities[i]) );
+
+            const float4& p = positions[i];
+            pmin.x = fminf(pmin.x, p.x);
+            pmin.y = fminf(pmin.y, p.y);
+            pmin.z = fminf(pmin.z, p.z);
+            pmin.w = fminf(pmin.w, p.w);
+
+            pmax.x = fmaxf(pmax.x, p.x);
+            pmax.y = fmaxf(pmax.y, p.y);
+            pmax.z = fmaxf(pmax.z, p.z);
+            pmax.w = fmaxf(pmax.w, p.w);
+        }
+
+        std::cout << "Frame " << current_particle_frame << " (t = " << frame.time() << " s), # particles = " << numParticles << std::endl;
+
+        bbox_min = make_float3(pmin.x - fixed_radius, pmin.y - fixed_radius, pmin.z - fixed_radius);
+        bbox_max = make_float3(pmax.x + fixed_radius, pmax.y + fixed_radius, pmax.z + fixed_radius);
+
+        const float wRange = pmax.w > pmin.w ? float( 1.0 / double(pmax.w - pmin.w) ) : 1.f;
+        for(size_t i=0; i<numParticles; i++)
+            positions[i].w = (positions[i].w - pmin.w) * wRange;
+    }
+
 	//read raw data file.
-    if (particles_file_extension == "raw")
+    else if (particles_file_extension == "raw")
     {
         std::cout << "Reading raw file" << particles_file << std::endl;
 
@@ -651,6 +737,10 @@ void loadParticles()
 {
     float3 bbox_min, bbox_max;
 
+    // Particle cache frames are mapped in O(1), so only the current one is kept decoded.
+    if (particles_file_extension == "pcache")
+        dataCache.clear();
+
     std::map<int, ParticleFrameData>::iterator cacheIt = dataCache.find(current_particle_frame);
     if(cacheIt == dataCache.end())
     {
@@ -1012,6 +1102,13 @@ void glfwRun( GLFWwindow* window, sutil::Camera& camera, RenderBuffers& buffers
             if ( ImGui::Checkbox( "camera rotate", &camera_slow_rotate ) ) {
             }
 
+            if ( particle_cache && max_particle_frames > 1 ) {
+              if ( ImGui::SliderInt( "frame", &current_particle_frame, 0, max_particle_frames - 1 ) ) {
+                loadParticles();
+                accumulation_frame = 0;
+              }
+            }
+
             ImGui::End();
         }
 
@@ -1066,7 +1163,8 @@ void printUsageAndExit( const std::string& argv0 )
         "  -h | --help                         Print this usage message and exit.\n"
         "  -f | --file                         Save single frame to file and exit.\n"
         "  -n | --nopbo                        Disable GL interop for display buffer.\n"
-        "  -p | --particles <particles_file>   Specify path to particles file to be loaded.\n"
+        "  -p | --particles <particles_file>   Specify path to particles file to be loaded (.txt, .raw or .pcache).\n"
+        "  --frame <int>                       First frame to show of a particle cache (.pcache).\n"
         "  -r | --report <LEVEL>               Enable usage reporting and report level [1-3].\n"
         "  --no-rotate                         Disable camera rotation (default on).\n"
         "  --wScale <float>                    Rescale particle attribute range by a fixed multiple.\n"
@@ -1143,6 +1241,7 @@ int main( int argc, char** argv )
                 printUsageAndExit( argv[0] );
             }
             fixed_radius = (float) atof( argv[++i] );
+            fixed_radius_from_args = true;
         }
 
         else if( arg == "--particlesPerSlab"  )
@@ -1185,6 +1284,15 @@ int main( int argc, char** argv )
             }
             particles_file = argv[++i];
         }
+        else if( arg == "--frame" )
+        {
+            if( i == argc-1 )
+            {
+                std::cout << "Option '" << argv[i] << "' requires additional argument.\n";
+                printUsageAndExit( argv[0] );
+            }
+            start_particle_frame = atoi( argv[++i] );
+        }
         else if( arg == "-r" || arg == "--report" )
         {
             if( i == argc-1 )
@@ -1221,6 +1329,8 @@ int main( int argc, char** argv )
         createContext( usage_report_level, &logger );
         setupParticles();
         setParticlesBaseName( particles_file );
+        if ( particles_file_extension == "pcache" )
+            current_particle_frame = start_particle_frame;
         loadParticles();
         setupCamera();
         setupLights();
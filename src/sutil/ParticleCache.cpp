@@ -0,0 +1,649 @@
+#include <ParticleCache.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#if defined( _WIN32 ) || defined( _WIN64 )
+#  define PARTICLE_CACHE_NO_MMAP
+#else
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+//-----------------------------------------------------------------------------
+//
+// Helpers
+//
+//-----------------------------------------------------------------------------
+
+namespace
+{
+
+// The arrays within a frame are aligned for vector loads.
+const uint64_t ARRAY_ALIGNMENT = 64;
+
+uint64_t alignUp( uint64_t value, uint64_t alignment )
+{
+  return ( value + alignment - 1 ) / alignment * alignment;
+}
+
+bool seekFile( FILE* file, uint64_t offset )
+{
+#if defined( _WIN32 ) || defined( _WIN64 )
+  return _fseeki64( file, (__int64) offset, SEEK_SET ) == 0;
+#else
+  return fseeko( file, (off_t) offset, SEEK_SET ) == 0;
+#endif
+}
+
+uint64_t fileSize( FILE* file )
+{
+#if defined( _WIN32 ) || defined( _WIN64 )
+  _fseeki64( file, 0, SEEK_END );
+  return (uint64_t) _ftelli64( file );
+#else
+  struct stat st;
+  if( fstat( fileno( file ), &st ) != 0 )
+    return 0;
+  return (uint64_t) st.st_size;
+#endif
+}
+
+void componentBounds( const float* values, uint32_t count, float* min, float* max )
+{
+  for( int c = 0; c < 3; ++c )
+  {
+    min[c] = count > 0 ? values[c] : 0.f;
+    max[c] = min[c];
+  }
+
+  for( uint32_t i = 0; i < count; ++i )
+  {
+    for( int c = 0; c < 3; ++c )
+    {
+      min[c] = std::min( min[c], values[3 * i + c] );
+      max[c] = std::max( max[c], values[3 * i + c] );
+    }
+  }
+}
+
+void encodeComponents( const float* values, uint32_t count, ParticleCacheEncoding encoding,
+                       const float* min, const float* max, unsigned char* out )
+{
+  switch( encoding )
+  {
+    case PARTICLE_CACHE_FLOAT32:
+      memcpy( out, values, 3 * sizeof( float ) * count );
+      break;
+
+    case PARTICLE_CACHE_FLOAT16:
+    {
+      uint16_t* half = reinterpret_cast<uint16_t*>( out );
+      for( uint32_t i = 0; i < 3 * count; ++i )
+        half[i] = floatToHalf( values[i] );
+      break;
+    }
+
+    case PARTICLE_CACHE_FIXED16:
+    {
+      float scale[3];
+      for( int c = 0; c < 3; ++c )
+        scale[c] = max[c] > min[c] ? 65535.f / ( max[c] - min[c] ) : 0.f;
+
+      uint16_t* fixed = reinterpret_cast<uint16_t*>( out );
+      for( uint32_t i = 0; i < count; ++i )
+      {
+        for( int c = 0; c < 3; ++c )
+        {
+          float q = ( values[3 * i + c] - min[c] ) * scale[c];
+          fixed[3 * i + c] = (uint16_t) std::min( 65535.f, std::max( 0.f, floorf( q + .5f ) ) );
+        }
+      }
+      break;
+    }
+  }
+}
+
+void decodeComponents( const unsigned char* data, uint32_t count, ParticleCacheEncoding encoding,
+                       const float* min, const float* max, float* out )
+{
+  switch( encoding )
+  {
+    case PARTICLE_CACHE_FLOAT32:
+      memcpy( out, data, 3 * sizeof( float ) * count );
+      break;
+
+    case PARTICLE_CACHE_FLOAT16:
+    {
+      const uint16_t* half = reinterpret_cast<const uint16_t*>( data );
+      for( uint32_t i = 0; i < 3 * count; ++i )
+        out[i] = halfToFloat( half[i] );
+      break;
+    }
+
+    case PARTICLE_CACHE_FIXED16:
+    {
+      float scale[3];
+      for( int c = 0; c < 3; ++c )
+        scale[c] = ( max[c] - min[c] ) / 65535.f;
+
+      const uint16_t* fixed = reinterpret_cast<const uint16_t*>( data );
+      for( uint32_t i = 0; i < count; ++i )
+        for( int c = 0; c < 3; ++c )
+          out[3 * i + c] = min[c] + fixed[3 * i + c] * scale[c];
+      break;
+    }
+  }
+}
+
+} // namespace
+
+
+size_t particleCacheComponentSize( ParticleCacheEncoding encoding )
+{
+  return encoding == PARTICLE_CACHE_FLOAT32 ? sizeof( float ) : sizeof( uint16_t );
+}
+
+
+const char* particleCacheEncodingName( ParticleCacheEncoding encoding )
+{
+  switch( encoding )
+  {
+    case PARTICLE_CACHE_FLOAT32: return "float32";
+    case PARTICLE_CACHE_FLOAT16: return "float16";
+    case PARTICLE_CACHE_FIXED16: return "fixed16";
+    default:                     return "unknown";
+  }
+}
+
+
+bool parseParticleCacheEncoding( const std::string& name, ParticleCacheEncoding& encoding )
+{
+  const ParticleCacheEncoding encodings[] = { PARTICLE_CACHE_FLOAT32, PARTICLE_CACHE_FLOAT16, PARTICLE_CACHE_FIXED16 };
+  for( size_t i = 0; i < sizeof( encodings ) / sizeof( encodings[0] ); ++i )
+  {
+    if( name == particleCacheEncodingName( encodings[i] ) )
+    {
+      encoding = encodings[i];
+      return true;
+    }
+  }
+  return false;
+}
+
+
+uint16_t floatToHalf( float value )
+{
+  uint32_t x;
+  memcpy( &x, &value, sizeof( x ) );
+
+  const uint32_t sign     = ( x >> 16 ) & 0x8000u;
+  const uint32_t exponent = ( x >> 23 ) & 0xffu;
+  uint32_t       mantissa = x & 0x7fffffu;
+
+  // Infinity and NaN
+  if( exponent == 0xffu )
+    return (uint16_t) ( sign | 0x7c00u | ( mantissa ? 0x200u : 0u ) );
+
+  const int e = (int) exponent - 127 + 15;
+
+  // Too large, becomes infinity.
+  if( e >= 0x1f )
+    return (uint16_t) ( sign | 0x7c00u );
+
+  // Too small for a normal half, becomes subnormal or zero.
+  if( e <= 0 )
+  {
+    if( e < -10 )
+      return (uint16_t) sign;
+
+    mantissa |= 0x800000u;
+    const uint32_t shift     = (uint32_t) ( 14 - e );
+    uint32_t       half      = mantissa >> shift;
+    const uint32_t remainder = mantissa & ( ( 1u << shift ) - 1u );
+    const uint32_t halfway   = 1u << ( shift - 1u );
+    if( remainder > halfway || ( remainder == halfway && ( half & 1u ) ) )
+      ++half;
+    return (uint16_t) ( sign | half );
+  }
+
+  // Rounding may carry into the exponent, which correctly rounds up to the next power of two (or infinity).
+  uint32_t half = sign | ( (uint32_t) e << 10 ) | ( mantissa >> 13 );
+  const uint32_t remainder = mantissa & 0x1fffu;
+  if( remainder > 0x1000u || ( remainder == 0x1000u && ( half & 1u ) ) )
+    ++half;
+  return (uint16_t) half;
+}
+
+
+float halfToFloat( uint16_t value )
+{
+  const uint32_t sign     = ( (uint32_t) value & 0x8000u ) << 16;
+  const uint32_t exponent = ( value >> 10 ) & 0x1fu;
+  const uint32_t mantissa = value & 0x3ffu;
+
+  if( exponent == 0 )
+  {
+    // Zero and subnormals
+    const float magnitude = ldexpf( (float) mantissa, -24 );
+    return sign ? -magnitude : magnitude;
+  }
+
+  uint32_t x;
+  if( exponent == 0x1f )
+    x = sign | 0x7f800000u | ( mantissa << 13 );
+  else
+    x = sign | ( ( exponent + 112u ) << 23 ) | ( mantissa << 13 );
+
+  float result;
+  memcpy( &result, &x, sizeof( result ) );
+  return result;
+}
+
+
+//-----------------------------------------------------------------------------
+//
+// ParticleCacheWriter
+//
+//-----------------------------------------------------------------------------
+
+ParticleCacheWriter::ParticleCacheWriter( const std::string& filename,
+                                          ParticleCacheEncoding encoding,
+                                          float particle_radius )
+  : m_file( 0 ), m_offset( 0 ), m_failed( false )
+{
+  memset( &m_header, 0, sizeof( m_header ) );
+  memcpy( m_header.magic, PARTICLE_CACHE_MAGIC, sizeof( m_header.magic ) );
+  m_header.version         = PARTICLE_CACHE_VERSION;
+  m_header.encoding        = encoding;
+  m_header.particle_radius = particle_radius;
+  m_header.frame_alignment = PARTICLE_CACHE_ALIGNMENT;
+
+  m_file = fopen( filename.c_str(), "wb" );
+  if( !m_file )
+  {
+    std::cerr << "ParticleCacheWriter( '" << filename << "' ) could not open the file for writing" << std::endl;
+    m_failed = true;
+    return;
+  }
+
+  // The final header is written by finish(), once the frame table is known.
+  std::vector<unsigned char> padding( PARTICLE_CACHE_ALIGNMENT, 0 );
+  memcpy( &padding[0], &m_header, sizeof( m_header ) );
+  write( &padding[0], padding.size() );
+}
+
+
+ParticleCacheWriter::~ParticleCacheWriter()
+{
+  finish();
+}
+
+
+bool ParticleCacheWriter::isOpen() const
+{
+  return m_file != 0;
+}
+
+
+bool ParticleCacheWriter::writeFrame( float time,
+                                      uint32_t particle_count,
+                                      const float* positions,
+                                      const float* velocities )
+{
+  if( !m_file )
+    return false;
+
+  const ParticleCacheEncoding encoding = static_cast<ParticleCacheEncoding>( m_header.encoding );
+  const uint64_t array_size = 3 * particleCacheComponentSize( encoding ) * particle_count;
+
+  ParticleCacheFrameHeader header;
+  memset( &header, 0, sizeof( header ) );
+  header.magic             = PARTICLE_CACHE_FRAME_MAGIC;
+  header.frame             = (uint32_t) m_frames.size();
+  header.particle_count    = particle_count;
+  header.encoding          = encoding;
+  header.time              = time;
+  header.positions_offset  = alignUp( sizeof( header ), ARRAY_ALIGNMENT );
+  header.velocities_offset = alignUp( header.positions_offset + array_size, ARRAY_ALIGNMENT );
+  header.size              = alignUp( header.velocities_offset + array_size, m_header.frame_alignment );
+
+  componentBounds( positions, particle_count, header.position_min, header.position_max );
+  componentBounds( velocities, particle_count, header.velocity_min, header.velocity_max );
+
+  m_scratch.assign( (size_t) header.size, 0 );
+  memcpy( &m_scratch[0], &header, sizeof( header ) );
+  encodeComponents( positions, particle_count, encoding, header.position_min, header.position_max,
+                    &m_scratch[(size_t) header.positions_offset] );
+  encodeComponents( velocities, particle_count, encoding, header.velocity_min, header.velocity_max,
+                    &m_scratch[(size_t) header.velocities_offset] );
+
+  ParticleCacheFrameEntry entry;
+  entry.offset         = m_offset;
+  entry.size           = header.size;
+  entry.time           = time;
+  entry.particle_count = particle_count;
+
+  if( !write( &m_scratch[0], m_scratch.size() ) )
+    return false;
+
+  m_frames.push_back( entry );
+  m_header.frame_count        = (uint32_t) m_frames.size();
+  m_header.max_particle_count = std::max( m_header.max_particle_count, particle_count );
+  return true;
+}
+
+
+bool ParticleCacheWriter::finish()
+{
+  if( !m_file )
+    return !m_failed;
+
+  m_header.frame_table_offset = m_offset;
+  if( !m_frames.empty() )
+    write( &m_frames[0], sizeof( ParticleCacheFrameEntry ) * m_frames.size() );
+
+  if( !seekFile( m_file, 0 ) || fwrite( &m_header, sizeof( m_header ), 1, m_file ) != 1 )
+    m_failed = true;
+
+  if( fclose( m_file ) != 0 )
+    m_failed = true;
+  m_file = 0;
+
+  return !m_failed;
+}
+
+
+bool ParticleCacheWriter::failed() const
+{
+  return m_failed;
+}
+
+
+uint32_t ParticleCacheWriter::frameCount() const
+{
+  return (uint32_t) m_frames.size();
+}
+
+
+uint64_t ParticleCacheWriter::bytesWritten() const
+{
+  return m_offset;
+}
+
+
+bool ParticleCacheWriter::write( const void* data, size_t size )
+{
+  if( fwrite( data, 1, size, m_file ) != size )
+  {
+    m_failed = true;
+    return false;
+  }
+  m_offset += size;
+  return true;
+}
+
+
+//-----------------------------------------------------------------------------
+//
+// ParticleCacheFrame
+//
+//-----------------------------------------------------------------------------
+
+ParticleCacheFrame::ParticleCacheFrame()
+  : m_mapping( 0 ), m_mapping_size( 0 ), m_data( 0 )
+{
+}
+
+
+ParticleCacheFrame::~ParticleCacheFrame()
+{
+  release();
+}
+
+
+void ParticleCacheFrame::release()
+{
+#ifndef PARTICLE_CACHE_NO_MMAP
+  if( m_mapping )
+    munmap( m_mapping, m_mapping_size );
+#endif
+  m_mapping      = 0;
+  m_mapping_size = 0;
+  m_data         = 0;
+  m_copy.clear();
+}
+
+
+bool ParticleCacheFrame::valid() const
+{
+  return m_data != 0;
+}
+
+
+const ParticleCacheFrameHeader& ParticleCacheFrame::header() const
+{
+  return *reinterpret_cast<const ParticleCacheFrameHeader*>( m_data );
+}
+
+
+uint32_t ParticleCacheFrame::particleCount() const
+{
+  return header().particle_count;
+}
+
+
+float ParticleCacheFrame::time() const
+{
+  return header().time;
+}
+
+
+ParticleCacheEncoding ParticleCacheFrame::encoding() const
+{
+  return static_cast<ParticleCacheEncoding>( header().encoding );
+}
+
+
+const void* ParticleCacheFrame::positionData() const
+{
+  return m_data + header().positions_offset;
+}
+
+
+const void* ParticleCacheFrame::velocityData() const
+{
+  return m_data + header().velocities_offset;
+}
+
+
+void ParticleCacheFrame::decodePositions( float* positions ) const
+{
+  const ParticleCacheFrameHeader& h = header();
+  decodeComponents( m_data + h.positions_offset, h.particle_count, encoding(), h.position_min, h.position_max, positions );
+}
+
+
+void ParticleCacheFrame::decodeVelocities( float* velocities ) const
+{
+  const ParticleCacheFrameHeader& h = header();
+  decodeComponents( m_data + h.velocities_offset, h.particle_count, encoding(), h.velocity_min, h.velocity_max, velocities );
+}
+
+
+//-----------------------------------------------------------------------------
+//
+// ParticleCacheReader
+//
+//-----------------------------------------------------------------------------
+
+ParticleCacheReader::ParticleCacheReader( const std::string& filename )
+  : m_file( 0 ), m_file_size( 0 )
+{
+  memset( &m_header, 0, sizeof( m_header ) );
+
+  m_file = fopen( filename.c_str(), "rb" );
+  if( !m_file )
+  {
+    std::cerr << "ParticleCacheReader( '" << filename << "' ) could not open the file" << std::endl;
+    return;
+  }
+
+  m_file_size = fileSize( m_file );
+
+  if( !readAt( 0, &m_header, sizeof( m_header ) ) ||
+      memcmp( m_header.magic, PARTICLE_CACHE_MAGIC, sizeof( m_header.magic ) ) != 0 ||
+      m_header.version > PARTICLE_CACHE_VERSION ||
+      m_header.encoding > PARTICLE_CACHE_FIXED16 ||
+      m_header.frame_alignment == 0 )
+  {
+    std::cerr << "ParticleCacheReader( '" << filename << "' ) not a supported particle cache" << std::endl;
+    fclose( m_file );
+    m_file = 0;
+    return;
+  }
+
+  const uint64_t table_size = sizeof( ParticleCacheFrameEntry ) * (uint64_t) m_header.frame_count;
+  if( m_header.frame_table_offset != 0 && m_header.frame_table_offset + table_size <= m_file_size )
+  {
+    m_frames.resize( m_header.frame_count );
+    if( m_header.frame_count == 0 || readAt( m_header.frame_table_offset, &m_frames[0], (size_t) table_size ) )
+      return;
+  }
+
+  std::cerr << "ParticleCacheReader( '" << filename << "' ) has no frame table, recovering frames" << std::endl;
+  recoverFrames();
+}
+
+
+ParticleCacheReader::~ParticleCacheReader()
+{
+  if( m_file )
+    fclose( m_file );
+}
+
+
+bool ParticleCacheReader::isOpen() const
+{
+  return m_file != 0;
+}
+
+
+const ParticleCacheHeader& ParticleCacheReader::header() const
+{
+  return m_header;
+}
+
+
+uint32_t ParticleCacheReader::frameCount() const
+{
+  return (uint32_t) m_frames.size();
+}
+
+
+const ParticleCacheFrameEntry& ParticleCacheReader::frameEntry( uint32_t index ) const
+{
+  return m_frames[index];
+}
+
+
+bool ParticleCacheReader::mapFrame( uint32_t index, ParticleCacheFrame& frame ) const
+{
+  frame.release();
+
+  if( !m_file || index >= m_frames.size() )
+    return false;
+
+  const ParticleCacheFrameEntry& entry = m_frames[index];
+  if( entry.size < sizeof( ParticleCacheFrameHeader ) || entry.offset + entry.size > m_file_size )
+    return false;
+
+#ifdef PARTICLE_CACHE_NO_MMAP
+  frame.m_copy.resize( (size_t) entry.size );
+  if( !readAt( entry.offset, &frame.m_copy[0], frame.m_copy.size() ) )
+  {
+    frame.release();
+    return false;
+  }
+  frame.m_data = &frame.m_copy[0];
+#else
+  // Mappings have to start at a page boundary, which frames usually (but not necessarily) are aligned to.
+  const uint64_t page_size = (uint64_t) sysconf( _SC_PAGESIZE );
+  const uint64_t start     = entry.offset - entry.offset % page_size;
+  const size_t   length    = (size_t) ( entry.offset - start + entry.size );
+
+  void* mapping = mmap( 0, length, PROT_READ, MAP_PRIVATE, fileno( m_file ), (off_t) start );
+  if( mapping == MAP_FAILED )
+    return false;
+
+  frame.m_mapping      = mapping;
+  frame.m_mapping_size = length;
+  frame.m_data         = static_cast<const unsigned char*>( mapping ) + ( entry.offset - start );
+#endif
+
+  // Never hand out arrays that reach outside of the frame.
+  const ParticleCacheFrameHeader& header = frame.header();
+  const uint64_t array_size = 3 * particleCacheComponentSize( frame.encoding() ) * (uint64_t) header.particle_count;
+  if( header.magic != PARTICLE_CACHE_FRAME_MAGIC ||
+      header.encoding > PARTICLE_CACHE_FIXED16 ||
+      header.positions_offset + array_size > entry.size ||
+      header.velocities_offset + array_size > entry.size )
+  {
+    frame.release();
+    return false;
+  }
+
+  return true;
+}
+
+
+bool ParticleCacheReader::readAt( uint64_t offset, void* data, size_t size ) const
+{
+#ifdef PARTICLE_CACHE_NO_MMAP
+  return seekFile( m_file, offset ) && fread( data, 1, size, m_file ) == size;
+#else
+  return pread( fileno( m_file ), data, size, (off_t) offset ) == (ssize_t) size;
+#endif
+}
+
+
+void ParticleCacheReader::recoverFrames()
+{
+  m_frames.clear();
+
+  uint64_t offset = alignUp( sizeof( ParticleCacheHeader ), m_header.frame_alignment );
+  ParticleCacheFrameHeader header;
+  while( offset + sizeof( header ) <= m_file_size && readAt( offset, &header, sizeof( header ) ) )
+  {
+    if( header.magic != PARTICLE_CACHE_FRAME_MAGIC || header.size < sizeof( header ) || offset + header.size > m_file_size )
+      break;
+
+    ParticleCacheFrameEntry entry;
+    entry.offset         = offset;
+    entry.size           = header.size;
+    entry.time           = header.time;
+    entry.particle_count = header.particle_count;
+    m_frames.push_back( entry );
+
+    offset += header.size;
+  }
+
+  m_header.frame_count = (uint32_t) m_frames.size();
+}
+
+
+bool isParticleCacheFile( const std::string& filename )
+{
+  FILE* file = fopen( filename.c_str(), "rb" );
+  if( !file )
+    return false;
+
+  char magic[sizeof( PARTICLE_CACHE_MAGIC )];
+  const bool is_cache = fread( magic, 1, sizeof( magic ), file ) == sizeof( magic ) &&
+                        memcmp( magic, PARTICLE_CACHE_MAGIC, sizeof( magic ) ) == 0;
+  fclose( file );
+  return is_cache;
+}
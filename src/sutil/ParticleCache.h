@@ -0,0 +1,223 @@
+#pragma once
+
+#include <sutilapi.h>
+
+#include <stdint.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+//-----------------------------------------------------------------------------
+//
+// Particle cache file format
+//
+// A versioned binary format for sequences of particle frames (positions and
+// velocities) that is written once and played back many times.
+//
+//   ParticleCacheHeader        (padded to ParticleCacheHeader::frame_alignment)
+//   frame 0                    (ParticleCacheFrameHeader, positions, velocities)
+//   frame 1                    (each frame starts on a frame_alignment boundary)
+//   ...
+//   ParticleCacheFrameEntry[frame_count]   (at frame_table_offset)
+//
+// Every frame is self-contained, so a single frame can be memory mapped and
+// used without copying or parsing the rest of the file. Positions and
+// velocities are stored interleaved (xyz per particle) with one of the
+// encodings below. Multi-byte values use the byte order of the writer
+// (little endian on every platform we support).
+//
+// If the writer did not finish, frame_table_offset is 0 and the frames can
+// still be recovered by walking the frame headers.
+//
+//-----------------------------------------------------------------------------
+
+enum ParticleCacheEncoding
+{
+  PARTICLE_CACHE_FLOAT32 = 0,  // Lossless.
+  PARTICLE_CACHE_FLOAT16 = 1,  // IEEE half precision floats.
+  PARTICLE_CACHE_FIXED16 = 2   // 16-bit fixed point within the per-frame bounds of each component.
+};
+
+static const char     PARTICLE_CACHE_MAGIC[8]     = { 'P', 'C', 'A', 'C', 'H', 'E', '\0', '\0' };
+static const uint32_t PARTICLE_CACHE_VERSION      = 1;
+static const uint32_t PARTICLE_CACHE_FRAME_MAGIC  = 0x4d415246; // "FRAM"
+static const uint32_t PARTICLE_CACHE_ALIGNMENT    = 4096;
+
+struct ParticleCacheHeader
+{
+  char     magic[8];              // PARTICLE_CACHE_MAGIC
+  uint32_t version;               // PARTICLE_CACHE_VERSION
+  uint32_t encoding;              // ParticleCacheEncoding of every frame
+  uint32_t frame_count;
+  uint32_t max_particle_count;    // Largest particle_count of any frame
+  uint64_t frame_table_offset;    // 0 if the file was not finished
+  float    particle_radius;       // 0 if unknown
+  uint32_t frame_alignment;       // Every frame starts at a multiple of this
+  uint32_t reserved[6];
+};
+
+struct ParticleCacheFrameHeader
+{
+  uint32_t magic;                 // PARTICLE_CACHE_FRAME_MAGIC
+  uint32_t frame;
+  uint32_t particle_count;
+  uint32_t encoding;
+  float    time;                  // Simulated time [s]
+  float    position_min[3];       // Bounds of the positions (used by PARTICLE_CACHE_FIXED16)
+  float    position_max[3];
+  float    velocity_min[3];       // Bounds of the velocities (used by PARTICLE_CACHE_FIXED16)
+  float    velocity_max[3];
+  uint32_t reserved;
+  uint64_t positions_offset;      // Relative to the start of this header
+  uint64_t velocities_offset;     // Relative to the start of this header
+  uint64_t size;                  // Of the whole frame, including this header and padding
+};
+
+struct ParticleCacheFrameEntry
+{
+  uint64_t offset;                // Of the frame header, from the start of the file
+  uint64_t size;
+  float    time;
+  uint32_t particle_count;
+};
+
+// Bytes per encoded component.
+SUTILAPI size_t particleCacheComponentSize( ParticleCacheEncoding encoding );
+
+SUTILAPI const char* particleCacheEncodingName( ParticleCacheEncoding encoding );
+
+// Accepts the names returned by particleCacheEncodingName. Returns false for unknown names.
+SUTILAPI bool parseParticleCacheEncoding( const std::string& name, ParticleCacheEncoding& encoding );
+
+// IEEE 754 half precision conversions (round to nearest even).
+SUTILAPI uint16_t floatToHalf( float value );
+SUTILAPI float    halfToFloat( uint16_t value );
+
+
+//-----------------------------------------------------------------------------
+//
+// ParticleCacheWriter
+//
+//-----------------------------------------------------------------------------
+
+class ParticleCacheWriter
+{
+public:
+  SUTILAPI ParticleCacheWriter( const std::string& filename,
+                                ParticleCacheEncoding encoding,
+                                float particle_radius = 0.f );
+
+  // Calls finish().
+  SUTILAPI ~ParticleCacheWriter();
+
+  SUTILAPI bool isOpen() const;
+
+  // Appends a frame. positions and velocities hold 3 floats per particle.
+  SUTILAPI bool writeFrame( float time,
+                            uint32_t particle_count,
+                            const float* positions,
+                            const float* velocities );
+
+  // Writes the frame table and the final header. Frames can not be added afterwards.
+  SUTILAPI bool finish();
+
+  SUTILAPI bool     failed() const;
+  SUTILAPI uint32_t frameCount() const;
+  SUTILAPI uint64_t bytesWritten() const;
+
+private:
+  FILE*                                m_file;
+  ParticleCacheHeader                  m_header;
+  std::vector<ParticleCacheFrameEntry> m_frames;
+  uint64_t                             m_offset;
+  std::vector<unsigned char>           m_scratch;
+  bool                                 m_failed;
+
+  bool write( const void* data, size_t size );
+
+  ParticleCacheWriter( const ParticleCacheWriter& );
+  ParticleCacheWriter& operator=( const ParticleCacheWriter& );
+};
+
+
+//-----------------------------------------------------------------------------
+//
+// ParticleCacheFrame
+//
+// One frame of a particle cache, mapped into memory by ParticleCacheReader.
+// The encoded arrays point straight into the mapping, so the frame has to be
+// kept alive for as long as they are used.
+//
+//-----------------------------------------------------------------------------
+
+class ParticleCacheFrame
+{
+public:
+  SUTILAPI ParticleCacheFrame();
+  SUTILAPI ~ParticleCacheFrame();
+
+  // Unmaps the frame.
+  SUTILAPI void release();
+
+  SUTILAPI bool                            valid() const;
+  SUTILAPI const ParticleCacheFrameHeader& header() const;
+  SUTILAPI uint32_t                        particleCount() const;
+  SUTILAPI float                           time() const;
+  SUTILAPI ParticleCacheEncoding           encoding() const;
+
+  // Encoded (see encoding()) xyz components of every particle.
+  SUTILAPI const void* positionData() const;
+  SUTILAPI const void* velocityData() const;
+
+  // Decodes to 3 floats per particle.
+  SUTILAPI void decodePositions( float* positions ) const;
+  SUTILAPI void decodeVelocities( float* velocities ) const;
+
+private:
+  friend class ParticleCacheReader;
+
+  void*                      m_mapping;       // Page aligned start of the mapping (if mapped).
+  size_t                     m_mapping_size;
+  std::vector<unsigned char> m_copy;          // Used instead of a mapping where mmap is not available.
+  const unsigned char*       m_data;          // Start of the frame header.
+
+  ParticleCacheFrame( const ParticleCacheFrame& );
+  ParticleCacheFrame& operator=( const ParticleCacheFrame& );
+};
+
+
+//-----------------------------------------------------------------------------
+//
+// ParticleCacheReader
+//
+//-----------------------------------------------------------------------------
+
+class ParticleCacheReader
+{
+public:
+  SUTILAPI explicit ParticleCacheReader( const std::string& filename );
+  SUTILAPI ~ParticleCacheReader();
+
+  SUTILAPI bool                           isOpen() const;
+  SUTILAPI const ParticleCacheHeader&     header() const;
+  SUTILAPI uint32_t                       frameCount() const;
+  SUTILAPI const ParticleCacheFrameEntry& frameEntry( uint32_t index ) const;
+
+  // Maps frame index into frame, replacing whatever frame was mapped before. O(1) in the amount of frames.
+  SUTILAPI bool mapFrame( uint32_t index, ParticleCacheFrame& frame ) const;
+
+private:
+  FILE*                                m_file;
+  ParticleCacheHeader                  m_header;
+  std::vector<ParticleCacheFrameEntry> m_frames;
+  uint64_t                             m_file_size;
+
+  bool readAt( uint64_t offset, void* data, size_t size ) const;
+  void recoverFrames();
+
+  ParticleCacheReader( const ParticleCacheReader& );
+  ParticleCacheReader& operator=( const ParticleCacheReader& );
+};
+
+// True if filename starts with PARTICLE_CACHE_MAGIC.
+SUTILAPI bool isParticleCacheFile( const std::string& filename );